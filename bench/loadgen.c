@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Load generator for the Gnuddels server
+//
+// storm: Opens all connections at once and measures the time until every
+//        connection is accepted and answered by the server
+// chat:  Connects all clients and lets them broadcast messages with a fixed
+//        rate, measures the throughput and the latency of the broadcasts.
+//        With -t only the first clients talk, the others just listen
+// hold:  Connects all clients, keeps them open for a fixed time and checks
+//        afterwards how many of them are still served, e.g. after a restart
+//
+// The port can be a list like "7001,7002", the clients are spread over the
+// servers of a network then. A host starting with '/' is the path of the
+// unix socket of the server, the port is ignored then
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <netdb.h>
+
+#define MODE_STORM 0
+#define MODE_CHAT  1
+#define MODE_HOLD  2
+
+#define STATE_CONNECTING 0
+#define STATE_WAITING    1
+#define STATE_READY      2
+#define STATE_FAILED     3
+
+#define LINE_SIZE 65536
+
+typedef struct Connection {
+    int socket;
+    int state;
+    // Incomplete line of the last read
+    char *line;
+    int lineSize;
+    // Sequence number of the next chat message
+    long seq;
+} Connection;
+
+// Latency histogram with buckets of 10 microseconds up to 10 seconds
+#define HISTOGRAM_RESOLUTION 10
+#define HISTOGRAM_SIZE 1000000
+
+static long long histogram[HISTOGRAM_SIZE + 1];
+static long long samples;
+static long long maxLatency;
+
+static Connection *connections;
+static int clients = 100;
+static int mode = MODE_STORM;
+static int rate = 10;
+// Clients sending messages in the chat mode, 0 = all
+static int talkers = 0;
+static int duration = 10;
+static int msgSize = 32;
+static char *host = "localhost";
+static char *port = NULL;
+
+// Longest list of ports
+#define MAX_PORTS 16
+
+static int epollFd;
+static struct addrinfo *addresses[MAX_PORTS];
+static int addressCount;
+
+// Address of the server when the host is a unix socket
+static struct sockaddr_un unixAddress;
+static struct addrinfo unixInfo;
+
+static int connected;
+static int answered;
+static int failed;
+static long long bytesReceived;
+static long long messagesSent;
+
+long long now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000LL + now.tv_nsec / 1000LL;
+}
+
+int parseArguments(int argc, char **args) {
+    int opt;
+    while ((opt = getopt(argc, args, "h:p:m:c:r:t:d:s:")) != -1) {
+        switch (opt) {
+            case 'h':
+                host = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 'm':
+                if (strcmp(optarg, "storm") == 0)
+                    mode = MODE_STORM;
+                else if (strcmp(optarg, "chat") == 0)
+                    mode = MODE_CHAT;
+                else if (strcmp(optarg, "hold") == 0)
+                    mode = MODE_HOLD;
+                else
+                    return EXIT_FAILURE;
+                break;
+            case 'c':
+                clients = atoi(optarg);
+                break;
+            case 'r':
+                rate = atoi(optarg);
+                break;
+            case 't':
+                talkers = atoi(optarg);
+                break;
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 's':
+                msgSize = atoi(optarg);
+                break;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    if ((port == NULL && host[0] != '/') || clients <= 0 || talkers < 0 || talkers > clients)
+        return EXIT_FAILURE;
+    if (talkers == 0)
+        talkers = clients;
+    return EXIT_SUCCESS;
+}
+
+int sendLine(Connection *con, char *line, int len) {
+    // Lines are short, a full socket buffer counts as a lost message
+    int sent = send(con->socket, line, len, MSG_NOSIGNAL);
+    return (sent == len ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+void fail(Connection *con) {
+    if (con->state == STATE_FAILED)
+        return;
+    con->state = STATE_FAILED;
+    ++failed;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, con->socket, NULL);
+    close(con->socket);
+}
+
+int openConnection(Connection *con, struct addrinfo *address) {
+    con->socket = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK, address->ai_protocol);
+    if (con->socket < 0) {
+        perror("Can't create new socket!");
+        return EXIT_FAILURE;
+    }
+    // Unix sockets don't grow their send buffer like TCP
+    if (address->ai_family == AF_UNIX) {
+        int size = 4 * 1024 * 1024;
+        setsockopt(con->socket, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+    con->state = STATE_CONNECTING;
+    con->lineSize = 0;
+    con->seq = 0;
+    if (connect(con->socket, address->ai_addr, address->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        perror("connect() failed");
+        close(con->socket);
+        return EXIT_FAILURE;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.ptr = con;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, con->socket, &event);
+    return EXIT_SUCCESS;
+}
+
+void recordLatency(long long latency) {
+    if (latency < 0)
+        latency = 0;
+    long long bucket = latency / HISTOGRAM_RESOLUTION;
+    if (bucket > HISTOGRAM_SIZE)
+        bucket = HISTOGRAM_SIZE;
+    histogram[bucket]++;
+    samples++;
+    if (latency > maxLatency)
+        maxLatency = latency;
+}
+
+long long percentile(double p) {
+    long long rank = (long long)(samples * p);
+    long long count = 0;
+    int i;
+    for (i = 0; i <= HISTOGRAM_SIZE; ++i) {
+        count += histogram[i];
+        if (count > rank)
+            return (long long)i * HISTOGRAM_RESOLUTION;
+    }
+    return maxLatency;
+}
+
+void handleLine(Connection *con, char *line, int len, long long now) {
+    // Keepalive of the server
+    if (len == 5 && strncmp(line, "/ping", 5) == 0) {
+        sendLine(con, "/pong\n", 6);
+        return;
+    }
+    // Answer on our ping
+    if (len == 5 && strncmp(line, "/pong", 5) == 0) {
+        if (con->state == STATE_WAITING) {
+            con->state = STATE_READY;
+            ++answered;
+        }
+        return;
+    }
+    // Broadcast of a chat message: "[name]: lg <sent timestamp> ..."
+    char *msg = memmem(line, len, "]: lg ", 6);
+    if (msg != NULL) {
+        recordLatency(now - strtoll(msg + 6, NULL, 10));
+    }
+}
+
+void readConnection(Connection *con, long long now) {
+    char buffer[LINE_SIZE];
+    while (true) {
+        int bytes_read = read(con->socket, buffer, sizeof(buffer));
+        if (bytes_read == 0) {
+            fail(con);
+            return;
+        }
+        if (bytes_read < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fail(con);
+            return;
+        }
+        bytesReceived += bytes_read;
+        // Split input into lines
+        char *start = buffer;
+        char *end = buffer + bytes_read;
+        char *delimiter;
+        while ((delimiter = memchr(start, '\n', end - start)) != NULL) {
+            int len = delimiter - start;
+            // Complete the incomplete line of the last read
+            if (con->lineSize > 0) {
+                int copy = (con->lineSize + len > LINE_SIZE ? LINE_SIZE - con->lineSize : len);
+                memcpy(con->line + con->lineSize, start, copy);
+                handleLine(con, con->line, con->lineSize + copy, now);
+                con->lineSize = 0;
+            }
+            else {
+                handleLine(con, start, len, now);
+            }
+            start = delimiter + 1;
+        }
+        // Store the incomplete line, overlong lines are cut
+        int rest = end - start;
+        if (con->lineSize + rest > LINE_SIZE)
+            rest = LINE_SIZE - con->lineSize;
+        memcpy(con->line + con->lineSize, start, rest);
+        con->lineSize += rest;
+    }
+}
+
+void handleEvent(struct epoll_event *event, long long now) {
+    Connection *con = event->data.ptr;
+    if (con->state == STATE_FAILED)
+        return;
+    if (con->state == STATE_CONNECTING && (event->events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) != 0) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(con->socket, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (error != 0) {
+            fail(con);
+            return;
+        }
+        ++connected;
+        // The answer on the ping proves the client is served by the server loop
+        con->state = STATE_WAITING;
+        sendLine(con, "/ping\n", 6);
+        struct epoll_event modified;
+        modified.events = EPOLLIN;
+        modified.data.ptr = con;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, con->socket, &modified);
+    }
+    if ((event->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0) {
+        readConnection(con, now);
+    }
+}
+
+#define MAX_EVENTS 1024
+
+// Processes events until timeout (in microseconds) is reached
+void processEvents(long long until) {
+    struct epoll_event events[MAX_EVENTS];
+    long long now = now_us();
+    int timeout = (until - now) / 1000;
+    if (timeout < 0)
+        timeout = 0;
+    int res = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+    now = now_us();
+    int i;
+    for (i = 0; i < res; ++i) {
+        handleEvent(&events[i], now);
+    }
+}
+
+int connectAll(long long timeout) {
+    long long start = now_us();
+    int i;
+    for (i = 0; i < clients; ++i) {
+        if (openConnection(&connections[i], addresses[i % addressCount]) == EXIT_FAILURE) {
+            connections[i].state = STATE_FAILED;
+            ++failed;
+        }
+    }
+    long long allConnected = 0;
+    while (answered + failed < clients && now_us() - start < timeout) {
+        processEvents(now_us() + 10000);
+        if (allConnected == 0 && connected + failed >= clients)
+            allConnected = now_us();
+    }
+    long long end = now_us();
+    printf("connections:    %d (%d failed)\n", clients, failed);
+    printf("all connected:  %.3f ms\n", ((allConnected == 0 ? end : allConnected) - start) / 1000.0);
+    printf("all answered:   %.3f ms (%d answered)\n", (end - start) / 1000.0, answered);
+    printf("bytes received: %lld\n", bytesReceived);
+    return (answered == clients ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+void chat(void) {
+    char *msg = malloc(msgSize + 64);
+    long long start = now_us();
+    long long end = start + duration * 1000000LL;
+    // Time between two messages of all clients together
+    double interval = 1000000.0 / ((double)rate * talkers);
+    long long receivedBefore = samples;
+    long long next = start;
+    int current = 0;
+    while (now_us() < end) {
+        long long now = now_us();
+        // Send all messages which are due
+        while (next <= now) {
+            Connection *con = &connections[current];
+            current = (current + 1) % talkers;
+            next = start + (long long)(++messagesSent * interval);
+            if (con->state != STATE_READY)
+                continue;
+            int len = snprintf(msg, 64, "lg %lld %ld ", now_us(), con->seq++);
+            while (len < msgSize)
+                msg[len++] = 'x';
+            msg[len++] = '\n';
+            if (sendLine(con, msg, len) == EXIT_FAILURE)
+                fail(con);
+        }
+        processEvents(next < end ? next : end);
+    }
+    // Wait for messages still on their way
+    long long drain = now_us() + 2000000LL;
+    long long expected = messagesSent * (clients - failed);
+    while (now_us() < drain && samples - receivedBefore < expected) {
+        processEvents(now_us() + 10000);
+    }
+    double seconds = (now_us() - start) / 1000000.0;
+    printf("messages sent:  %lld\n", messagesSent);
+    printf("delivered:      %lld of %lld (%.0f/s)\n", samples, expected, samples / seconds);
+    printf("latency p50:    %.3f ms\n", percentile(0.50) / 1000.0);
+    printf("latency p99:    %.3f ms\n", percentile(0.99) / 1000.0);
+    printf("latency p99.9:  %.3f ms\n", percentile(0.999) / 1000.0);
+    printf("latency max:    %.3f ms\n", maxLatency / 1000.0);
+    free(msg);
+}
+
+void hold(void) {
+    long long end = now_us() + duration * 1000000LL;
+    while (now_us() < end) {
+        processEvents(end);
+    }
+    // Every connection still served answers a new ping
+    long long start = now_us();
+    answered = 0;
+    int alive = 0;
+    int i;
+    for (i = 0; i < clients; ++i) {
+        Connection *con = &connections[i];
+        if (con->state != STATE_READY)
+            continue;
+        con->state = STATE_WAITING;
+        if (sendLine(con, "/ping\n", 6) == EXIT_FAILURE)
+            fail(con);
+        else
+            ++alive;
+    }
+    while (answered < alive && now_us() - start < 10000000LL) {
+        processEvents(now_us() + 10000);
+    }
+    printf("still served:   %d of %d (%d failed)\n", answered, clients, failed);
+}
+
+int main(int argc, char **args) {
+    if (parseArguments(argc, args) == EXIT_FAILURE) {
+        printf("Usage: %s -p Port[,Port]... [-h Host|Unix socket] [-m storm|chat|hold] [-c Clients] [-r Messages/s per client] [-t Talkers] [-d Seconds] [-s Message size]\n", args[0]);
+        return EXIT_FAILURE;
+    }
+    // Every client needs its own file descriptor
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0 , sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (host[0] == '/') {
+        unixAddress.sun_family = AF_UNIX;
+        strncpy(unixAddress.sun_path, host, sizeof(unixAddress.sun_path) - 1);
+        unixInfo.ai_family = AF_UNIX;
+        unixInfo.ai_socktype = SOCK_STREAM;
+        unixInfo.ai_addr = (struct sockaddr*)&unixAddress;
+        unixInfo.ai_addrlen = sizeof(unixAddress);
+        addresses[addressCount++] = &unixInfo;
+    }
+    else {
+        char *next;
+        for (next = strtok(port, ","); next != NULL && addressCount < MAX_PORTS; next = strtok(NULL, ",")) {
+            int error = getaddrinfo(host, next, &hints, &addresses[addressCount]);
+            if (error != 0) {
+                fprintf(stderr, "Can't resolve %s: %s\n", host, gai_strerror(error));
+                return EXIT_FAILURE;
+            }
+            ++addressCount;
+        }
+    }
+
+    epollFd = epoll_create1(0);
+    connections = calloc(clients, sizeof(Connection));
+    int i;
+    for (i = 0; i < clients; ++i) {
+        connections[i].line = malloc(LINE_SIZE);
+    }
+
+    if (connectAll(60000000LL) == EXIT_SUCCESS) {
+        if (mode == MODE_CHAT)
+            chat();
+        else if (mode == MODE_HOLD)
+            hold();
+    }
+
+    for (i = 0; i < clients; ++i) {
+        if (connections[i].state != STATE_FAILED)
+            close(connections[i].socket);
+        free(connections[i].line);
+    }
+    free(connections);
+    for (i = 0; i < addressCount; ++i) {
+        if (addresses[i] != &unixInfo)
+            freeaddrinfo(addresses[i]);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Simulation of the Gnuddels server without the kernel
+//
+// The server logic runs with the memory transport and a simulated clock,
+// the simulated clients feed their messages directly into the buffers the
+// server reads and everything the server writes is only counted. Equal
+// arguments always give the same run, the checksum of all written bytes
+// proves it.
+//
+// -c Clients          connected clients
+// -t Talkers          clients sending messages, the first ones
+// -r Messages/s       of every talker
+// -d Seconds          simulated time
+// -s Message size
+// -w Window           bytes a client can have unread, 0 = reads everything
+// -b Bytes/ms         a client reads when it has a window
+// -o name=value       options of the server
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../server/server.h"
+#include "../server/config.h"
+#include "../server/transport.h"
+#include "../server/log.h"
+#include "../common/time/clock.h"
+
+static int clients = 10000;
+static int talkers = 10;
+static int rate = 10;
+static int duration = 10;
+static int msgSize = 32;
+static int window = 0;
+static int readRate = 1000;
+
+// Clients whose input wasn't read completely
+static int *inputList;
+static int inputCount;
+static bool *inputQueued;
+
+// Simulated clock in milliseconds
+static long long now;
+
+static long long
+now_us(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000LL + t.tv_nsec / 1000LL;
+}
+
+static int
+parse_options(int argc, char **args) {
+    int opt;
+    while ((opt = getopt(argc, args, "c:t:r:d:s:w:b:o:")) != -1) {
+        switch (opt) {
+            case 'c':
+                clients = atoi(optarg);
+                break;
+            case 't':
+                talkers = atoi(optarg);
+                break;
+            case 'r':
+                rate = atoi(optarg);
+                break;
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 's':
+                msgSize = atoi(optarg);
+                break;
+            case 'w':
+                window = atoi(optarg);
+                break;
+            case 'b':
+                readRate = atoi(optarg);
+                break;
+            case 'o':
+                if (Config_set(optarg) == EXIT_FAILURE)
+                    return EXIT_FAILURE;
+                break;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    if (clients <= 0 || talkers < 0 || talkers > clients || rate <= 0 || rate > 1000 || msgSize < 1)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+// Handles the input of a client like a POLLIN, if the server polls it
+static void
+poll_input(int socket) {
+    int index = socket - MEMORY_FIRST_SOCKET;
+    if (search_client(socket) == NULL)
+        return;
+    if ((watched_events(socket) & POLLIN) == 0) {
+        // Paused by the server, tried again in the next millisecond
+        if (!inputQueued[index]) {
+            inputQueued[index] = true;
+            inputList[inputCount++] = socket;
+        }
+        return;
+    }
+    client_event(socket, POLLIN);
+}
+
+int main(int argc, char **args) {
+    // The simulated clients never answer a ping, talk as fast as asked and
+    // everything runs in the server loop
+    config.pingInterval = 0;
+    config.rateMsgs = 0;
+    config.rateBytes = 0;
+    config.workers = 0;
+    config.ioThreads = 0;
+    // The measurements collect the join notices of the connecting clients
+    config.presenceWindow = 500;
+    int i;
+    for (i = 0; i < LOG_SUBSYSTEMS; ++i) {
+        logLevels[i] = LOG_OFF;
+    }
+    if (parse_options(argc, args) == EXIT_FAILURE) {
+        printf("Usage: %s [-c Clients] [-t Talkers] [-r Messages/s per talker] [-d Seconds] [-s Message size] [-w Window] [-b Bytes/ms] [-o name=value]...\n", args[0]);
+        Config_printUsage();
+        return EXIT_FAILURE;
+    }
+    now = 1000000;
+    simulateClock(&now);
+    if (simulation_init() == EXIT_FAILURE)
+        return EXIT_FAILURE;
+
+    inputList = malloc(sizeof(int) * clients);
+    inputQueued = calloc(clients, sizeof(bool));
+    char name[32];
+    long long start = now_us();
+    for (i = 0; i < clients; ++i) {
+        int socket = Memory_open(window);
+        snprintf(name, sizeof(name), "sim%d", i);
+        if (socket < 0 || connect_client(socket, name, false) == NULL)
+            return EXIT_FAILURE;
+    }
+    long long connectTime = now_us() - start;
+
+    // A talker sends every interval ms, the talkers are spread over it
+    int interval = 1000 / rate;
+    char *msg = malloc(msgSize + 1);
+    memset(msg, 'x', msgSize);
+    msg[msgSize] = '\n';
+    long long sent = 0;
+    long long end = now + duration * 1000LL;
+    start = now_us();
+    for (; now < end; ++now) {
+        int slot = now % interval;
+        for (i = slot * talkers / interval; i < (slot + 1) * talkers / interval; ++i) {
+            int socket = MEMORY_FIRST_SOCKET + i;
+            if (Memory_feed(socket, msg, msgSize + 1) == EXIT_SUCCESS) {
+                ++sent;
+                poll_input(socket);
+            }
+        }
+        // Input which waited for its client
+        int count = inputCount;
+        inputCount = 0;
+        for (i = 0; i < count; ++i) {
+            inputQueued[inputList[i] - MEMORY_FIRST_SOCKET] = false;
+            poll_input(inputList[i]);
+        }
+        // Clients with a window read a part of it
+        if (window > 0) {
+            for (i = 0; i < clients; ++i) {
+                int socket = MEMORY_FIRST_SOCKET + i;
+                if (Memory_read(socket, readRate) > 0 && search_client(socket) != NULL
+                    && (watched_events(socket) & POLLOUT) != 0) {
+                    client_event(socket, POLLOUT);
+                }
+            }
+        }
+        simulation_step();
+    }
+    long long elapsed = now_us() - start;
+
+    long long received = 0;
+    int connected = 0;
+    for (i = 0; i < clients; ++i) {
+        received += Memory_received(MEMORY_FIRST_SOCKET + i);
+        if (search_client(MEMORY_FIRST_SOCKET + i) != NULL)
+            ++connected;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("clients:        %d (%d still connected), connected in %.3f s\n", clients, connected, connectTime / 1000000.0);
+    printf("simulated:      %d s, %lld messages sent\n", duration, sent);
+    printf("real time:      %.3f s (%.0f messages/s)\n", elapsed / 1000000.0, sent / (elapsed / 1000000.0));
+    printf("bytes written:  %lld (%.0f MB/s)\n", received, received / (elapsed / 1000000.0) / 1000000.0);
+    printf("peak RSS:       %ld KB\n", usage.ru_maxrss);
+    printf("checksum:       %016lx\n", Memory_checksum());
+    free(msg);
+    return EXIT_SUCCESS;
+}
@@ -27,6 +27,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -42,10 +43,15 @@
 // Methods only called when server is starting / stopping
 // *******************************************************
 
+#define IN_BUFFER_SIZE 4096
+
 static int clientSocket;
 static int infd;
 static int outfd;
 
+// Reassembly buffer for the messages received from the server
+static StringBuffer *serverBuffer;
+
 int initClient(int argc, char **args, int infd_, int outfd_) {
 
     puts("Start Client...");
@@ -66,6 +72,11 @@ int initClient(int argc, char **args, int infd_, int outfd_) {
     if (initPoll() == EXIT_FAILURE) {
         return EXIT_FAILURE;
     }
+
+    serverBuffer = StringBuffer_construct_n(IN_BUFFER_SIZE);
+    if (serverBuffer == NULL) {
+        return EXIT_FAILURE;
+    }
     printf("Gnuddels-Client connected to %s on port %s!\n", host, port);
 
     return EXIT_SUCCESS;
@@ -223,11 +234,16 @@ void clientLoop(void) {
         }
     }
 }
-#define IN_BUFFER_SIZE 4096
 static char inBuffer[IN_BUFFER_SIZE + 1] = {0};
 
-int read_from_server(void ) {
-    int bytes_read = read(clientSocket, inBuffer, IN_BUFFER_SIZE);
+int read_from_server(void) {
+    // Make sure a complete read fits behind the incomplete message
+    if (serverBuffer->capacity - serverBuffer->size < IN_BUFFER_SIZE) {
+        if (StringBuffer_resize(serverBuffer, serverBuffer->size + IN_BUFFER_SIZE) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+    // Read directly behind the incomplete message of the last read
+    int bytes_read = read(clientSocket, serverBuffer->buffer + serverBuffer->size, IN_BUFFER_SIZE);
     if (bytes_read == 0) {
         perror("server closed connection!");
         return EXIT_FAILURE;
@@ -236,10 +252,83 @@ int read_from_server(void ) {
         perror("read failed!");
         return EXIT_FAILURE;
     }
-    // Copy received message to the client buffer
-    write(outfd, inBuffer, bytes_read);
-    write(outfd, "\n", 1);
-    
+    serverBuffer->size = serverBuffer->size + bytes_read;
+    serverBuffer->buffer[serverBuffer->size] = '\0';
+
+    return forward_messages();
+}
+
+#define MSG_DELIMITER '\n'
+
+#define COMMAND_START '/'
+// Maximum number of pieces written to the GUI by a single writev. A piece
+// is a run of adjacent messages, the keepalives between the runs are
+// skipped, so the pieces aren't contiguous.
+#define GUI_BATCH_SIZE 64
+
+int forward_messages(void) {
+    struct iovec batch[GUI_BATCH_SIZE];
+    int batchSize = 0;
+
+    char *start = serverBuffer->buffer;
+    char *end = serverBuffer->buffer + serverBuffer->size;
+    char *delimiter;
+    // Collect every complete message in the buffer
+    while ((delimiter = memchr(start, MSG_DELIMITER, end - start)) != NULL) {
+        // Message including its delimiter
+        int len = delimiter - start + 1;
+        // Keepalives are answered here, other lines starting with
+        // COMMAND_START (roster updates, session tokens) go to the GUI
+        if (*start == COMMAND_START && is_server_command(start, len - 1)) {
+            if (handle_server_command(start, len - 1) == EXIT_FAILURE)
+                return EXIT_FAILURE;
+            start = delimiter + 1;
+            continue;
+        }
+        // Follows the last message directly, the piece is extended. Only
+        // a skipped keepalive starts a new piece.
+        if (batchSize > 0 && (char*)batch[batchSize - 1].iov_base + batch[batchSize - 1].iov_len == start) {
+            batch[batchSize - 1].iov_len += len;
+        }
+        else {
+            // Batch is full -> write it to the GUI
+            if (batchSize == GUI_BATCH_SIZE) {
+                if (writevAll(outfd, batch, batchSize) == EXIT_FAILURE) {
+                    perror("write to gui failed!");
+                    return EXIT_FAILURE;
+                }
+                batchSize = 0;
+            }
+            batch[batchSize].iov_base = start;
+            batch[batchSize].iov_len = len;
+            ++batchSize;
+        }
+        start = delimiter + 1;
+    }
+    if (batchSize > 0 && writevAll(outfd, batch, batchSize) == EXIT_FAILURE) {
+        perror("write to gui failed!");
+        return EXIT_FAILURE;
+    }
+
+    // Move the incomplete message to the beginning of the buffer
+    int rest = end - start;
+    memmove(serverBuffer->buffer, start, rest);
+    serverBuffer->size = rest;
+    serverBuffer->buffer[serverBuffer->size] = '\0';
+
+    return EXIT_SUCCESS;
+}
+
+bool is_server_command(char *command, int len) {
+    // Only the keepalive of the server is handled by the client itself
+    return len == 5 && strncmp(command, "/ping", len) == 0;
+}
+
+int handle_server_command(char *command, int len) {
+    // Keepalive of the server
+    if (len == 5 && strncmp(command, "/ping", len) == 0) {
+        return sendAll(clientSocket, "/pong\n", 6);
+    }
     return EXIT_SUCCESS;
 }
 
@@ -254,4 +343,6 @@ int read_from_gui(void) {
         return EXIT_FAILURE;
     }
     sendAll(clientSocket, inBuffer, bytes_read);
-} 
+
+    return EXIT_SUCCESS;
+}
@@ -15,6 +15,8 @@
  * You should have received a copy of the GNU General Public License
  * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
  */
+
+#include <stdbool.h>
   
 // Methods only called when client is starting / stopping
 
@@ -34,4 +36,10 @@ void clientLoop(void);
 
 int read_from_server(void);
 
+int forward_messages(void);
+
+bool is_server_command(char *command, int len);
+
+int handle_server_command(char *command, int len);
+
 int read_from_gui(void);
@@ -23,6 +23,14 @@
 
 #define STANDARD_SIZE 16
 
+// Changed by every thread building messages
+static long allocatedBytes;
+
+static void
+StringBuffer_count(long bytes) {
+    __atomic_add_fetch(&allocatedBytes, bytes, __ATOMIC_RELAXED);
+}
+
 StringBuffer
 *StringBuffer_construct() {
     return StringBuffer_construct_n(STANDARD_SIZE);
@@ -45,6 +53,7 @@ StringBuffer
     ptr->buffer = buffer;
     ptr->size = 0;
     ptr->capacity = capacity;
+    StringBuffer_count(sizeof(StringBuffer) + capacity + 1);
     
     return ptr;
 }
@@ -58,7 +67,7 @@ StringBuffer
 *StringBuffer_concat_n(StringBuffer *ptr, char *string, size_t len) {
     // Need to resize the buffer
     // Always the double len
-    if (ptr->size + len > ptr->capacity) {
+    if (ptr->size + len > (size_t)ptr->capacity) {
         // Search for the new capacity...maybe we can solve this with mathematica...
         int newCapacity = ptr->capacity;
         int t = ptr->size + len;
@@ -88,6 +97,7 @@ StringBuffer_resize(StringBuffer *ptr, int newCapacity) {
         return EXIT_FAILURE;        
     }
     ptr->buffer = buffer;
+    StringBuffer_count(newCapacity - ptr->capacity);
     ptr->capacity = newCapacity;
     return EXIT_SUCCESS;
 }
@@ -98,6 +108,8 @@ StringBuffer_free(StringBuffer *ptr) {
         return;    
     if (ptr->buffer != NULL)    
         free(ptr->buffer);
+    StringBuffer_count(-(long)(sizeof(StringBuffer) + ptr->capacity + 1));
+    free(ptr);
 }
 
 void
@@ -106,3 +118,8 @@ StringBuffer_clear(StringBuffer *ptr) {
         ptr->buffer[0] = '\0';
     ptr->size = 0;
 }
+
+long
+StringBuffer_allocated(void) {
+    return __atomic_load_n(&allocatedBytes, __ATOMIC_RELAXED);
+}
@@ -47,4 +47,8 @@ StringBuffer_free(StringBuffer *ptr);
 void
 StringBuffer_clear(StringBuffer *ptr);
 
+// Bytes of all StringBuffers which weren't freed yet
+long
+StringBuffer_allocated(void);
+
 #endif
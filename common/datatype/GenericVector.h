@@ -117,6 +117,24 @@ name##Vector_removeAt(name##Vector *vector, int index, type *holder) { \
     return holder; \
 } \
 \
+/* Removes the element by moving the last element to its position */ \
+static type* \
+name##Vector_removeFast(name##Vector *vector, int index, type *holder) { \
+    if (vector == NULL) { \
+        perror("vector is null!"); \
+        return NULL; \
+    } \
+    if (index < 0 || index >= vector->size) { \
+        fprintf(stderr , "Index %d outside of vector (size = %d)\n", index, vector->size); \
+        return NULL; \
+    } \
+    if (holder != NULL) \
+        *holder = vector->elements[index]; \
+    vector->size = vector->size - 1; \
+    vector->elements[index] = vector->elements[vector->size]; \
+    return holder; \
+} \
+\
 static int \
 name##Vector_remove(name##Vector *vector, type *e, int (*equals)(type *e1, type *e2)) { \
     if (vector == NULL) { \
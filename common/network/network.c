@@ -16,43 +16,152 @@
  * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
  */
  
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include <netinet/in.h>
+#include <poll.h>
 
 #include "network.h"
 
-#define OUT_BUFFER_SIZE 4096
+int initTransferStage(TransferStage *stage, int capacity, bool zeroCopy) {
+    stage->size = 0;
+    stage->offset = 0;
+    stage->buffer = NULL;
+    stage->pipe[0] = -1;
+    stage->pipe[1] = -1;
+    if (zeroCopy) {
+        if (pipe2(stage->pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+            perror("Can't create pipe!");
+            return EXIT_FAILURE;
+        }
+        // A bigger pipe needs less splice calls, the kernel may give less
+        fcntl(stage->pipe[1], F_SETPIPE_SZ, capacity);
+        int size = fcntl(stage->pipe[1], F_GETPIPE_SZ);
+        stage->capacity = (size > 0 ? size : capacity);
+    }
+    else {
+        stage->buffer = malloc(capacity);
+        if (stage->buffer == NULL) {
+            perror("Insufficent memory!");
+            return EXIT_FAILURE;
+        }
+        stage->capacity = capacity;
+    }
+    return EXIT_SUCCESS;
+}
 
-int transferFile(int source, int destination, char *buffer) {
-    
-    memset(buffer, 0, OUT_BUFFER_SIZE);
-    int bytes_read;
-    while((bytes_read = read(source, buffer, OUT_BUFFER_SIZE)) > 0) {
-        if (sendAll(destination, buffer, bytes_read) == -1)
-            return -1;
+void freeTransferStage(TransferStage *stage) {
+    if (stage->pipe[0] >= 0) {
+        close(stage->pipe[0]);
+        close(stage->pipe[1]);
     }
+    free(stage->buffer);
+}
 
-    return EXIT_SUCCESS;
+int transferFill(TransferStage *stage, int source, int len) {
+    // Free space behind the staged bytes
+    int space = stage->capacity - stage->offset - stage->size;
+    if (len > space)
+        len = space;
+    int res;
+    do {
+        if (stage->buffer == NULL)
+            res = splice(source, NULL, stage->pipe[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        else
+            res = read(source, stage->buffer + stage->offset + stage->size, len);
+    } while (res < 0 && errno == EINTR);
+    if (res > 0)
+        stage->size += res;
+    return res;
+}
+
+int transferDrain(TransferStage *stage, int destination) {
+    int res;
+    do {
+        if (stage->buffer == NULL)
+            res = splice(stage->pipe[0], NULL, destination, NULL, stage->size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+        else
+            res = send(destination, stage->buffer + stage->offset, stage->size, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (res < 0 && errno == EINTR);
+    if (res > 0) {
+        stage->size -= res;
+        if (stage->buffer != NULL)
+            stage->offset = (stage->size == 0 ? 0 : stage->offset + res);
+    }
+    return res;
 }
 
+int transferPad(TransferStage *stage, int len) {
+    static const char zeros[4096];
+    int space = stage->capacity - stage->offset - stage->size;
+    if (len > space)
+        len = space;
+    if (len > (int)sizeof(zeros))
+        len = sizeof(zeros);
+    if (stage->buffer != NULL) {
+        memset(stage->buffer + stage->offset + stage->size, 0, len);
+        stage->size += len;
+        return len;
+    }
+    int res = write(stage->pipe[1], zeros, len);
+    if (res > 0)
+        stage->size += res;
+    return res;
+}
+
+// Milliseconds to wait for a full non blocking socket
+#define SEND_TIMEOUT 5000
+
 int sendAll(int dest, char *data, int dataLength) {
-    int sent = send(dest, data, dataLength,MSG_NOSIGNAL );
-    if (sent == -1)
-        return EXIT_FAILURE;
-    if (sent != dataLength) {
-        char *p = data;
-        do {
-            dataLength -= sent;
-            p += sent;
-            sent = send(dest, p, dataLength,MSG_NOSIGNAL);
-            if (sent == -1)
-                return EXIT_FAILURE;
-        } while (dataLength > 0);
+    char *p = data;
+    while (dataLength > 0) {
+        int sent = send(dest, p, dataLength, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+            // Non blocking socket is full, wait until it can be written again
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pollfd;
+                pollfd.fd = dest;
+                pollfd.events = POLLOUT;
+                if (poll(&pollfd, 1, SEND_TIMEOUT) > 0)
+                    continue;
+            }
+            return EXIT_FAILURE;
+        }
+        dataLength -= sent;
+        p += sent;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int writevAll(int dest, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t written = writev(dest, iov, iovcnt);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return EXIT_FAILURE;
+        }
+        // Skip all completely written parts
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        // Continue with the rest of a partial written part
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
     }
 
     return EXIT_SUCCESS;
@@ -19,8 +19,33 @@
 #ifndef NETWORK_h
 #define NETWORK_h
 
-int transferFile(int source, int destination, char *buffer);
+#include <stdbool.h>
+#include <sys/uio.h>
+
+// Data on its way from one socket to another. With a pipe the data is
+// spliced and never copied to user space, otherwise it is copied through
+// the buffer.
+typedef struct TransferStage {
+    int pipe[2];
+    char *buffer;
+    int capacity;
+    // Staged bytes, in the buffer they start at offset
+    int size;
+    int offset;
+} TransferStage;
+
+int initTransferStage(TransferStage *stage, int capacity, bool zeroCopy);
+
+void freeTransferStage(TransferStage *stage);
+
+int transferFill(TransferStage *stage, int source, int len);
+
+int transferDrain(TransferStage *stage, int destination);
+
+int transferPad(TransferStage *stage, int len);
 
 int sendAll(int dest, char *data, int dataLength);
 
+int writevAll(int dest, struct iovec *iov, int iovcnt);
+
 #endif
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "clock.h"
+
+// Time of a simulation, NULL for the real clocks
+static long long *simulatedTime;
+
+void simulateClock(long long *now) {
+    simulatedTime = now;
+}
+
+long long currentTimeMillis(void) {
+    if (simulatedTime != NULL)
+        return *simulatedTime;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000LL + now.tv_nsec / 1000000LL;
+}
+
+long long wallTimeMillis(void) {
+    if (simulatedTime != NULL)
+        return *simulatedTime;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (long long)now.tv_sec * 1000LL + now.tv_nsec / 1000000LL;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLOCK_h
+#define CLOCK_h
+
+// Milliseconds of a monotonic clock, not related to the wall clock
+long long currentTimeMillis(void);
+
+// Milliseconds since the epoch, comparable between hosts
+long long wallTimeMillis(void);
+
+// Lets both clocks return *now, NULL returns to the real clocks
+void simulateClock(long long *now);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "budget.h"
+#include "config.h"
+#include "bufferPool.h"
+#include "mailbox.h"
+#include "session.h"
+#include "pipeline.h"
+
+// Clients named by the report
+#define BUDGET_REPORT 5
+
+static const char *categoryNames[] = {"input", "output", "held", "pool", "strings", "clients", "mail", "sessions"};
+
+static const char *stageNames[] = {"normal", "pausiert", "verwirft", "trennt"};
+
+// Counters of the chains and the clients
+static long accounts[BUDGET_CATEGORIES];
+
+long
+*budget_account(int category) {
+    return &(accounts[category]);
+}
+
+long
+budget_usage(int category) {
+    switch (category) {
+        case BUDGET_POOL:
+            // All chunks which don't belong to a client
+            return BufferPool_allocated() * (long)sizeof(Chunk) - accounts[BUDGET_INPUT] - accounts[BUDGET_OUTPUT] - accounts[BUDGET_HELD];
+        case BUDGET_STRINGS:
+            return StringBuffer_allocated();
+        case BUDGET_MAIL:
+            return mailbox_memory();
+        case BUDGET_SESSIONS:
+            return session_memory();
+        case BUDGET_OUTPUT:
+            // The output queues of the I/O threads hold payloads
+            return accounts[BUDGET_OUTPUT] + Pipeline_memory();
+        default:
+            return accounts[category];
+    }
+}
+
+long
+budget_total(void) {
+    long total = 0;
+    int i;
+    for (i = 0; i < BUDGET_CATEGORIES; ++i) {
+        total += budget_usage(i);
+    }
+    return total;
+}
+
+int
+budget_stage(long total) {
+    if (config.memBudget == 0)
+        return BUDGET_NORMAL;
+    // Percent of the budget
+    long used = total * 100 / (config.memBudget * 1024L * 1024L);
+    if (used >= config.memKill)
+        return BUDGET_KILL;
+    if (used >= config.memShed)
+        return BUDGET_SHED;
+    if (used >= config.memPause)
+        return BUDGET_PAUSE;
+    return BUDGET_NORMAL;
+}
+
+const char
+*budget_stageName(int stage) {
+    return stageNames[stage];
+}
+
+long
+budget_client(Client *client) {
+    return sizeof(Client) + ChunkChain_memory(&(client->input)) + ChunkChain_memory(&(client->held)) + Outbox_memory(&(client->outbox));
+}
+
+StringBuffer
+*budget_report(Client **clients, int count, int stage) {
+    // The biggest clients, sorted by insertion
+    Client *biggest[BUDGET_REPORT];
+    long sizes[BUDGET_REPORT];
+    int found = 0;
+    int i, j;
+    for (i = 0; i < count; ++i) {
+        long size = budget_client(clients[i]);
+        for (j = found; j > 0 && sizes[j - 1] < size; --j) {
+            if (j < BUDGET_REPORT) {
+                biggest[j] = biggest[j - 1];
+                sizes[j] = sizes[j - 1];
+            }
+        }
+        if (j < BUDGET_REPORT) {
+            biggest[j] = clients[i];
+            sizes[j] = size;
+            if (found < BUDGET_REPORT)
+                ++found;
+        }
+    }
+
+    StringBuffer *msg = StringBuffer_construct();
+    char line[128];
+    long total = budget_total();
+    if (config.memBudget > 0)
+        snprintf(line, sizeof(line), "INFO: Speicher %ld KB von %d MB (%s):", total / 1024, config.memBudget, stageNames[stage]);
+    else
+        snprintf(line, sizeof(line), "INFO: Speicher %ld KB:", total / 1024);
+    StringBuffer_concat(msg, line);
+    for (i = 0; i < BUDGET_CATEGORIES; ++i) {
+        snprintf(line, sizeof(line), "%s %s %ld KB", (i == 0 ? "" : ","), categoryNames[i], budget_usage(i) / 1024);
+        StringBuffer_concat(msg, line);
+    }
+    StringBuffer_concat(msg, "; Groesste Clients:");
+    for (i = 0; i < found; ++i) {
+        StringBuffer_concat(msg, (i == 0 ? " [" : ", ["));
+        StringBuffer_concat(msg, biggest[i]->name);
+        snprintf(line, sizeof(line), "] %ld KB", sizes[i] / 1024);
+        StringBuffer_concat(msg, line);
+    }
+    return msg;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include "clientStruct.h"
+#include "../common/StringBuffer.h"
+
+// Memory of the server by category. The chunk chains of the clients
+// account their chunks themselves, the other modules are asked for
+// their size.
+#define BUDGET_INPUT      0
+#define BUDGET_OUTPUT     1
+#define BUDGET_HELD       2
+// Free chunks and the chunks of the links
+#define BUDGET_POOL       3
+#define BUDGET_STRINGS    4
+#define BUDGET_CLIENTS    5
+#define BUDGET_MAIL       6
+#define BUDGET_SESSIONS   7
+#define BUDGET_CATEGORIES 8
+
+// Stages of the load shedding, reached at mem.pause, mem.shed and
+// mem.kill percent of mem.budget
+#define BUDGET_NORMAL 0
+#define BUDGET_PAUSE  1
+#define BUDGET_SHED   2
+#define BUDGET_KILL   3
+
+// Counter of the accounted categories
+long *budget_account(int category);
+
+long budget_usage(int category);
+
+long budget_total(void);
+
+// Stage of the usage total, always BUDGET_NORMAL without a budget
+int budget_stage(long total);
+
+const char *budget_stageName(int stage);
+
+// Bytes used by a client and its buffers
+long budget_client(Client *client);
+
+// Usage of the categories and the biggest of the clients
+StringBuffer *budget_report(Client **clients, int count, int stage);
+
+#endif
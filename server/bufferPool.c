@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "bufferPool.h"
+#include "transport.h"
+
+// Chunks not in use
+static Chunk *freeList;
+static long freeCount;
+// Maximum of unused chunks kept, the others are given back to the system
+static long maxFreeCount = 1024;
+// Chunks in use or in the free list
+static long allocatedCount;
+
+void
+BufferPool_init(int maxFree) {
+    maxFreeCount = maxFree;
+}
+
+Chunk
+*BufferPool_get(void) {
+    Chunk *chunk = freeList;
+    if (chunk != NULL) {
+        freeList = chunk->next;
+        --freeCount;
+    }
+    else {
+        chunk = malloc(sizeof(Chunk));
+        if (chunk == NULL) {
+            perror("Insufficent memory!");
+            return NULL;
+        }
+        ++allocatedCount;
+    }
+    chunk->next = NULL;
+    chunk->start = 0;
+    chunk->end = 0;
+    return chunk;
+}
+
+void
+BufferPool_release(Chunk *chunk) {
+    if (freeCount >= maxFreeCount) {
+        free(chunk);
+        --allocatedCount;
+        return;
+    }
+    chunk->next = freeList;
+    freeList = chunk;
+    ++freeCount;
+}
+
+long
+BufferPool_allocated(void) {
+    return allocatedCount;
+}
+
+long
+BufferPool_free(void) {
+    return freeCount;
+}
+
+void
+ChunkChain_init(ChunkChain *chain) {
+    chain->head = NULL;
+    chain->tail = NULL;
+    chain->size = 0;
+    chain->chunks = 0;
+    chain->account = NULL;
+}
+
+void
+ChunkChain_account(ChunkChain *chain, long *account) {
+    if (chain->account != NULL)
+        *(chain->account) -= ChunkChain_memory(chain);
+    chain->account = account;
+    if (account != NULL)
+        *account += ChunkChain_memory(chain);
+}
+
+long
+ChunkChain_memory(ChunkChain *chain) {
+    return chain->chunks * (long)sizeof(Chunk);
+}
+
+static void
+ChunkChain_add(ChunkChain *chain, Chunk *chunk) {
+    if (chain->tail == NULL)
+        chain->head = chunk;
+    else
+        chain->tail->next = chunk;
+    chain->tail = chunk;
+    ++chain->chunks;
+    if (chain->account != NULL)
+        *(chain->account) += sizeof(Chunk);
+}
+
+// Maximum of chunks used by a single read
+#define READ_CHUNKS 8
+
+int
+ChunkChain_read(ChunkChain *chain, int fd, int maxBytes) {
+    struct iovec iov[READ_CHUNKS + 1];
+    Chunk *chunks[READ_CHUNKS];
+    int iovcnt = 0;
+    int space = 0;
+    // Fill the rest of the last chunk first
+    if (chain->tail != NULL && chain->tail->end < CHUNK_SIZE) {
+        iov[0].iov_base = chain->tail->data + chain->tail->end;
+        iov[0].iov_len = CHUNK_SIZE - chain->tail->end;
+        space = iov[0].iov_len;
+        iovcnt = 1;
+    }
+    // Take new chunks for the rest
+    int count = 0;
+    while (space < maxBytes && count < READ_CHUNKS) {
+        Chunk *chunk = BufferPool_get();
+        if (chunk == NULL)
+            break;
+        chunks[count++] = chunk;
+        iov[iovcnt].iov_base = chunk->data;
+        iov[iovcnt].iov_len = CHUNK_SIZE;
+        space += CHUNK_SIZE;
+        ++iovcnt;
+    }
+
+    int bytes_read = transport->readv(fd, iov, iovcnt);
+    int rest = (bytes_read > 0 ? bytes_read : 0);
+    chain->size += rest;
+    // Account the data to the chunks
+    if (iovcnt > count) {
+        int len = (rest < CHUNK_SIZE - chain->tail->end ? rest : CHUNK_SIZE - chain->tail->end);
+        chain->tail->end += len;
+        rest -= len;
+    }
+    int i;
+    for (i = 0; i < count; ++i) {
+        // Give the unused chunks back, but keep errno of the read
+        if (rest == 0) {
+            int error = errno;
+            BufferPool_release(chunks[i]);
+            errno = error;
+            continue;
+        }
+        chunks[i]->end = (rest < CHUNK_SIZE ? rest : CHUNK_SIZE);
+        rest -= chunks[i]->end;
+        ChunkChain_add(chain, chunks[i]);
+    }
+    return bytes_read;
+}
+
+// Maximum of chunks sent at once
+#define SEND_CHUNKS 16
+
+int
+ChunkChain_send(ChunkChain *chain, int socket, int maxBytes) {
+    struct iovec iov[SEND_CHUNKS];
+    int iovcnt = 0;
+    Chunk *chunk;
+    for (chunk = chain->head; chunk != NULL && maxBytes > 0 && iovcnt < SEND_CHUNKS; chunk = chunk->next) {
+        int len = chunk->end - chunk->start;
+        if (len > maxBytes)
+            len = maxBytes;
+        iov[iovcnt].iov_base = chunk->data + chunk->start;
+        iov[iovcnt].iov_len = len;
+        maxBytes -= len;
+        ++iovcnt;
+    }
+    if (iovcnt == 0)
+        return 0;
+    int written = transport->writev(socket, iov, iovcnt);
+    if (written > 0)
+        ChunkChain_consume(chain, written);
+    return written;
+}
+
+int
+ChunkChain_append(ChunkChain *chain, char *data, int len) {
+    while (len > 0) {
+        if (chain->tail == NULL || chain->tail->end == CHUNK_SIZE) {
+            Chunk *chunk = BufferPool_get();
+            if (chunk == NULL)
+                return EXIT_FAILURE;
+            ChunkChain_add(chain, chunk);
+        }
+        Chunk *tail = chain->tail;
+        int copy = (len < CHUNK_SIZE - tail->end ? len : CHUNK_SIZE - tail->end);
+        memcpy(tail->data + tail->end, data, copy);
+        tail->end += copy;
+        chain->size += copy;
+        data += copy;
+        len -= copy;
+    }
+    return EXIT_SUCCESS;
+}
+
+int
+ChunkChain_find(ChunkChain *chain, char c) {
+    int offset = 0;
+    Chunk *chunk;
+    for (chunk = chain->head; chunk != NULL; chunk = chunk->next) {
+        char *found = memchr(chunk->data + chunk->start, c, chunk->end - chunk->start);
+        if (found != NULL)
+            return offset + (found - (chunk->data + chunk->start));
+        offset += chunk->end - chunk->start;
+    }
+    return -1;
+}
+
+void
+ChunkChain_copy(ChunkChain *chain, char *dest, int len) {
+    Chunk *chunk;
+    for (chunk = chain->head; chunk != NULL && len > 0; chunk = chunk->next) {
+        int copy = chunk->end - chunk->start;
+        if (copy > len)
+            copy = len;
+        memcpy(dest, chunk->data + chunk->start, copy);
+        dest += copy;
+        len -= copy;
+    }
+}
+
+void
+ChunkChain_consume(ChunkChain *chain, int len) {
+    if (len > chain->size)
+        len = chain->size;
+    chain->size -= len;
+    while (len > 0) {
+        Chunk *chunk = chain->head;
+        int available = chunk->end - chunk->start;
+        if (len < available) {
+            chunk->start += len;
+            return;
+        }
+        len -= available;
+        // Chunk is empty -> back to the pool
+        chain->head = chunk->next;
+        if (chain->head == NULL)
+            chain->tail = NULL;
+        --chain->chunks;
+        if (chain->account != NULL)
+            *(chain->account) -= sizeof(Chunk);
+        BufferPool_release(chunk);
+    }
+}
+
+void
+ChunkChain_clear(ChunkChain *chain) {
+    ChunkChain_consume(chain, chain->size);
+}
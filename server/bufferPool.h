@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+// Bytes of data stored in a single chunk
+#define CHUNK_SIZE 1024
+
+// Fixed size piece of a buffer, taken from a shared pool
+typedef struct Chunk {
+    struct Chunk *next;
+    // Unconsumed data is between start and end
+    int start;
+    int end;
+    char data[CHUNK_SIZE];
+} Chunk;
+
+// Buffer made of chained chunks, empty chains don't hold any chunk
+typedef struct ChunkChain {
+    Chunk *head;
+    Chunk *tail;
+    int size;
+    int chunks;
+    // Bytes of the chunks are added to it, NULL when not accounted
+    long *account;
+} ChunkChain;
+
+void
+BufferPool_init(int maxFree);
+
+Chunk
+*BufferPool_get(void);
+
+void
+BufferPool_release(Chunk *chunk);
+
+long
+BufferPool_allocated(void);
+
+long
+BufferPool_free(void);
+
+void
+ChunkChain_init(ChunkChain *chain);
+
+void
+ChunkChain_account(ChunkChain *chain, long *account);
+
+long
+ChunkChain_memory(ChunkChain *chain);
+
+int
+ChunkChain_read(ChunkChain *chain, int fd, int maxBytes);
+
+int
+ChunkChain_send(ChunkChain *chain, int socket, int maxBytes);
+
+int
+ChunkChain_append(ChunkChain *chain, char *data, int len);
+
+int
+ChunkChain_find(ChunkChain *chain, char c);
+
+void
+ChunkChain_copy(ChunkChain *chain, char *dest, int len);
+
+void
+ChunkChain_consume(ChunkChain *chain, int len);
+
+void
+ChunkChain_clear(ChunkChain *chain);
+
+#endif
@@ -17,27 +17,58 @@
  */
 
 #include "clientStruct.h"
+#include "sketch.h"
+#include "budget.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 Client
 *Client_construct(int clientSocket, char *name) {
-    Client *client = malloc(sizeof(client));
+    Client *client = malloc(sizeof(Client));
     if (client == NULL) {
         perror("Insufficent memory!");
         return NULL;
     }
     client->socket = clientSocket;
+    client->name = NULL;
+    client->address = strdup(name);
+    client->addressHash = Sketch_hash(name);
+    client->admin = false;
+    client->id = 0;
+    client->nameClaim = 0;
+    client->pollIndex = -1;
+    client->listIndex = -1;
+    client->pingSentAt = 0;
+    client->rosterIndex = -1;
+    client->jobPending = false;
+    client->oversized = false;
+    client->streaming = false;
+    client->transfer = NULL;
+    ChunkChain_init(&(client->held));
+    ChunkChain_account(&(client->held), budget_account(BUDGET_HELD));
+    Outbox_init(&(client->outbox));
+    Outbox_account(&(client->outbox), budget_account(BUDGET_OUTPUT));
+    client->backlogged = false;
+    client->ready = false;
+    client->readyPrev = NULL;
+    client->readyNext = NULL;
+    client->readyRound = 0;
+    client->session = NULL;
+    client->recentBytes = 0;
+    client->budgetCheck = 0;
+    client->shed = false;
+    client->reading = true;
+    client->inputPaused = false;
+    client->hungUp = false;
     Client_setName(client, name);
-    StringBuffer *buffer = StringBuffer_construct_n(4096);
-    if (buffer == NULL) {
-        return NULL;
-    }
-    client->buffer = buffer;
+    ChunkChain_init(&(client->input));
+    ChunkChain_account(&(client->input), budget_account(BUDGET_INPUT));
+    *budget_account(BUDGET_CLIENTS) += sizeof(Client);
     
     return client;
 }
@@ -56,9 +87,12 @@ Client_free(Client *client) {
     if (client->name != NULL) {
         free(client->name);
     }
-    if (client->buffer != NULL) {      
-        StringBuffer_free(client->buffer);
-     }
+    free(client->address);
+    ChunkChain_clear(&(client->input));
+    ChunkChain_clear(&(client->held));
+    Outbox_clear(&(client->outbox));
+    *budget_account(BUDGET_CLIENTS) -= sizeof(Client);
+    free(client);
 }
 
 int
@@ -68,20 +102,6 @@ equals_Client_Socket(Client *c1, Client *c2) {
 
 int
 equals_Client_Name(Client *c1, Client *c2) {
-    StringBuffer *name1 = StringBuffer_construct();
-    StringBuffer_concat(name1, c1->name);
-    StringBuffer *name2 = StringBuffer_construct();
-    StringBuffer_concat(name2, c2->name);
-    
-    // Convert both names to lowercases
-    int i;
-    for(i = 0; i < name1->size; i++){
-        name1->buffer[i] = tolower(name1->buffer[i]);
-    }   
-    for(i = 0; i < name2->size; i++){
-        name2->buffer[i] = tolower(name2->buffer[i]);
-    }   
-
-    // convert lower case names
-    return (strcmp(name1->buffer, name2->buffer) == 0 ? 0 : -1);
+    // Names are compared case insensitive
+    return (strcasecmp(c1->name, c2->name) == 0 ? 0 : -1);
 }
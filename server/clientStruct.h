@@ -22,11 +22,77 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include "../common/StringBuffer.h"
+#include "tokenBucket.h"
+#include "timerWheel.h"
+#include "bufferPool.h"
+#include "outbox.h"
 
 typedef struct Client {
     int socket;
-    StringBuffer *buffer;
+    // Positions in the pollList and the clientList
+    int pollIndex;
+    int listIndex;
+    // Received input, only holds chunks while a message is incomplete
+    ChunkChain input;
     char *name;
+    // Address the client connected from, counted by the top talkers
+    char *address;
+    unsigned long addressHash;
+    // Connected over the unix socket by a user of admin.uids, may use the admin commands
+    bool admin;
+    // Identifies the client in the federation, names aren't unique
+    long id;
+    // Wall clock time the name was chosen with /nick, 0 for the standard name
+    long long nameClaim;
+    // Rate limits of the client
+    TokenBucket msgBucket;
+    TokenBucket byteBucket;
+    TokenBucket commandBucket;
+    // Continues polling a paused client
+    Timer resumeTimer;
+    // Time of the last input and of the last message which was no keepalive
+    long long lastActivity;
+    long long lastMessage;
+    // Time of the unanswered ping, 0 when no ping is pending
+    long long pingSentAt;
+    Timer keepaliveTimer;
+    Timer idleTimer;
+    // Position in the roster subscribers, -1 when not subscribed
+    int rosterIndex;
+    // A worker computes a response, the following messages have to wait
+    bool jobPending;
+    // Rest of a message above the maximal size is still coming
+    bool oversized;
+    // The oversized message is relayed in pieces instead of being skipped
+    bool streaming;
+    // File the client sends or receives, NULL without one
+    struct Transfer *transfer;
+    // Messages for a receiver of a file, sent after the file
+    ChunkChain held;
+    // Messages the socket couldn't take yet
+    Outbox outbox;
+    // Too many messages are queued, the input waits until they are sent
+    bool backlogged;
+    // Used up its budget, the rest of its messages waits in the ready list
+    bool ready;
+    struct Client *readyPrev;
+    struct Client *readyNext;
+    // Round of serve_ready_clients in which it was appended
+    unsigned int readyRound;
+    // Session of the client, NULL when it didn't ask for one
+    struct Session *session;
+    // Bytes of messages handled in the check of the memory budget with
+    // the number budgetCheck, its heaviest senders are paused
+    long recentBytes;
+    int budgetCheck;
+    // Not read until the memory is below the budget again
+    bool shed;
+    // Last state given to set_reading
+    bool reading;
+    // The I/O thread of the client doesn't read it
+    bool inputPaused;
+    // Closed by the peer, removed when its last messages are handled
+    bool hungUp;
 } Client;
 
 Client
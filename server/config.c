@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "config.h"
+#include "log.h"
+
+Config config = {
+    .rateMsgs = 0,
+    .rateMsgsBurst = 20,
+    .rateBytes = 0,
+    .rateBytesBurst = 32768,
+    .rateCommands = 0,
+    .rateCommandsBurst = 5,
+    .ratePolicy = RATE_POLICY_DELAY,
+    .pingInterval = 0,
+    .pingTimeout = 30,
+    .idleTimeout = 0,
+    .acceptBudget = 256,
+    .poolMaxFree = 1024,
+    .presenceWindow = 0,
+    .presenceNames = 3,
+    .presenceMaxRoom = 0,
+    .listPageSize = 0,
+    .workers = 0,
+    .ioThreads = 0,
+    .topWindow = 60,
+    .msgMaxSize = 0,
+    .msgPolicy = MSG_POLICY_REJECT,
+    .transferMode = TRANSFER_MODE_SPLICE,
+    .fairMsgs = 16,
+    .fairBytes = 16384,
+    .topThrottle = 0,
+    .busyPoll = 0,
+    .busySocket = 0,
+    .outLimit = {64 * 1024, 256 * 1024, 256 * 1024, 1024 * 1024},
+    .outPolicy = {OUT_POLICY_DISCONNECT, OUT_POLICY_DISCONNECT, OUT_POLICY_DROP_OLD, OUT_POLICY_DISCONNECT},
+    .outLowat = 16384,
+    .mailMemory = 0,
+    .mailMax = 50,
+    .mailAge = 86400,
+    .sessionMemory = 256 * 1024,
+    .sessionHistory = 4096,
+    .sessionTimeout = 300,
+    .memBudget = 0,
+    .memPause = 70,
+    .memShed = 80,
+    .memKill = 90,
+    .fanoutMin = 64,
+    .adminUidCount = 0,
+};
+
+static const char *ratePolicies[] = {"delay", "drop", "disconnect", NULL};
+
+static const char *transferModes[] = {"splice", "copy", NULL};
+
+static const char *msgPolicies[] = {"reject", "disconnect", "stream", NULL};
+
+static const char *outPolicies[] = {"drop", "dropold", "disconnect", NULL};
+
+// A single option, set by "-o name=value"
+typedef struct Option {
+    const char *name;
+    int *value;
+    // Allowed names of the values, NULL for numbers
+    const char **choices;
+    const char *description;
+} Option;
+
+// An option taking a comma separated list of numbers
+typedef struct ListOption {
+    const char *name;
+    int *values;
+    int *count;
+    const char *description;
+} ListOption;
+
+static Option options[] = {
+    {"rate.msgs",           &config.rateMsgs,           NULL, "messages per second of a client (0 = unlimited)"},
+    {"rate.msgs.burst",     &config.rateMsgsBurst,      NULL, "messages a client can send at once"},
+    {"rate.bytes",          &config.rateBytes,          NULL, "bytes per second of a client (0 = unlimited)"},
+    {"rate.bytes.burst",    &config.rateBytesBurst,     NULL, "bytes a client can send at once"},
+    {"rate.cmds",           &config.rateCommands,       NULL, "expensive commands per second of a client (0 = unlimited)"},
+    {"rate.cmds.burst",     &config.rateCommandsBurst,  NULL, "expensive commands a client can send at once"},
+    {"rate.policy",         &config.ratePolicy,         ratePolicies, "reaction on exceeded limits"},
+    {"ping.interval",       &config.pingInterval,       NULL, "seconds without input until a client is pinged (0 = never)"},
+    {"ping.timeout",        &config.pingTimeout,        NULL, "seconds a client has to answer a ping"},
+    {"idle.timeout",        &config.idleTimeout,        NULL, "seconds without messages until a client is disconnected (0 = never)"},
+    {"accept.budget",       &config.acceptBudget,       NULL, "connections accepted per listener and loop iteration (0 = all)"},
+    {"pool.maxfree",        &config.poolMaxFree,        NULL, "unused input chunks of 1KB kept in the pool"},
+    {"presence.window",     &config.presenceWindow,     NULL, "milliseconds join/leave events are collected (0 = send at once)"},
+    {"presence.names",      &config.presenceNames,      NULL, "names listed in a join/leave notice"},
+    {"presence.maxroom",    &config.presenceMaxRoom,    NULL, "clients above which join/leave notices are suppressed (0 = never)"},
+    {"list.pagesize",       &config.listPageSize,       NULL, "names on a page of /list (0 = no pages)"},
+    {"workers",             &config.workers,            NULL, "threads computing /list and /search (0 = in the server loop)"},
+    {"io.threads",          &config.ioThreads,          NULL, "threads reading and writing the client sockets (0 = in the server loop)"},
+    {"msg.maxsize",         &config.msgMaxSize,         NULL, "bytes of the longest message (0 = unlimited)"},
+    {"msg.policy",          &config.msgPolicy,          msgPolicies, "reaction on longer messages, stream relays them in pieces"},
+    {"transfer.mode",       &config.transferMode,       transferModes, "relay of files, copy reads and writes them"},
+    {"fair.msgs",           &config.fairMsgs,           NULL, "messages handled per client and turn (0 = all)"},
+    {"fair.bytes",          &config.fairBytes,          NULL, "bytes of messages handled per client and turn (0 = all)"},
+    {"top.window",          &config.topWindow,          NULL, "seconds of a window counting the top talkers (0 = not counted)"},
+    {"top.throttle",        &config.topThrottle,        NULL, "messages of an address per window above which it may send one message per second (0 = never)"},
+    {"busy.poll",           &config.busyPoll,           NULL, "milliseconds the loop spins without waiting after the last event (0 = never)"},
+    {"busy.socket",         &config.busySocket,         NULL, "microseconds the kernel busy polls a client socket (0 = never)"},
+    {"out.control.limit",   &config.outLimit[LANE_CONTROL],     NULL, "bytes of replies and errors queued for a client (0 = unlimited)"},
+    {"out.control.policy",  &config.outPolicy[LANE_CONTROL],    outPolicies, "reaction on more replies, dropold drops the oldest"},
+    {"out.direct.limit",    &config.outLimit[LANE_DIRECT],      NULL, "bytes of private messages queued for a client (0 = unlimited)"},
+    {"out.direct.policy",   &config.outPolicy[LANE_DIRECT],     outPolicies, "reaction on more private messages"},
+    {"out.broadcast.limit", &config.outLimit[LANE_BROADCAST],   NULL, "bytes of chat messages queued for a client (0 = unlimited)"},
+    {"out.broadcast.policy",&config.outPolicy[LANE_BROADCAST],  outPolicies, "reaction on more chat messages"},
+    {"out.bulk.limit",      &config.outLimit[LANE_BULK],        NULL, "bytes of lists and roster updates queued for a client (0 = unlimited)"},
+    {"out.bulk.policy",     &config.outPolicy[LANE_BULK],       outPolicies, "reaction on more lists and roster updates"},
+    {"out.lowat",           &config.outLowat,           NULL, "unsent bytes the kernel keeps for a client, the lanes queue the rest (0 = kernel default)"},
+    {"mail.memory",         &config.mailMemory,         NULL, "bytes storing whispers to offline nicks, the oldest are dropped first (0 = not stored)"},
+    {"mail.max",            &config.mailMax,            NULL, "stored whispers per nick (0 = unlimited)"},
+    {"mail.age",            &config.mailAge,            NULL, "seconds a stored whisper is kept (0 = until the memory is full)"},
+    {"session.memory",      &config.sessionMemory,      NULL, "bytes of the last broadcasts kept for resumed sessions (0 = no sessions)"},
+    {"session.history",     &config.sessionHistory,     NULL, "broadcasts kept for resumed sessions"},
+    {"session.timeout",     &config.sessionTimeout,     NULL, "seconds a session keeps the nick of its lost client"},
+    {"mem.budget",          &config.memBudget,          NULL, "megabytes of buffers the server may use (0 = unlimited)"},
+    {"mem.pause",           &config.memPause,           NULL, "percent of the budget where the heaviest senders aren't read"},
+    {"mem.shed",            &config.memShed,            NULL, "percent of the budget where lists and roster updates are dropped"},
+    {"mem.kill",            &config.memKill,            NULL, "percent of the budget where the biggest clients are disconnected"},
+    {"fanout.min",          &config.fanoutMin,          NULL, "clients from which every I/O thread sends a broadcast to its clients itself (0 = never)"},
+    {"log.server",          &logLevels[LOG_SERVER],     logLevelNames, "records of the listeners and the server loop"},
+    {"log.client",          &logLevels[LOG_CLIENT],     logLevelNames, "records of connecting and leaving clients"},
+    {"log.federation",      &logLevels[LOG_FEDERATION], logLevelNames, "records of the links to other nodes"},
+    {"log.transfer",        &logLevels[LOG_TRANSFER],   logLevelNames, "records of file transfers"},
+    {NULL, NULL, NULL, NULL}
+};
+
+static ListOption listOptions[] = {
+    {"admin.uids",          config.adminUids,   &config.adminUidCount,  "comma separated uids of unix socket users allowed to use /top and /memory (empty = none)"},
+    {NULL, NULL, NULL, NULL}
+};
+
+static int
+Config_parseNumber(char *value, int *number) {
+    char *end;
+    errno = 0;
+    long parsed = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || errno == ERANGE || parsed < 0 || parsed > INT_MAX) {
+        return EXIT_FAILURE;
+    }
+    *number = (int)parsed;
+    return EXIT_SUCCESS;
+}
+
+static int
+Config_parseList(ListOption *option, char *value) {
+    // Split a copy, the value is printed on errors
+    char *list = strdup(value);
+    if (list == NULL) {
+        perror("Insufficent memory!");
+        return EXIT_FAILURE;
+    }
+    int result = EXIT_SUCCESS;
+    int count = 0;
+    // An empty list clears the option
+    char *number = list;
+    while (*number != '\0') {
+        char *next = strchr(number, ',');
+        if (next != NULL)
+            *next = '\0';
+        if (count == CONFIG_LIST_MAX || Config_parseNumber(number, &(option->values[count])) == EXIT_FAILURE) {
+            result = EXIT_FAILURE;
+            break;
+        }
+        ++count;
+        if (next == NULL)
+            break;
+        number = next + 1;
+    }
+    free(list);
+    if (result == EXIT_SUCCESS)
+        *(option->count) = count;
+    return result;
+}
+
+static int
+Config_parseValue(Option *option, char *value) {
+    // Named value
+    if (option->choices != NULL) {
+        int i;
+        for (i = 0; option->choices[i] != NULL; ++i) {
+            if (strcmp(option->choices[i], value) == 0) {
+                *(option->value) = i;
+                return EXIT_SUCCESS;
+            }
+        }
+        return EXIT_FAILURE;
+    }
+    // Number, the options are ints
+    return Config_parseNumber(value, option->value);
+}
+
+int
+Config_set(char *option) {
+    char *value = strchr(option, '=');
+    if (value == NULL) {
+        fprintf(stderr, "Option '%s' has no value!\n", option);
+        return EXIT_FAILURE;
+    }
+    size_t nameLength = value - option;
+    value = value + 1;
+
+    Option *o;
+    for (o = options; o->name != NULL; ++o) {
+        if (strlen(o->name) == nameLength && strncmp(o->name, option, nameLength) == 0) {
+            if (Config_parseValue(o, value) == EXIT_FAILURE) {
+                fprintf(stderr, "Invalid value '%s' for option '%s'!\n", value, o->name);
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+        }
+    }
+    ListOption *l;
+    for (l = listOptions; l->name != NULL; ++l) {
+        if (strlen(l->name) == nameLength && strncmp(l->name, option, nameLength) == 0) {
+            if (Config_parseList(l, value) == EXIT_FAILURE) {
+                fprintf(stderr, "Invalid value '%s' for option '%s'!\n", value, l->name);
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+        }
+    }
+    fprintf(stderr, "Unknown option '%.*s'!\n", (int)nameLength, option);
+    return EXIT_FAILURE;
+}
+
+void
+Config_printUsage(void) {
+    puts("Options (-o name=value):");
+    Option *o;
+    for (o = options; o->name != NULL; ++o) {
+        if (o->choices != NULL) {
+            printf("  %-20s %s (", o->name, o->description);
+            int i;
+            for (i = 0; o->choices[i] != NULL; ++i) {
+                printf(i == 0 ? "%s" : "|%s", o->choices[i]);
+            }
+            printf(", default %s)\n", o->choices[*(o->value)]);
+        }
+        else {
+            printf("  %-20s %s (default %d)\n", o->name, o->description, *(o->value));
+        }
+    }
+    ListOption *l;
+    for (l = listOptions; l->name != NULL; ++l) {
+        printf("  %-20s %s (default ", l->name, l->description);
+        int i;
+        for (i = 0; i < *(l->count); ++i) {
+            printf(i == 0 ? "%d" : ",%d", l->values[i]);
+        }
+        printf(*(l->count) == 0 ? "none)\n" : ")\n");
+    }
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Reactions on clients exceeding their rate limits
+#define RATE_POLICY_DELAY       0
+#define RATE_POLICY_DROP        1
+#define RATE_POLICY_DISCONNECT  2
+
+// Relays of files
+#define TRANSFER_MODE_SPLICE    0
+#define TRANSFER_MODE_COPY      1
+
+// Reactions on messages longer than the maximal size
+#define MSG_POLICY_REJECT       0
+#define MSG_POLICY_DISCONNECT   1
+#define MSG_POLICY_STREAM       2
+
+// Reactions on a full lane of the outbox
+#define OUT_POLICY_DROP         0
+#define OUT_POLICY_DROP_OLD     1
+#define OUT_POLICY_DISCONNECT   2
+
+// Most values of an option taking a list
+#define CONFIG_LIST_MAX          16
+
+#include "outbox.h"
+
+typedef struct Config {
+    // Messages per second of a client
+    int rateMsgs;
+    int rateMsgsBurst;
+    // Bytes per second of a client
+    int rateBytes;
+    int rateBytesBurst;
+    // Expensive commands (like /list) per second of a client
+    int rateCommands;
+    int rateCommandsBurst;
+    // One of RATE_POLICY_*
+    int ratePolicy;
+    // Seconds without input until a client is pinged
+    int pingInterval;
+    // Seconds a client has to answer a ping
+    int pingTimeout;
+    // Seconds without messages until a client is disconnected
+    int idleTimeout;
+    // Connections accepted per listener and loop iteration
+    int acceptBudget;
+    // Unused input chunks kept in the pool
+    int poolMaxFree;
+    // Milliseconds presence events are collected
+    int presenceWindow;
+    // Names listed in a presence notice
+    int presenceNames;
+    // Clients above which presence notices are suppressed
+    int presenceMaxRoom;
+    // Names on a page of /list
+    int listPageSize;
+    // Threads computing expensive commands
+    int workers;
+    // Threads reading and writing the sockets of the clients
+    int ioThreads;
+    // Longest message which is buffered completely
+    int msgMaxSize;
+    // One of MSG_POLICY_*
+    int msgPolicy;
+    // One of TRANSFER_MODE_*
+    int transferMode;
+    // Budget of a client per turn
+    int fairMsgs;
+    int fairBytes;
+    // Seconds of a window of the top talkers
+    int topWindow;
+    // Messages per window above which an address is throttled
+    int topThrottle;
+    // Milliseconds the loop polls without waiting after the last event
+    int busyPoll;
+    // Microseconds the kernel polls a client socket on a read
+    int busySocket;
+    // Bytes queued per lane of the outbox, see LANE_*
+    int outLimit[OUTBOX_LANES];
+    // One of OUT_POLICY_* per lane
+    int outPolicy[OUTBOX_LANES];
+    // Unsent bytes in the socket, the rest waits in the lanes
+    int outLowat;
+    // Bytes of the arena storing whispers to offline nicks
+    int mailMemory;
+    // Mails per nick and seconds they are kept
+    int mailMax;
+    int mailAge;
+    // Bytes and number of the last broadcasts kept for resumed sessions
+    int sessionMemory;
+    int sessionHistory;
+    // Seconds a session waits for its client to come back
+    int sessionTimeout;
+    // Megabytes the server may use and the percents of it where the
+    // heaviest senders pause, bulk messages are dropped and the biggest
+    // clients are disconnected
+    int memBudget;
+    int memPause;
+    int memShed;
+    int memKill;
+    // Clients from which the I/O threads fan out a broadcast themselves
+    int fanoutMin;
+    // Users of the unix socket which may use the admin commands
+    int adminUids[CONFIG_LIST_MAX];
+    int adminUidCount;
+} Config;
+
+// The configuration of the running server
+extern Config config;
+
+int Config_set(char *option);
+
+void Config_printUsage(void);
+
+#endif
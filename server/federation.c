@@ -0,0 +1,1084 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+
+#include "federation.h"
+#include "log.h"
+#include "server.h"
+#include "presence.h"
+#include "roster.h"
+#include "bufferPool.h"
+#include "budget.h"
+#include "../common/network/network.h"
+#include "../common/time/clock.h"
+#include "../common/StringBuffer.h"
+#include "../common/datatype/GenericVector.h"
+
+// States of a link
+#define LINK_CONNECTING 0
+#define LINK_HELLO      1
+#define LINK_READY      2
+
+// Seconds until a broken outgoing link is connected again
+#define LINK_RETRY 5
+
+// Bytes read from a link at once
+#define LINK_READ_SIZE 65536
+
+// Output waiting for a link which doesn't read, the link is dropped above
+#define LINK_OUTPUT_LIMIT (16 * 1024 * 1024)
+
+// The burst of all users is sent in pieces of this size
+#define BURST_SIZE 65536
+
+// Longest name of a node
+#define NODE_NAME_SIZE 256
+
+// Number of sequence numbers below the highest one which are remembered
+#define DEDUP_WINDOW 64
+
+#define USER_BUCKETS 4096
+
+typedef struct Link {
+    int socket;
+    int state;
+    // Name of the node on the other side, NULL until its hello arrived
+    char *node;
+    // Address of an outgoing link to connect it again, NULL for incoming links
+    char *peer;
+    // Received input, only holds chunks while a line is incomplete
+    ChunkChain input;
+    // Lines the socket didn't take yet, sent with the next POLLOUT
+    ChunkChain output;
+    // Output is too big, the link is closed by its next event
+    bool dropped;
+    // Statistics of the link
+    long long sent;
+    long long received;
+    long long since;
+} Link;
+
+// User of another node
+typedef struct RemoteUser {
+    // Users are identified by their home node and their id on it
+    char *home;
+    long id;
+    char *name;
+    long long claim;
+    // Link the user is reachable over
+    Link *via;
+    // Position in the userList
+    int listIndex;
+    // Chains of the hash tables
+    struct RemoteUser *nextById;
+    struct RemoteUser *nextByName;
+} RemoteUser;
+
+// Sequence numbers seen from a node
+typedef struct Origin {
+    char *node;
+    long long highest;
+    // Bit i is set when highest - i was seen
+    unsigned long long window;
+} Origin;
+
+DefVector(Link *, link);
+DefVector(RemoteUser *, user);
+DefVector(Origin *, origin);
+DefVector(char *, peer);
+DefVector(int, fedListener);
+
+static char *nodeName;
+// Sequence number of the next message of this node
+static long long nextSeq;
+
+static linkVector *links;
+static originVector *origins;
+// Addresses of the outgoing links
+static peerVector *peers;
+// Sockets accepting links of other nodes
+static fedListenerVector *listeners;
+
+// All remote users
+static userVector *userList;
+
+// Remote users by home and id and by their lower case name
+static RemoteUser *usersById[USER_BUCKETS];
+static RemoteUser *usersByName[USER_BUCKETS];
+
+static void connect_peer(void *data);
+static void relay(StringBuffer *line, Link *from);
+static void rename_loser(Client *client);
+
+// *******************************************
+// Configuration and startup
+// *******************************************
+
+void
+federation_setNode(char *node) {
+    nodeName = node;
+}
+
+void
+federation_addPeer(char *address) {
+    if (peers == NULL)
+        peers = peerVector_construct(2);
+    peerVector_add(peers, address);
+}
+
+void
+federation_adopt(int listener) {
+    if (listeners == NULL)
+        listeners = fedListenerVector_construct(2);
+    fedListenerVector_add(listeners, listener);
+    watch_socket(listener, POLLIN);
+}
+
+int
+federation_listenerCount(void) {
+    return (listeners == NULL ? 0 : listeners->size);
+}
+
+int
+*federation_listeners(void) {
+    return (listeners == NULL ? NULL : listeners->elements);
+}
+
+static int
+listen_links(char *port) {
+    struct addrinfo hints;
+    memset(&hints, 0 , sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *res;
+    int error = getaddrinfo(NULL, port, &hints, &res);
+    if (error != 0) {
+        fprintf(stderr, "Can't parse information for socket creation: %s\n", gai_strerror(error));
+        return EXIT_FAILURE;
+    }
+    struct addrinfo *info;
+    for (info = res; info != NULL; info = info->ai_next) {
+        int listener = initListener(info);
+        if (listener >= 0) {
+            fedListenerVector_add(listeners, listener);
+            watch_socket(listener, POLLIN);
+        }
+    }
+    freeaddrinfo(res);
+    if (listeners->size == 0) {
+        fprintf(stderr, "Can't listen for links on any address!\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static void
+retry_listen(void *data) {
+    if (listen_links(data) == EXIT_FAILURE)
+        defer_task(LINK_RETRY * 1000LL, &retry_listen, data);
+}
+
+int
+federation_init(char *port, bool retry) {
+    links = linkVector_construct(4);
+    origins = originVector_construct(4);
+    if (listeners == NULL)
+        listeners = fedListenerVector_construct(2);
+    userList = userVector_construct(8);
+    if (links == NULL || origins == NULL || listeners == NULL || userList == NULL)
+        return EXIT_FAILURE;
+
+    // Standard name is unique on a host and stays the same after a restart,
+    // so the neighbours know the node again
+    if (nodeName == NULL) {
+        // Only the port of the links tells the nodes of a host apart
+        if (port == NULL && peers != NULL) {
+            fprintf(stderr, "A node without a port for links needs a name (-N)!\n");
+            return EXIT_FAILURE;
+        }
+        char host[NODE_NAME_SIZE / 2];
+        if (gethostname(host, sizeof(host)) != 0)
+            strcpy(host, "node");
+        host[sizeof(host) - 1] = '\0';
+        nodeName = malloc(NODE_NAME_SIZE);
+        if (nodeName == NULL) {
+            perror("Insufficent memory!");
+            return EXIT_FAILURE;
+        }
+        if (port == NULL)
+            snprintf(nodeName, NODE_NAME_SIZE, "%s", host);
+        else
+            snprintf(nodeName, NODE_NAME_SIZE, "%s-%s", host, port);
+    }
+    // Sequence numbers continue to grow after a restart of the node,
+    // otherwise the other nodes would drop its messages as duplicates
+    nextSeq = wallTimeMillis() * 1000LL;
+
+    // Listen for links of other nodes, unless the predecessor already did
+    if (port != NULL && listeners->size == 0 && listen_links(port) == EXIT_FAILURE) {
+        if (!retry)
+            return EXIT_FAILURE;
+        defer_task(LINK_RETRY * 1000LL, &retry_listen, port);
+    }
+
+    // Link to the other nodes
+    int i;
+    for (i = 0; peers != NULL && i < peers->size; ++i) {
+        connect_peer(peers->elements[i]);
+    }
+    printf("Node %s is part of the network\n", nodeName);
+    return EXIT_SUCCESS;
+}
+
+// *******************************************
+// Remote users
+// *******************************************
+
+static unsigned int
+hash_id(char *home, long id) {
+    unsigned int hash = 5381;
+    for (; *home != '\0'; ++home)
+        hash = hash * 33 + (unsigned char)*home;
+    return (hash ^ (unsigned int)id * 2654435761u) % USER_BUCKETS;
+}
+
+static unsigned int
+hash_name(char *name) {
+    // Names are compared case insensitive
+    unsigned int hash = 5381;
+    for (; *name != '\0'; ++name)
+        hash = hash * 33 + tolower((unsigned char)*name);
+    return hash % USER_BUCKETS;
+}
+
+static RemoteUser
+*user_find(char *home, long id) {
+    RemoteUser *user = usersById[hash_id(home, id)];
+    for (; user != NULL; user = user->nextById) {
+        if (user->id == id && strcmp(user->home, home) == 0)
+            return user;
+    }
+    return NULL;
+}
+
+static RemoteUser
+*user_findByName(char *name) {
+    RemoteUser *user = usersByName[hash_name(name)];
+    for (; user != NULL; user = user->nextByName) {
+        if (strcasecmp(user->name, name) == 0)
+            return user;
+    }
+    return NULL;
+}
+
+static void
+user_unlinkName(RemoteUser *user) {
+    RemoteUser **pos = &usersByName[hash_name(user->name)];
+    while (*pos != user)
+        pos = &((*pos)->nextByName);
+    *pos = user->nextByName;
+}
+
+static void
+user_linkName(RemoteUser *user) {
+    unsigned int bucket = hash_name(user->name);
+    user->nextByName = usersByName[bucket];
+    usersByName[bucket] = user;
+}
+
+static RemoteUser
+*user_add(char *home, long id, char *name, long long claim, Link *via) {
+    RemoteUser *user = malloc(sizeof(RemoteUser));
+    if (user == NULL) {
+        perror("Insufficent memory!");
+        return NULL;
+    }
+    user->home = strdup(home);
+    user->id = id;
+    user->name = strdup(name);
+    user->claim = claim;
+    user->via = via;
+    unsigned int bucket = hash_id(home, id);
+    user->nextById = usersById[bucket];
+    usersById[bucket] = user;
+    user_linkName(user);
+    user->listIndex = userList->size;
+    userVector_add(userList, user);
+
+    roster_add(user->name);
+    presence_joined(user->name);
+    return user;
+}
+
+// Forgets the user, notify is false when another user takes over the name
+static void
+user_remove(RemoteUser *user, bool notify) {
+    RemoteUser **pos = &usersById[hash_id(user->home, user->id)];
+    while (*pos != user)
+        pos = &((*pos)->nextById);
+    *pos = user->nextById;
+    user_unlinkName(user);
+    userVector_removeFast(userList, user->listIndex, NULL);
+    if (user->listIndex < userList->size)
+        userList->elements[user->listIndex]->listIndex = user->listIndex;
+
+    roster_remove(user->name);
+    if (notify)
+        presence_left(user->name);
+    free(user->home);
+    free(user->name);
+    free(user);
+}
+
+static void
+user_rename(RemoteUser *user, char *name, long long claim) {
+    StringBuffer *msg = StringBuffer_construct();
+    StringBuffer_concat(msg, "INFO: '");
+    StringBuffer_concat(msg, user->name);
+    StringBuffer_concat(msg, "' nennt sich nun '");
+    StringBuffer_concat(msg, name);
+    StringBuffer_concat(msg, "'.");
+    broadcast(msg);
+    StringBuffer_free(msg);
+
+    roster_rename(user->name, name);
+    user_unlinkName(user);
+    free(user->name);
+    user->name = strdup(name);
+    user->claim = claim;
+    user_linkName(user);
+}
+
+bool
+federation_nameTaken(char *name) {
+    return user_findByName(name) != NULL;
+}
+
+int
+federation_userCount(void) {
+    return (userList == NULL ? 0 : userList->size);
+}
+
+char
+*federation_userName(int index) {
+    return userList->elements[index]->name;
+}
+
+// *******************************************
+// Nick conflicts
+// *******************************************
+
+// Earlier claims win, claims of the same millisecond are decided by the node name
+static bool
+claim_wins(long long claim, char *home, long long other, char *otherHome) {
+    if (claim != other)
+        return claim < other;
+    return strcmp(home, otherHome) < 0;
+}
+
+// Every node decides a conflict the same way, only the home of the losing
+// user renames it. Returns false when the claim loses.
+static bool
+resolve_claim(char *name, char *home, long id, long long claim) {
+    // Standard names aren't unique
+    if (claim == 0)
+        return true;
+    Client *local = search_client_by_name(name);
+    if (local != NULL && local->nameClaim > 0) {
+        if (!claim_wins(claim, home, local->nameClaim, nodeName))
+            return false;
+        rename_loser(local);
+    }
+    RemoteUser *user = usersByName[hash_name(name)];
+    while (user != NULL) {
+        RemoteUser *next = user->nextByName;
+        if (user->claim > 0 && strcasecmp(user->name, name) == 0 && (user->id != id || strcmp(user->home, home) != 0)) {
+            if (!claim_wins(claim, home, user->claim, user->home))
+                return false;
+            // Its home renames the user later
+            user_remove(user, false);
+        }
+        user = next;
+    }
+    return true;
+}
+
+static void
+rename_loser(Client *client) {
+    // Append the node name and a number until the name is free
+    int size = strlen(client->name) + strlen(nodeName) + 16;
+    char *name = malloc(size);
+    snprintf(name, size, "%s_%s", client->name, nodeName);
+    int i;
+    for (i = 2; search_client_by_name(name) != NULL || federation_nameTaken(name); ++i) {
+        snprintf(name, size, "%s_%s%d", client->name, nodeName, i);
+    }
+    StringBuffer *msg = StringBuffer_construct();
+    StringBuffer_concat(msg, "INFO: Der Name '");
+    StringBuffer_concat(msg, client->name);
+    StringBuffer_concat(msg, "' wird bereits auf einem anderen Server benutzt, du heisst nun '");
+    StringBuffer_concat(msg, name);
+    StringBuffer_concat(msg, "'.");
+    send_message(client->socket, msg);
+    StringBuffer_free(msg);
+
+    rename_client(client, name);
+    free(name);
+}
+
+// *******************************************
+// Duplicate detection
+// *******************************************
+
+// Returns true when the message was seen before
+static bool
+seen(char *node, long long seq) {
+    // Own messages came back over a cycle
+    if (strcmp(node, nodeName) == 0)
+        return true;
+    Origin *origin = NULL;
+    int i;
+    for (i = 0; i < origins->size; ++i) {
+        if (strcmp(origins->elements[i]->node, node) == 0) {
+            origin = origins->elements[i];
+            break;
+        }
+    }
+    if (origin == NULL) {
+        origin = malloc(sizeof(Origin));
+        origin->node = strdup(node);
+        origin->highest = seq;
+        origin->window = 1;
+        originVector_add(origins, origin);
+        return false;
+    }
+    if (seq > origin->highest) {
+        long long shift = seq - origin->highest;
+        origin->window = (shift >= DEDUP_WINDOW ? 0 : origin->window << shift) | 1;
+        origin->highest = seq;
+        return false;
+    }
+    long long age = origin->highest - seq;
+    // Too old to decide, better drop it than deliver it twice
+    if (age >= DEDUP_WINDOW)
+        return true;
+    if ((origin->window & (1ULL << age)) != 0)
+        return true;
+    origin->window |= (1ULL << age);
+    return false;
+}
+
+// *******************************************
+// Sending
+// *******************************************
+
+static void
+concat_number(StringBuffer *buffer, long long number) {
+    char temp[32];
+    snprintf(temp, sizeof(temp), "%lld", number);
+    StringBuffer_concat(buffer, temp);
+}
+
+// Writes the queued output as far as the socket takes it
+static int
+link_flush(Link *link) {
+    while (link->output.size > 0) {
+        if (ChunkChain_send(&(link->output), link->socket, link->output.size) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return EXIT_FAILURE;
+            break;
+        }
+    }
+    watch_events(link->socket, POLLIN | (link->output.size > 0 ? POLLOUT : 0));
+    return EXIT_SUCCESS;
+}
+
+static int
+link_send(Link *link, char *data, int len) {
+    if (link->dropped || (link->state != LINK_READY && strncmp(data, "HELLO ", 6) != 0))
+        return EXIT_FAILURE;
+    // The relays mustn't wait for a slow node, nor keep its lines forever
+    if (link->output.size + len > LINK_OUTPUT_LIMIT) {
+        LOG(LOG_FEDERATION, LOG_WARN, "Node doesn't read its lines", link->socket, link->node);
+        link->dropped = true;
+        // Closed by the next poll, the links are iterated now
+        shutdown(link->socket, SHUT_RDWR);
+        return EXIT_FAILURE;
+    }
+    bool idle = (link->output.size == 0);
+    if (ChunkChain_append(&(link->output), data, len) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    // Otherwise the output waits for POLLOUT
+    if (idle && link_flush(link) == EXIT_FAILURE) {
+        link->dropped = true;
+        shutdown(link->socket, SHUT_RDWR);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Sends the line to every link except the one it came from
+static void
+relay(StringBuffer *line, Link *from) {
+    StringBuffer_concat_n(line, "\n", 1);
+    int i;
+    for (i = 0; i < links->size; ++i) {
+        Link *link = links->elements[i];
+        if (link != from && link->state == LINK_READY) {
+            if (link_send(link, line->buffer, line->size) == EXIT_SUCCESS)
+                ++link->sent;
+        }
+    }
+    line->size = line->size - 1;
+    line->buffer[line->size] = '\0';
+}
+
+// Starts a new message of this node
+static StringBuffer
+*event_construct(char *type) {
+    StringBuffer *line = StringBuffer_construct();
+    StringBuffer_concat(line, type);
+    StringBuffer_concat(line, " ");
+    StringBuffer_concat(line, nodeName);
+    StringBuffer_concat(line, " ");
+    concat_number(line, nextSeq++);
+    StringBuffer_concat(line, " ");
+    return line;
+}
+
+static void
+send_hello(Link *link) {
+    StringBuffer *line = StringBuffer_construct();
+    StringBuffer_concat(line, "HELLO ");
+    StringBuffer_concat(line, nodeName);
+    StringBuffer_concat(line, "\n");
+    link_send(link, line->buffer, line->size);
+    StringBuffer_free(line);
+}
+
+static void
+burst_user(Link *link, StringBuffer *burst, char *home, long id, long long claim, char *name) {
+    StringBuffer_concat(burst, "USER ");
+    StringBuffer_concat(burst, home);
+    StringBuffer_concat(burst, " ");
+    concat_number(burst, id);
+    StringBuffer_concat(burst, " ");
+    concat_number(burst, claim);
+    StringBuffer_concat(burst, " ");
+    StringBuffer_concat(burst, name);
+    StringBuffer_concat(burst, "\n");
+    ++link->sent;
+    if (burst->size >= BURST_SIZE) {
+        link_send(link, burst->buffer, burst->size);
+        StringBuffer_clear(burst);
+    }
+}
+
+// Tells the new neighbour about every user known by this node
+static void
+send_burst(Link *link) {
+    StringBuffer *burst = StringBuffer_construct_n(BURST_SIZE);
+    int i;
+    for (i = 0; i < client_count(); ++i) {
+        Client *client = client_at(i);
+        burst_user(link, burst, nodeName, client->id, client->nameClaim, client->name);
+    }
+    for (i = 0; i < userList->size; ++i) {
+        RemoteUser *user = userList->elements[i];
+        if (user->via != link)
+            burst_user(link, burst, user->home, user->id, user->claim, user->name);
+    }
+    if (burst->size > 0)
+        link_send(link, burst->buffer, burst->size);
+    StringBuffer_free(burst);
+}
+
+// *******************************************
+// Events of the local clients
+// *******************************************
+
+void
+federation_joined(Client *client) {
+    if (links == NULL || links->size == 0)
+        return;
+    StringBuffer *line = event_construct("JOIN");
+    concat_number(line, client->id);
+    StringBuffer_concat(line, " ");
+    concat_number(line, client->nameClaim);
+    StringBuffer_concat(line, " ");
+    StringBuffer_concat(line, client->name);
+    relay(line, NULL);
+    StringBuffer_free(line);
+}
+
+void
+federation_left(Client *client) {
+    if (links == NULL || links->size == 0)
+        return;
+    StringBuffer *line = event_construct("PART");
+    StringBuffer_concat(line, nodeName);
+    StringBuffer_concat(line, " ");
+    concat_number(line, client->id);
+    relay(line, NULL);
+    StringBuffer_free(line);
+}
+
+void
+federation_renamed(Client *client) {
+    if (links == NULL || links->size == 0)
+        return;
+    StringBuffer *line = event_construct("NICK");
+    concat_number(line, client->id);
+    StringBuffer_concat(line, " ");
+    concat_number(line, client->nameClaim);
+    StringBuffer_concat(line, " ");
+    StringBuffer_concat(line, client->name);
+    relay(line, NULL);
+    StringBuffer_free(line);
+}
+
+void
+federation_message(Client *client, char *text) {
+    if (links == NULL || links->size == 0)
+        return;
+    StringBuffer *line = event_construct("MSG");
+    StringBuffer_concat(line, client->name);
+    StringBuffer_concat(line, "\t");
+    StringBuffer_concat(line, text);
+    relay(line, NULL);
+    StringBuffer_free(line);
+}
+
+int
+federation_whisper(Client *client, char *receiver, char *text) {
+    if (links == NULL)
+        return EXIT_FAILURE;
+    RemoteUser *user = user_findByName(receiver);
+    if (user == NULL)
+        return EXIT_FAILURE;
+    StringBuffer *line = event_construct("PRIV");
+    StringBuffer_concat(line, client->name);
+    StringBuffer_concat(line, "\t");
+    StringBuffer_concat(line, user->name);
+    StringBuffer_concat(line, "\t");
+    StringBuffer_concat(line, text);
+    // Only the link towards the receiver needs the whisper
+    StringBuffer_concat_n(line, "\n", 1);
+    if (link_send(user->via, line->buffer, line->size) == EXIT_SUCCESS)
+        ++user->via->sent;
+    StringBuffer_free(line);
+    return EXIT_SUCCESS;
+}
+
+// *******************************************
+// Links
+// *******************************************
+
+static Link
+*link_find(int socket) {
+    int i;
+    for (i = 0; i < links->size; ++i) {
+        if (links->elements[i]->socket == socket)
+            return links->elements[i];
+    }
+    return NULL;
+}
+
+static Link
+*link_construct(int socket, int state, char *peer) {
+    Link *link = malloc(sizeof(Link));
+    if (link == NULL) {
+        perror("Insufficent memory!");
+        return NULL;
+    }
+    link->socket = socket;
+    link->state = state;
+    link->node = NULL;
+    link->peer = peer;
+    ChunkChain_init(&(link->input));
+    ChunkChain_init(&(link->output));
+    ChunkChain_account(&(link->output), budget_account(BUDGET_OUTPUT));
+    link->dropped = false;
+    link->sent = 0;
+    link->received = 0;
+    link->since = currentTimeMillis();
+    linkVector_add(links, link);
+    watch_socket(socket, (state == LINK_CONNECTING ? POLLOUT : POLLIN));
+    return link;
+}
+
+static void
+link_close(Link *link) {
+    int i;
+    for (i = 0; i < links->size; ++i) {
+        if (links->elements[i] == link) {
+            linkVector_removeFast(links, i, NULL);
+            break;
+        }
+    }
+    unwatch_socket(link->socket);
+    close(link->socket);
+    ChunkChain_clear(&(link->input));
+    ChunkChain_clear(&(link->output));
+    if (link->node != NULL) {
+        char stats[LOG_TEXT_SIZE];
+        snprintf(stats, sizeof(stats), "%s, %lld lines sent and %lld received in %lld ms",
+                link->node, link->sent, link->received, currentTimeMillis() - link->since);
+        LOG(LOG_FEDERATION, LOG_INFO, "Link closed", link->socket, stats);
+    }
+
+    // The users behind the link are gone, tell the rest of the network
+    for (i = 0; i < userList->size; ++i) {
+        RemoteUser *user = userList->elements[i];
+        if (user->via == link) {
+            StringBuffer *line = event_construct("PART");
+            StringBuffer_concat(line, user->home);
+            StringBuffer_concat(line, " ");
+            concat_number(line, user->id);
+            relay(line, NULL);
+            StringBuffer_free(line);
+            // The last user takes its position
+            user_remove(user, true);
+            --i;
+        }
+    }
+
+    // Outgoing links are connected again
+    if (link->peer != NULL)
+        defer_task(LINK_RETRY * 1000LL, &connect_peer, link->peer);
+    free(link->node);
+    free(link);
+}
+
+static void
+connect_peer(void *data) {
+    char *peer = data;
+    // Address is host:port, the host can contain colons itself
+    char *colon = strrchr(peer, ':');
+    if (colon == NULL) {
+        fprintf(stderr, "Invalid address of a node: %s\n", peer);
+        return;
+    }
+    char *host = strndup(peer, colon - peer);
+    struct addrinfo hints;
+    memset(&hints, 0 , sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res;
+    int error = getaddrinfo(host, colon + 1, &hints, &res);
+    free(host);
+    if (error != 0) {
+        fprintf(stderr, "Can't resolve %s: %s\n", peer, gai_strerror(error));
+        defer_task(LINK_RETRY * 1000LL, &connect_peer, peer);
+        return;
+    }
+    int sock = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, res->ai_protocol);
+    if (sock < 0 || (connect(sock, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+        LOG_ERRNO(LOG_FEDERATION, "Can't connect to the node", -1);
+        if (sock >= 0)
+            close(sock);
+        freeaddrinfo(res);
+        defer_task(LINK_RETRY * 1000LL, &connect_peer, peer);
+        return;
+    }
+    freeaddrinfo(res);
+    link_construct(sock, LINK_CONNECTING, peer);
+}
+
+// *******************************************
+// Received lines
+// *******************************************
+
+static int
+handle_hello(Link *link, char *line) {
+    char node[NODE_NAME_SIZE];
+    if (sscanf(line, "HELLO %255s", node) != 1)
+        return EXIT_FAILURE;
+    if (strcmp(node, nodeName) == 0) {
+        LOG(LOG_FEDERATION, LOG_ERROR, "Node is linked to itself", link->socket, node);
+        return EXIT_FAILURE;
+    }
+    int i;
+    for (i = 0; i < links->size; ++i) {
+        Link *other = links->elements[i];
+        if (other != link && other->node != NULL && strcmp(other->node, node) == 0) {
+            LOG(LOG_FEDERATION, LOG_ERROR, "Node is already linked", link->socket, node);
+            return EXIT_FAILURE;
+        }
+    }
+    link->node = strdup(node);
+    link->state = LINK_READY;
+    LOG(LOG_FEDERATION, LOG_INFO, "Linked to node", link->socket, node);
+    send_burst(link);
+    return EXIT_SUCCESS;
+}
+
+static int
+handle_user(Link *link, char *line) {
+    char home[NODE_NAME_SIZE];
+    long id;
+    long long claim;
+    int pos = 0;
+    if (sscanf(line, "USER %255s %ld %lld %n", home, &id, &claim, &pos) != 3 || pos == 0)
+        return EXIT_FAILURE;
+    char *name = line + pos;
+    // Known users end the flood of the burst
+    if (strcmp(home, nodeName) == 0 || user_find(home, id) != NULL)
+        return EXIT_SUCCESS;
+    if (!resolve_claim(name, home, id, claim))
+        return EXIT_SUCCESS;
+    user_add(home, id, name, claim, link);
+    StringBuffer *forward = StringBuffer_construct();
+    StringBuffer_concat(forward, line);
+    relay(forward, link);
+    StringBuffer_free(forward);
+    return EXIT_SUCCESS;
+}
+
+// Delivers a whisper to a local client or passes it towards the receiver
+static void
+handle_whisper(Link *link, StringBuffer *line, char *args) {
+    char *receiver = strchr(args, '\t');
+    char *text = (receiver == NULL ? NULL : strchr(receiver + 1, '\t'));
+    if (text == NULL)
+        return;
+    *text = '\0';
+    Client *client = search_client_by_name(receiver + 1);
+    RemoteUser *user = (client == NULL ? user_findByName(receiver + 1) : NULL);
+    *text = '\t';
+    if (client != NULL) {
+        *receiver = '\0';
+        StringBuffer *msg = StringBuffer_construct();
+        StringBuffer_concat(msg, "[");
+        StringBuffer_concat(msg, args);
+        StringBuffer_concat(msg, " -> me]: ");
+        StringBuffer_concat(msg, text + 1);
+        send_message_lane(client->socket, msg, LANE_DIRECT);
+        StringBuffer_free(msg);
+        return;
+    }
+    // Receiver is gone otherwise
+    if (user != NULL && user->via != link && user->via->state == LINK_READY) {
+        StringBuffer_concat_n(line, "\n", 1);
+        if (link_send(user->via, line->buffer, line->size) == EXIT_SUCCESS)
+            ++user->via->sent;
+    }
+}
+
+static int
+handle_event(Link *link, char *line) {
+    char type[16];
+    char origin[NODE_NAME_SIZE];
+    long long seq;
+    int pos = 0;
+    if (sscanf(line, "%15s %255s %lld %n", type, origin, &seq, &pos) != 3 || pos == 0)
+        return EXIT_FAILURE;
+    if (seen(origin, seq))
+        return EXIT_SUCCESS;
+    char *args = line + pos;
+    StringBuffer *forward = StringBuffer_construct();
+    StringBuffer_concat(forward, line);
+
+    // Whispers only travel towards the receiver
+    if (strcmp(type, "PRIV") == 0) {
+        handle_whisper(link, forward, args);
+        StringBuffer_free(forward);
+        return EXIT_SUCCESS;
+    }
+    relay(forward, link);
+    StringBuffer_free(forward);
+
+    long id;
+    long long claim;
+    int namePos = 0;
+    if (strcmp(type, "MSG") == 0) {
+        char *text = strchr(args, '\t');
+        if (text == NULL)
+            return EXIT_FAILURE;
+        *text = '\0';
+        StringBuffer *msg = StringBuffer_construct();
+        StringBuffer_concat(msg, "[");
+        StringBuffer_concat(msg, args);
+        StringBuffer_concat(msg, "]: ");
+        StringBuffer_concat(msg, text + 1);
+        broadcast(msg);
+        StringBuffer_free(msg);
+    }
+    else if (strcmp(type, "JOIN") == 0) {
+        if (sscanf(args, "%ld %lld %n", &id, &claim, &namePos) != 2 || namePos == 0)
+            return EXIT_FAILURE;
+        if (user_find(origin, id) == NULL && resolve_claim(args + namePos, origin, id, claim))
+            user_add(origin, id, args + namePos, claim, link);
+    }
+    else if (strcmp(type, "PART") == 0) {
+        char home[NODE_NAME_SIZE];
+        if (sscanf(args, "%255s %ld", home, &id) != 2)
+            return EXIT_FAILURE;
+        RemoteUser *user = user_find(home, id);
+        if (user != NULL)
+            user_remove(user, true);
+    }
+    else if (strcmp(type, "NICK") == 0) {
+        if (sscanf(args, "%ld %lld %n", &id, &claim, &namePos) != 2 || namePos == 0)
+            return EXIT_FAILURE;
+        char *name = args + namePos;
+        if (resolve_claim(name, origin, id, claim)) {
+            RemoteUser *user = user_find(origin, id);
+            if (user != NULL)
+                user_rename(user, name, claim);
+            // The user lost a conflict before and was forgotten
+            else
+                user_add(origin, id, name, claim, link);
+        }
+    }
+    // Unknown messages of newer nodes are only relayed
+    return EXIT_SUCCESS;
+}
+
+static int
+handle_line(Link *link, char *line) {
+    ++link->received;
+    if (strncmp(line, "HELLO ", 6) == 0)
+        return handle_hello(link, line);
+    // Nothing but the hello is accepted before the hello
+    if (link->state != LINK_READY)
+        return EXIT_FAILURE;
+    if (strncmp(line, "USER ", 5) == 0)
+        return handle_user(link, line);
+    return handle_event(link, line);
+}
+
+static int
+link_dispatch(Link *link) {
+    int len;
+    while ((len = ChunkChain_find(&(link->input), '\n')) >= 0) {
+        char *line = malloc(len + 1);
+        if (line == NULL) {
+            perror("Insufficent memory!");
+            return EXIT_FAILURE;
+        }
+        ChunkChain_copy(&(link->input), line, len);
+        line[len] = '\0';
+        ChunkChain_consume(&(link->input), len + 1);
+        int res = handle_line(link, line);
+        free(line);
+        if (res != EXIT_SUCCESS) {
+            LOG(LOG_FEDERATION, LOG_ERROR, "Invalid line from node", link->socket, link->node);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// *******************************************
+// Socket events
+// *******************************************
+
+bool
+federation_isSocket(int socket) {
+    if (links == NULL)
+        return false;
+    int i;
+    for (i = 0; i < listeners->size; ++i) {
+        if (listeners->elements[i] == socket)
+            return true;
+    }
+    return link_find(socket) != NULL;
+}
+
+static void
+accept_links(int listener) {
+    int sock;
+    while ((sock = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        Link *link = link_construct(sock, LINK_HELLO, NULL);
+        if (link == NULL) {
+            close(sock);
+            continue;
+        }
+        send_hello(link);
+    }
+}
+
+int
+federation_handle(int socket, short revents) {
+    int i;
+    for (i = 0; i < listeners->size; ++i) {
+        if (listeners->elements[i] == socket) {
+            accept_links(socket);
+            return EXIT_SUCCESS;
+        }
+    }
+    Link *link = link_find(socket);
+    if (link == NULL)
+        return EXIT_FAILURE;
+
+    // Outgoing connection is established or failed
+    if (link->state == LINK_CONNECTING) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+            if (LOG_ERROR <= logLevels[LOG_FEDERATION])
+                Log_write(LOG_FEDERATION, LOG_ERROR, "Can't connect to the node", socket, link->peer, error);
+            link_close(link);
+            return LINK_CLOSED;
+        }
+        link->state = LINK_HELLO;
+        watch_events(socket, POLLIN);
+        send_hello(link);
+        return EXIT_SUCCESS;
+    }
+    if (link->dropped) {
+        link_close(link);
+        return LINK_CLOSED;
+    }
+    if ((revents & POLLOUT) != 0 && link_flush(link) != EXIT_SUCCESS) {
+        link_close(link);
+        return LINK_CLOSED;
+    }
+    if ((revents & POLLIN) != 0) {
+        int res = ChunkChain_read(&(link->input), socket, LINK_READ_SIZE);
+        if (res == 0 || (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                || link_dispatch(link) != EXIT_SUCCESS) {
+            link_close(link);
+            return LINK_CLOSED;
+        }
+        return EXIT_SUCCESS;
+    }
+    if ((revents & POLLOUT) != 0)
+        return EXIT_SUCCESS;
+    // Connection was closed or broken
+    link_close(link);
+    return LINK_CLOSED;
+}
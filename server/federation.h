@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include <stdbool.h>
+#include "clientStruct.h"
+
+// Several servers are linked over TCP into one chat network. Messages,
+// whispers, nick changes and presence events are flooded over the links,
+// every node relays a message only once per link and never back to the
+// link it came from. The links should form a tree, duplicates over a cycle
+// are detected by the origin and the sequence number of the message.
+
+// Result of federation_handle when the socket was closed and removed
+#define LINK_CLOSED -2
+
+void federation_setNode(char *node);
+
+void federation_addPeer(char *address);
+
+// A failed listener is tried again later when retry is true
+int federation_init(char *port, bool retry);
+
+// Listening sockets are handed over to a successor, the links aren't.
+// The neighbours connect again and the new links start with a burst.
+
+void federation_adopt(int listener);
+
+int federation_listenerCount(void);
+
+int *federation_listeners(void);
+
+bool federation_isSocket(int socket);
+
+int federation_handle(int socket, short revents);
+
+bool federation_nameTaken(char *name);
+
+int federation_userCount(void);
+
+char *federation_userName(int index);
+
+void federation_joined(Client *client);
+
+void federation_left(Client *client);
+
+void federation_renamed(Client *client);
+
+void federation_message(Client *client, char *text);
+
+int federation_whisper(Client *client, char *receiver, char *text);
+
+#endif
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "filter.h"
+#include "../common/time/clock.h"
+
+// Character replacing the matched text
+#define FILTER_MASK '*'
+
+// Longer patterns are ignored
+#define FILTER_MAX_PATTERN 1024
+
+// *******************************************
+// Automaton
+// *******************************************
+
+Filter
+*Filter_compile(char **patterns, int count) {
+    Filter *filter = calloc(1, sizeof(Filter));
+    if (filter == NULL) {
+        perror("Insufficent memory!");
+        return NULL;
+    }
+    // Class 0 are all bytes which are part of no pattern
+    int maxStates = 1;
+    int i, j, c;
+    filter->classes = 1;
+    for (i = 0; i < count; ++i) {
+        unsigned char *pattern = (unsigned char *)patterns[i];
+        for (j = 0; pattern[j] != '\0'; ++j) {
+            c = tolower(pattern[j]);
+            if (filter->classOf[c] == 0 && filter->classes < 256)
+                filter->classOf[c] = filter->classes++;
+        }
+        maxStates += j;
+    }
+    // Upper case letters share the class of the lower case ones
+    for (c = 0; c < 256; ++c) {
+        filter->classOf[c] = filter->classOf[tolower(c)];
+    }
+
+    int classes = filter->classes;
+    filter->table = malloc(sizeof(int) * maxStates * classes);
+    filter->matchLength = calloc(maxStates, sizeof(unsigned short));
+    int *fail = malloc(sizeof(int) * maxStates);
+    int *queue = malloc(sizeof(int) * maxStates);
+    if (filter->table == NULL || filter->matchLength == NULL || fail == NULL || queue == NULL) {
+        perror("Insufficent memory!");
+        free(fail);
+        free(queue);
+        Filter_free(filter);
+        return NULL;
+    }
+    memset(filter->table, -1, sizeof(int) * maxStates * classes);
+
+    // Build the trie of the patterns
+    int states = 1;
+    for (i = 0; i < count; ++i) {
+        unsigned char *pattern = (unsigned char *)patterns[i];
+        int state = 0;
+        for (j = 0; pattern[j] != '\0'; ++j) {
+            int *next = &(filter->table[state * classes + filter->classOf[pattern[j]]]);
+            if (*next < 0)
+                *next = states++;
+            state = *next;
+        }
+        if (j > 0 && j > filter->matchLength[state])
+            filter->matchLength[state] = j;
+    }
+    filter->states = states;
+    filter->patterns = count;
+
+    // Replace the missing transitions by the ones of the failure state,
+    // so matching needs exactly one lookup per byte
+    int head = 0;
+    int tail = 0;
+    fail[0] = 0;
+    for (c = 0; c < classes; ++c) {
+        int next = filter->table[c];
+        if (next < 0) {
+            filter->table[c] = 0;
+        }
+        else {
+            fail[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+    while (head < tail) {
+        int state = queue[head++];
+        // Patterns ending in the failure state end here too
+        if (filter->matchLength[fail[state]] > filter->matchLength[state])
+            filter->matchLength[state] = filter->matchLength[fail[state]];
+        int *row = &(filter->table[state * classes]);
+        int *failRow = &(filter->table[fail[state] * classes]);
+        for (c = 0; c < classes; ++c) {
+            if (row[c] < 0) {
+                row[c] = failRow[c];
+            }
+            else {
+                fail[row[c]] = failRow[c];
+                queue[tail++] = row[c];
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+
+    // Shrink the table to the used states
+    int *table = realloc(filter->table, sizeof(int) * states * classes);
+    if (table != NULL)
+        filter->table = table;
+    return filter;
+}
+
+int
+Filter_apply(Filter *filter, char *text, int len) {
+    int *table = filter->table;
+    int classes = filter->classes;
+    int state = 0;
+    int matches = 0;
+    int i;
+    for (i = 0; i < len; ++i) {
+        state = table[state * classes + filter->classOf[(unsigned char)text[i]]];
+        int matchLength = filter->matchLength[state];
+        // Mask the longest pattern ending here, shorter ones are part of it
+        if (matchLength > 0) {
+            memset(text + i - matchLength + 1, FILTER_MASK, matchLength);
+            ++matches;
+        }
+    }
+    return matches;
+}
+
+void
+Filter_free(Filter *filter) {
+    if (filter == NULL)
+        return;
+    free(filter->table);
+    free(filter->matchLength);
+    free(filter);
+}
+
+// *******************************************
+// Filter of the server
+// *******************************************
+
+// File of the patterns, NULL when nothing is filtered
+static char *filterPath;
+
+// Automaton used by the server loop
+static Filter *current;
+
+// Compiled by the reload thread, taken over by the server loop
+static Filter *pending;
+
+static bool reloading;
+
+static Filter
+*filter_load(char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Can't open the filter list!");
+        return NULL;
+    }
+    char **patterns = NULL;
+    int count = 0;
+    int capacity = 0;
+    char *line = NULL;
+    size_t lineSize = 0;
+    ssize_t len;
+    while ((len = getline(&line, &lineSize, file)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || len > FILTER_MAX_PATTERN || line[0] == '#')
+            continue;
+        if (count == capacity) {
+            capacity = (capacity == 0 ? 64 : capacity * 2);
+            char **temp = realloc(patterns, sizeof(char *) * capacity);
+            if (temp == NULL) {
+                perror("Insufficent memory!");
+                break;
+            }
+            patterns = temp;
+        }
+        patterns[count] = strdup(line);
+        if (patterns[count] != NULL)
+            ++count;
+    }
+    free(line);
+    fclose(file);
+
+    Filter *filter = Filter_compile(patterns, count);
+    int i;
+    for (i = 0; i < count; ++i) {
+        free(patterns[i]);
+    }
+    free(patterns);
+    return filter;
+}
+
+int
+filter_init(char *path) {
+    filterPath = path;
+    if (path == NULL)
+        return EXIT_SUCCESS;
+    long long start = currentTimeMillis();
+    current = filter_load(path);
+    if (current == NULL)
+        return EXIT_FAILURE;
+    printf("Filter with %d patterns and %d states compiled in %lld ms\n", current->patterns, current->states, currentTimeMillis() - start);
+    return EXIT_SUCCESS;
+}
+
+static void
+*filter_compileThread(void *data) {
+    (void)data;
+    long long start = currentTimeMillis();
+    Filter *filter = filter_load(filterPath);
+    if (filter != NULL) {
+        printf("Filter reloaded with %d patterns and %d states in %lld ms\n", filter->patterns, filter->states, currentTimeMillis() - start);
+        // An older result wasn't used yet
+        Filter_free(__atomic_exchange_n(&pending, filter, __ATOMIC_ACQ_REL));
+    }
+    __atomic_store_n(&reloading, false, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int
+filter_reload(void) {
+    if (filterPath == NULL)
+        return EXIT_FAILURE;
+    // The list is already compiled again
+    if (__atomic_exchange_n(&reloading, true, __ATOMIC_ACQ_REL))
+        return EXIT_SUCCESS;
+    // The server loop keeps filtering with the old automaton meanwhile
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &filter_compileThread, NULL) != 0) {
+        perror("Can't start the filter compiler!");
+        __atomic_store_n(&reloading, false, __ATOMIC_RELEASE);
+        return EXIT_FAILURE;
+    }
+    pthread_detach(thread);
+    return EXIT_SUCCESS;
+}
+
+int
+filter_message(char *text, int len) {
+    // Swap in a reloaded automaton
+    if (__atomic_load_n(&pending, __ATOMIC_RELAXED) != NULL) {
+        Filter *next = __atomic_exchange_n(&pending, NULL, __ATOMIC_ACQ_REL);
+        if (next != NULL) {
+            Filter_free(current);
+            current = next;
+        }
+    }
+    if (current == NULL)
+        return 0;
+    return Filter_apply(current, text, len);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+
+// Masks banned words and spam URLs in the messages of the clients. All
+// patterns of the list are compiled into one Aho-Corasick automaton, a
+// message is matched case-insensitively in a single pass, so the costs
+// don't depend on the number of patterns. The list is a file with one
+// pattern per line, empty lines and lines starting with '#' are ignored.
+
+typedef struct Filter {
+    // Bytes are mapped to the few classes used by the patterns
+    unsigned char classOf[256];
+    int classes;
+    int states;
+    // Next state for every state and class, states * classes entries
+    int *table;
+    // Length of the longest pattern ending in a state, 0 for none
+    unsigned short *matchLength;
+    int patterns;
+} Filter;
+
+Filter
+*Filter_compile(char **patterns, int count);
+
+int
+Filter_apply(Filter *filter, char *text, int len);
+
+void
+Filter_free(Filter *filter);
+
+// Filter of the server
+
+int filter_init(char *path);
+
+int filter_reload(void);
+
+int filter_message(char *text, int len);
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "handoff.h"
+
+static int
+handoff_address(char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Path '%s' is too long for a unix socket!\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy(address->sun_path, path);
+    return EXIT_SUCCESS;
+}
+
+int
+handoff_listen(char *path) {
+    struct sockaddr_un address;
+    if (handoff_address(path, &address) == EXIT_FAILURE)
+        return -1;
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        perror("Can't create handoff socket!");
+        return -1;
+    }
+    // Socket file of the previous server
+    unlink(path);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(listener, 1) == -1) {
+        perror("Can't listen on handoff socket!");
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+int
+handoff_connect(char *path) {
+    struct sockaddr_un address;
+    if (handoff_address(path, &address) == EXIT_FAILURE)
+        return -1;
+    int socket_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (socket_ < 0) {
+        perror("Can't create handoff socket!");
+        return -1;
+    }
+    if (connect(socket_, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        close(socket_);
+        return -1;
+    }
+    return socket_;
+}
+
+int
+handoff_send(int socket, char *data, int len, int *fds, int fdCount) {
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    // File descriptors are sent as ancillary data
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    if (fdCount > 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCount);
+    }
+
+    int sent;
+    do {
+        sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent != len) {
+        perror("Can't send handoff message!");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int
+handoff_receive(int socket, char *data, int maxLen, int *fds, int *fdCount) {
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = maxLen;
+
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int received;
+    do {
+        received = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0) {
+        fprintf(stderr, "Can't receive handoff message!\n");
+        return -1;
+    }
+
+    *fdCount = 0;
+    struct cmsghdr *cmsg;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            *fdCount = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (*fdCount));
+        }
+    }
+    return received;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+// Unix socket connection between a running server and its successor.
+// Messages keep their boundaries and can carry file descriptors.
+
+// Most file descriptors sent by a single message
+#define HANDOFF_MAX_FDS 64
+
+// Biggest message, limited by the socket buffer
+#define HANDOFF_MAX_MESSAGE (128 * 1024)
+
+// Milliseconds to wait for the successor to confirm the handoff
+#define HANDOFF_TIMEOUT 5000
+
+int handoff_listen(char *path);
+
+int handoff_connect(char *path);
+
+int handoff_send(int socket, char *data, int len, int *fds, int fdCount);
+
+int handoff_receive(int socket, char *data, int maxLen, int *fds, int *fdCount);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "../common/time/clock.h"
+
+// Records in the ring, must be a power of two
+#define LOG_CAPACITY 8192
+
+// Bytes collected before they are written
+#define LOG_BATCH 65536
+
+// Sleep of the background thread when the ring is empty
+#define LOG_IDLE_NANOS 5000000
+
+int logLevels[LOG_SUBSYSTEMS] = {LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO};
+
+const char *logLevelNames[] = {"off", "error", "warn", "info", "debug", NULL};
+
+static const char *subsystemNames[] = {"server", "client", "federation", "transfer"};
+
+// Slot of the ring, the sequence tells the producers and the consumer whose turn it is
+typedef struct LogSlot {
+    unsigned long sequence;
+    LogRecord record;
+} LogSlot;
+
+static LogSlot *slots;
+static unsigned long head __attribute__((aligned(64)));
+static unsigned long tail __attribute__((aligned(64)));
+static unsigned long dropped __attribute__((aligned(64)));
+
+static pthread_t thread;
+
+void
+Log_write(int subsystem, int level, const char *message, int socket, const char *text, int error) {
+    // Not started yet, write it directly
+    if (slots == NULL) {
+        fprintf(stderr, "%s: %s\n", subsystemNames[subsystem], message);
+        return;
+    }
+    unsigned long pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    LogSlot *slot;
+    while (true) {
+        slot = &slots[pos & (LOG_CAPACITY - 1)];
+        unsigned long sequence = __atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE);
+        long diff = (long)sequence - (long)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        // Ring is full, the server never waits for the log
+        else if (diff < 0) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+    LogRecord *record = &(slot->record);
+    record->time = wallTimeMillis();
+    record->level = level;
+    record->subsystem = subsystem;
+    record->socket = socket;
+    record->error = error;
+    record->message = message;
+    if (text == NULL) {
+        record->text[0] = '\0';
+    }
+    else {
+        strncpy(record->text, text, LOG_TEXT_SIZE - 1);
+        record->text[LOG_TEXT_SIZE - 1] = '\0';
+    }
+    __atomic_store_n(&(slot->sequence), pos + 1, __ATOMIC_RELEASE);
+}
+
+static int
+Log_format(LogRecord *record, char *line, int size) {
+    static const char *levels[] = {"", "ERROR", "WARN ", "INFO ", "DEBUG"};
+    time_t seconds = record->time / 1000;
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    int len = snprintf(line, size, "%02d:%02d:%02d.%03d %s %s: %s",
+        tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(record->time % 1000),
+        levels[record->level], subsystemNames[record->subsystem], record->message);
+    if (record->socket >= 0 && len < size)
+        len += snprintf(line + len, size - len, " fd=%d", record->socket);
+    if (record->text[0] != '\0' && len < size)
+        len += snprintf(line + len, size - len, " %s", record->text);
+    if (record->error != 0 && len < size) {
+        char error[128];
+        len += snprintf(line + len, size - len, ": %s", strerror_r(record->error, error, sizeof(error)));
+    }
+    if (len >= size - 1)
+        len = size - 2;
+    line[len++] = '\n';
+    return len;
+}
+
+static void
+Log_writeAll(char *data, int len) {
+    while (len > 0) {
+        int written = write(STDOUT_FILENO, data, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+// Formats and writes all records in the ring, returns their number
+static int
+Log_drain(char *batch) {
+    int len = 0;
+    int count = 0;
+    while (true) {
+        LogSlot *slot = &slots[tail & (LOG_CAPACITY - 1)];
+        if (__atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+        // Room for a full line
+        if (len > LOG_BATCH - 512) {
+            Log_writeAll(batch, len);
+            len = 0;
+        }
+        len += Log_format(&(slot->record), batch + len, LOG_BATCH - len);
+        __atomic_store_n(&(slot->sequence), tail + LOG_CAPACITY, __ATOMIC_RELEASE);
+        __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+        ++count;
+    }
+    unsigned long lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+    if (lost > 0)
+        len += snprintf(batch + len, LOG_BATCH - len, "%lu log records dropped\n", lost);
+    if (len > 0)
+        Log_writeAll(batch, len);
+    return count;
+}
+
+static void
+*Log_run(void *data) {
+    (void)data;
+    char *batch = malloc(LOG_BATCH);
+    if (batch == NULL) {
+        perror("Insufficent memory!");
+        return NULL;
+    }
+    struct timespec idle = {0, LOG_IDLE_NANOS};
+    while (true) {
+        // Wait for more records, a busy server fills a batch meanwhile
+        if (Log_drain(batch) == 0)
+            nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+int
+Log_init(void) {
+    slots = malloc(sizeof(LogSlot) * LOG_CAPACITY);
+    if (slots == NULL) {
+        perror("Insufficent memory!");
+        return EXIT_FAILURE;
+    }
+    unsigned long i;
+    for (i = 0; i < LOG_CAPACITY; ++i) {
+        slots[i].sequence = i;
+    }
+    // Messages of the start come before the records
+    fflush(stdout);
+    // Signals like SIGHUP are left to the server loop
+    sigset_t signals, previous;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_SETMASK, &signals, &previous);
+    int result = pthread_create(&thread, NULL, &Log_run, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (result != 0) {
+        perror("Can't start the log thread!");
+        free(slots);
+        slots = NULL;
+        return EXIT_FAILURE;
+    }
+    pthread_detach(thread);
+    return EXIT_SUCCESS;
+}
+
+void
+Log_flush(void) {
+    if (slots == NULL)
+        return;
+    // Wait a moment for the background thread to write the last records
+    struct timespec idle = {0, LOG_IDLE_NANOS};
+    int i;
+    for (i = 0; i < 200 && __atomic_load_n(&tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&head, __ATOMIC_RELAXED); ++i) {
+        nanosleep(&idle, NULL);
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+// Logging without blocking the server loop. A call only copies a record of
+// fixed size into a lock-free ring, a background thread formats the records
+// and writes them in batches to stdout. Records are dropped and counted
+// when the ring is full.
+
+// Levels, a record is written when its level is at most the level of its subsystem
+#define LOG_OFF     0
+#define LOG_ERROR   1
+#define LOG_WARN    2
+#define LOG_INFO    3
+#define LOG_DEBUG   4
+
+// Subsystems with their own level
+#define LOG_SERVER      0
+#define LOG_CLIENT      1
+#define LOG_FEDERATION  2
+#define LOG_TRANSFER    3
+#define LOG_SUBSYSTEMS  4
+
+// Bytes of the text of a record, longer texts are truncated
+#define LOG_TEXT_SIZE 88
+
+typedef struct LogRecord {
+    // Wall clock time in milliseconds
+    long long time;
+    short level;
+    short subsystem;
+    // Socket of the client, -1 for none
+    int socket;
+    // errno of a failed call, 0 for none
+    int error;
+    // Constant string, only the pointer is stored
+    const char *message;
+    char text[LOG_TEXT_SIZE];
+} LogRecord;
+
+extern int logLevels[LOG_SUBSYSTEMS];
+
+extern const char *logLevelNames[];
+
+// The level is checked before any arguments are copied
+#define LOG(subsystem, level, message, socket, text) \
+    do { \
+        if ((level) <= logLevels[(subsystem)]) \
+            Log_write((subsystem), (level), (message), (socket), (text), 0); \
+    } while (0)
+
+// Like perror, the errno is formatted by the background thread
+#define LOG_ERRNO(subsystem, message, socket) \
+    do { \
+        if (LOG_ERROR <= logLevels[(subsystem)]) \
+            Log_write((subsystem), LOG_ERROR, (message), (socket), NULL, errno); \
+    } while (0)
+
+int
+Log_init(void);
+
+void
+Log_write(int subsystem, int level, const char *message, int socket, const char *text, int error);
+
+void
+Log_flush(void);
+
+#endif
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "mailbox.h"
+#include "server.h"
+#include "config.h"
+#include "outbox.h"
+#include "../common/time/clock.h"
+
+#define MAIL_BUCKETS 4096
+
+// Records in the arena are aligned to this
+#define MAIL_ALIGN 8
+
+// Part of the arena which is freed when it is full
+#define MAIL_RESERVE 8
+
+// Mails of a nick, chained by their offsets in the arena
+typedef struct Mailbox {
+    char *name;
+    int first;
+    int last;
+    int count;
+    struct Mailbox *next;
+} Mailbox;
+
+// Header of a mail in the arena, followed by the sender and the text
+typedef struct Mail {
+    // NULL when the mail was delivered or dropped
+    Mailbox *box;
+    long long time;
+    // Bytes of the whole record
+    int size;
+    // Offset of the next mail of the box, -1 for the last one
+    int next;
+    int senderLength;
+    int textLength;
+} Mail;
+
+static char *arena;
+static int capacity;
+// Bytes of the records, the live and the dead ones
+static int used;
+static int deadBytes;
+// No live mail is stored before this offset
+static int front;
+
+static Mailbox *boxes[MAIL_BUCKETS];
+static int boxCount;
+
+static unsigned int
+hash_name(char *name) {
+    // Names are compared case insensitive
+    unsigned int hash = 5381;
+    for (; *name != '\0'; ++name)
+        hash = hash * 33 + tolower((unsigned char)*name);
+    return hash % MAIL_BUCKETS;
+}
+
+static Mailbox
+*box_find(char *name) {
+    Mailbox *box = boxes[hash_name(name)];
+    for (; box != NULL; box = box->next) {
+        if (strcasecmp(box->name, name) == 0)
+            return box;
+    }
+    return NULL;
+}
+
+static Mailbox
+*box_create(char *name) {
+    Mailbox *box = malloc(sizeof(Mailbox));
+    if (box == NULL) {
+        perror("Insufficent memory!");
+        return NULL;
+    }
+    box->name = strdup(name);
+    box->first = -1;
+    box->last = -1;
+    box->count = 0;
+    ++boxCount;
+    unsigned int bucket = hash_name(name);
+    box->next = boxes[bucket];
+    boxes[bucket] = box;
+    return box;
+}
+
+static void
+box_remove(Mailbox *box) {
+    Mailbox **p = &(boxes[hash_name(box->name)]);
+    while (*p != box)
+        p = &((*p)->next);
+    *p = box->next;
+    --boxCount;
+    free(box->name);
+    free(box);
+}
+
+static Mail
+*mail_at(int offset) {
+    return (Mail *)(arena + offset);
+}
+
+// Mails before this time are expired
+static long long
+mail_expiry(long long now) {
+    return (config.mailAge > 0 ? now - config.mailAge * 1000LL : 0);
+}
+
+// Marks the first mail of its box as dead
+static void
+mail_drop(Mail *mail) {
+    Mailbox *box = mail->box;
+    box->first = mail->next;
+    mail->box = NULL;
+    deadBytes += mail->size;
+    if (--box->count == 0)
+        box_remove(box);
+}
+
+// Drops the oldest mails of all boxes, the arena is sorted by time
+static void
+mail_dropOldest(long long before, int bytes) {
+    while (front < used) {
+        Mail *mail = mail_at(front);
+        if (mail->box != NULL) {
+            if (mail->time >= before && bytes <= 0)
+                return;
+            bytes -= mail->size;
+            mail_drop(mail);
+        }
+        front += mail->size;
+    }
+}
+
+// Moves the live mails to the beginning of the arena
+static void
+mail_compact(void) {
+    int i;
+    Mailbox *box;
+    for (i = 0; i < MAIL_BUCKETS; ++i) {
+        for (box = boxes[i]; box != NULL; box = box->next) {
+            box->first = -1;
+            box->last = -1;
+        }
+    }
+    int from = 0;
+    int to = 0;
+    while (from < used) {
+        Mail *mail = mail_at(from);
+        int size = mail->size;
+        if (mail->box != NULL) {
+            if (to != from)
+                memmove(arena + to, arena + from, size);
+            mail = mail_at(to);
+            mail->next = -1;
+            // Chains are rebuilt in the order of the arena, the oldest first
+            box = mail->box;
+            if (box->last >= 0)
+                mail_at(box->last)->next = to;
+            else
+                box->first = to;
+            box->last = to;
+            to += size;
+        }
+        from += size;
+    }
+    used = to;
+    deadBytes = 0;
+    front = 0;
+}
+
+int
+mailbox_store(char *receiver, char *sender, char *text) {
+    if (config.mailMemory == 0)
+        return EXIT_FAILURE;
+    if (arena == NULL) {
+        capacity = config.mailMemory - config.mailMemory % MAIL_ALIGN;
+        arena = malloc(capacity);
+        if (arena == NULL) {
+            perror("Insufficent memory!");
+            return EXIT_FAILURE;
+        }
+    }
+    long long now = wallTimeMillis();
+    mail_dropOldest(mail_expiry(now), 0);
+
+    int senderLength = strlen(sender);
+    int textLength = strlen(text);
+    int size = sizeof(Mail) + senderLength + textLength;
+    size = (size + MAIL_ALIGN - 1) / MAIL_ALIGN * MAIL_ALIGN;
+    if (size > capacity)
+        return EXIT_FAILURE;
+    Mailbox *box = box_find(receiver);
+    if (box != NULL && config.mailMax > 0 && box->count >= config.mailMax)
+        return MAILBOX_FULL;
+
+    // Make room at the end of the arena, a compaction frees at least
+    // 1 / MAIL_RESERVE of it, so it isn't repeated for every mail
+    if (capacity - used < size) {
+        int needed = size + capacity / MAIL_RESERVE;
+        if (capacity - used + deadBytes < needed)
+            mail_dropOldest(0, needed - (capacity - used + deadBytes));
+        mail_compact();
+        // The box may have lost its last mail
+        box = box_find(receiver);
+    }
+    if (box == NULL && (box = box_create(receiver)) == NULL)
+        return EXIT_FAILURE;
+
+    Mail *mail = mail_at(used);
+    mail->box = box;
+    mail->time = now;
+    mail->size = size;
+    mail->next = -1;
+    mail->senderLength = senderLength;
+    mail->textLength = textLength;
+    memcpy((char *)(mail + 1), sender, senderLength);
+    memcpy((char *)(mail + 1) + senderLength, text, textLength);
+    if (box->last >= 0)
+        mail_at(box->last)->next = used;
+    else
+        box->first = used;
+    box->last = used;
+    ++box->count;
+    used += size;
+    return EXIT_SUCCESS;
+}
+
+void
+mailbox_deliver(Client *client) {
+    Mailbox *box = (arena == NULL ? NULL : box_find(client->name));
+    if (box == NULL)
+        return;
+    long long expired = mail_expiry(wallTimeMillis());
+    StringBuffer *mails = StringBuffer_construct();
+    int count = 0;
+    // All mails are sent at once, the box is removed with its last one
+    int offset = box->first;
+    while (offset >= 0) {
+        Mail *mail = mail_at(offset);
+        offset = mail->next;
+        if (mail->time >= expired) {
+            char *data = (char *)(mail + 1);
+            StringBuffer_concat(mails, "\n[");
+            StringBuffer_concat_n(mails, data, mail->senderLength);
+            StringBuffer_concat(mails, " -> me]: ");
+            StringBuffer_concat_n(mails, data + mail->senderLength, mail->textLength);
+            ++count;
+        }
+        mail_drop(mail);
+    }
+    if (count > 0) {
+        StringBuffer *msg = StringBuffer_construct();
+        char line[80];
+        snprintf(line, sizeof(line), "INFO: %d Nachrichten kamen, waehrend du nicht online warst:", count);
+        StringBuffer_concat(msg, line);
+        StringBuffer_concat_n(msg, mails->buffer, mails->size);
+        send_message_lane(client->socket, msg, LANE_DIRECT);
+        StringBuffer_free(msg);
+    }
+    StringBuffer_free(mails);
+}
+
+long
+mailbox_memory(void) {
+    return (arena == NULL ? 0 : capacity) + boxCount * (long)sizeof(Mailbox);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include "clientStruct.h"
+
+// Whispers to nicks which aren't online. All mails are stored one after
+// another in a single arena of a fixed size, the mails of a nick are
+// chained through it. When the arena is full, the oldest mails of all
+// mailboxes are dropped first.
+
+// Result of mailbox_store when the nick has too many mails
+#define MAILBOX_FULL 2
+
+int mailbox_store(char *receiver, char *sender, char *text);
+
+void mailbox_deliver(Client *client);
+
+// Bytes of the arena and the mailboxes
+long mailbox_memory(void);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "outbox.h"
+
+// Share of the socket a lane gets, in quanta per round
+static const int weights[OUTBOX_LANES] = {8, 4, 2, 1};
+
+void
+Outbox_init(Outbox *box) {
+    int i;
+    for (i = 0; i < OUTBOX_LANES; ++i) {
+        ChunkChain_init(&(box->lanes[i]));
+        box->deficit[i] = 0;
+    }
+    ChunkChain_init(&(box->partial));
+    box->current = 0;
+    box->size = 0;
+}
+
+int
+Outbox_push(Outbox *box, int lane, char *data, int len) {
+    ChunkChain *chain = &(box->lanes[lane]);
+    int queued = chain->size;
+    if (ChunkChain_append(chain, (char *)&len, sizeof(len)) == EXIT_FAILURE
+        || ChunkChain_append(chain, data, len) == EXIT_FAILURE) {
+        // A length without its message would break the lane
+        box->size -= queued;
+        ChunkChain_clear(chain);
+        return EXIT_FAILURE;
+    }
+    box->size += sizeof(len) + len;
+    return EXIT_SUCCESS;
+}
+
+int
+Outbox_pushPartial(Outbox *box, char *data, int len) {
+    if (ChunkChain_append(&(box->partial), data, len) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    box->size += len;
+    return EXIT_SUCCESS;
+}
+
+int
+Outbox_laneSize(Outbox *box, int lane) {
+    return box->lanes[lane].size;
+}
+
+// Length of the next message in the lane
+static int
+Outbox_head(ChunkChain *chain) {
+    int len;
+    ChunkChain_copy(chain, (char *)&len, sizeof(len));
+    return len;
+}
+
+int
+Outbox_drop(Outbox *box, int lane) {
+    ChunkChain *chain = &(box->lanes[lane]);
+    if (chain->size == 0)
+        return 0;
+    int len = Outbox_head(chain);
+    ChunkChain_consume(chain, sizeof(len) + len);
+    box->size -= sizeof(len) + len;
+    return len;
+}
+
+// Lane of the next message, -1 when the outbox is empty
+static int
+Outbox_next(Outbox *box) {
+    while (box->size > box->partial.size) {
+        int lane = box->current;
+        ChunkChain *chain = &(box->lanes[lane]);
+        if (chain->size > 0) {
+            int len = Outbox_head(chain);
+            if (len <= box->deficit[lane]) {
+                box->deficit[lane] -= len;
+                return lane;
+            }
+        }
+        else {
+            // Empty lanes don't save their share for later
+            box->deficit[lane] = 0;
+        }
+        box->current = (lane + 1) % OUTBOX_LANES;
+        if (box->lanes[box->current].size > 0)
+            box->deficit[box->current] += weights[box->current] * OUTBOX_QUANTUM;
+    }
+    return -1;
+}
+
+int
+Outbox_send(Outbox *box, int socket) {
+    while (true) {
+        // Finish the message the socket started to take
+        if (box->partial.size > 0) {
+            int sent = ChunkChain_send(&(box->partial), socket, box->partial.size);
+            if (sent < 0)
+                return (errno == EAGAIN || errno == EWOULDBLOCK ? OUTBOX_PENDING : OUTBOX_ERROR);
+            box->size -= sent;
+            if (box->partial.size > 0)
+                return OUTBOX_PENDING;
+        }
+        int lane = Outbox_next(box);
+        if (lane < 0)
+            return OUTBOX_EMPTY;
+        ChunkChain *chain = &(box->lanes[lane]);
+        int len = Outbox_head(chain);
+        ChunkChain_consume(chain, sizeof(len));
+        box->size -= sizeof(len);
+        int sent = ChunkChain_send(chain, socket, len);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return OUTBOX_ERROR;
+            sent = 0;
+        }
+        box->size -= sent;
+        len -= sent;
+        // Move the rest, so no other message is put in between
+        while (len > 0) {
+            char buffer[CHUNK_SIZE];
+            int copy = (len < CHUNK_SIZE ? len : CHUNK_SIZE);
+            ChunkChain_copy(chain, buffer, copy);
+            ChunkChain_consume(chain, copy);
+            if (ChunkChain_append(&(box->partial), buffer, copy) == EXIT_FAILURE)
+                return OUTBOX_ERROR;
+            len -= copy;
+        }
+    }
+}
+
+int
+Outbox_copy(Outbox *box, char *dest) {
+    int pos = box->partial.size;
+    ChunkChain_copy(&(box->partial), dest, pos);
+    int i;
+    for (i = 0; i < OUTBOX_LANES; ++i) {
+        ChunkChain *chain = &(box->lanes[i]);
+        // The lane is copied with its lengths, the messages are moved over them
+        char *lane = dest + pos;
+        ChunkChain_copy(chain, lane, chain->size);
+        int read = 0;
+        while (read < chain->size) {
+            int len;
+            memcpy(&len, lane + read, sizeof(len));
+            read += sizeof(len);
+            memmove(dest + pos, lane + read, len);
+            read += len;
+            pos += len;
+        }
+    }
+    return pos;
+}
+
+void
+Outbox_clear(Outbox *box) {
+    int i;
+    for (i = 0; i < OUTBOX_LANES; ++i) {
+        ChunkChain_clear(&(box->lanes[i]));
+        box->deficit[i] = 0;
+    }
+    ChunkChain_clear(&(box->partial));
+    box->size = 0;
+}
+
+void
+Outbox_account(Outbox *box, long *account) {
+    int i;
+    for (i = 0; i < OUTBOX_LANES; ++i) {
+        ChunkChain_account(&(box->lanes[i]), account);
+    }
+    ChunkChain_account(&(box->partial), account);
+}
+
+long
+Outbox_memory(Outbox *box) {
+    long memory = ChunkChain_memory(&(box->partial));
+    int i;
+    for (i = 0; i < OUTBOX_LANES; ++i) {
+        memory += ChunkChain_memory(&(box->lanes[i]));
+    }
+    return memory;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include "bufferPool.h"
+
+// Priority classes of the messages to a client
+#define LANE_CONTROL    0
+#define LANE_DIRECT     1
+#define LANE_BROADCAST  2
+#define LANE_BULK       3
+#define OUTBOX_LANES    4
+
+// Bytes a lane may send per round and weight
+#define OUTBOX_QUANTUM  1024
+
+// Results of Outbox_send
+#define OUTBOX_EMPTY    0
+#define OUTBOX_PENDING  1
+#define OUTBOX_ERROR    -1
+
+// Messages waiting for a full socket, sent by deficit round robin
+typedef struct Outbox {
+    // Every message is stored as its length followed by the data
+    ChunkChain lanes[OUTBOX_LANES];
+    // Bytes a lane may still send in this round
+    int deficit[OUTBOX_LANES];
+    // Lane visited by the scheduler
+    int current;
+    // Rest of a message the socket took only partly, sent before any other
+    ChunkChain partial;
+    // Bytes in all lanes and the partial message
+    int size;
+} Outbox;
+
+void
+Outbox_init(Outbox *box);
+
+int
+Outbox_push(Outbox *box, int lane, char *data, int len);
+
+int
+Outbox_pushPartial(Outbox *box, char *data, int len);
+
+int
+Outbox_laneSize(Outbox *box, int lane);
+
+int
+Outbox_drop(Outbox *box, int lane);
+
+int
+Outbox_send(Outbox *box, int socket);
+
+// Copies the messages without their lengths to dest, which holds box->size bytes
+int
+Outbox_copy(Outbox *box, char *dest);
+
+void
+Outbox_clear(Outbox *box);
+
+void
+Outbox_account(Outbox *box, long *account);
+
+long
+Outbox_memory(Outbox *box);
+
+#endif
@@ -0,0 +1,834 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+
+// Entries of the rings
+#define INBOUND_CAPACITY  (1 << 16)
+#define OUTBOUND_CAPACITY (1 << 16)
+
+// Bytes read from a socket per event
+#define IO_READ_SIZE 16384
+#define IO_READS_PER_EVENT 4
+
+// Buffers written at once
+#define IO_BATCH 64
+
+// Clients not reading this many bytes of output are disconnected
+#define IO_OUTPUT_LIMIT (8 * 1024 * 1024)
+
+#define IO_EVENTS 256
+
+// Milliseconds between the tries to pass input to a full inbound ring
+#define IO_RETRY_INTERVAL 1
+
+// Entries waiting for room in a full ring, only used by the pushing thread
+typedef struct Backlog {
+    RingEntry *entries;
+    int head;
+    int size;
+    int capacity;
+} Backlog;
+
+// Output waiting for a writable socket
+typedef struct OutItem {
+    struct OutItem *next;
+    Payload *payload;
+    int offset;
+} OutItem;
+
+// State of a client socket, only used by its I/O thread
+typedef struct IoSocket {
+    long clientId;
+    // Incomplete line of the last read
+    char *partial;
+    int partialSize;
+    int partialCapacity;
+    OutItem *outHead;
+    OutItem *outTail;
+    long outBytes;
+    // Input ended, waiting for the close of the dispatcher
+    bool closed;
+    // Waiting for EPOLLOUT
+    bool writing;
+    // Not read until the inbound ring has room again
+    bool stalled;
+    // Not read until the dispatcher continues it
+    bool paused;
+    // Bytes of the current line, counted up to the limit
+    int lineLength;
+    // Events registered at epoll, 0 when the socket isn't watched
+    int events;
+    // Gets the broadcasts with sequence numbers
+    bool numbered;
+    // Position in the open sockets of the thread
+    int openIndex;
+} IoSocket;
+
+typedef struct IoThread {
+    pthread_t thread;
+    int epollFd;
+    // Signals new entries in the outbound ring
+    int wakeFd;
+    SpscRing outbound;
+    // Dispatcher pushed entries since the last wake up
+    bool pending;
+    // Sockets indexed by their file descriptor
+    IoSocket **sockets;
+    int socketsSize;
+    // File descriptors of all sockets, the receivers of broadcasts
+    int *open;
+    int openCount;
+    int openCapacity;
+    // Pushed entries to the dispatcher in the current batch
+    bool pushed;
+    // Input waiting for a full inbound ring, sockets aren't read meanwhile
+    Backlog backlog;
+    bool stalling;
+    // Output of the dispatcher waiting for a full outbound ring
+    Backlog waiting;
+} IoThread;
+
+static IoThread *threads;
+static int threadCount;
+
+// Longest line handed over completely
+static int lineLimit;
+
+static MpscRing inbound;
+// Signals new entries in the inbound ring
+static int dispatcherFd = -1;
+
+// Bytes of the payloads not released yet and of the queued items,
+// changed by every thread
+static long outputMemory;
+
+// *******************************************
+// Payloads
+// *******************************************
+
+Payload
+*Payload_construct(char *data, int len) {
+    Payload *payload = malloc(sizeof(Payload) + len);
+    if (payload == NULL) {
+        perror("Insufficent memory!");
+        return NULL;
+    }
+    payload->references = 1;
+    payload->len = len;
+    memcpy(payload->data, data, len);
+    __atomic_add_fetch(&outputMemory, sizeof(Payload) + len, __ATOMIC_RELAXED);
+    return payload;
+}
+
+void
+Payload_release(Payload *payload) {
+    if (__atomic_sub_fetch(&(payload->references), 1, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_sub_fetch(&outputMemory, sizeof(Payload) + payload->len, __ATOMIC_RELAXED);
+        free(payload);
+    }
+}
+
+// *******************************************
+// Backlogs
+// *******************************************
+
+static bool
+backlog_add(Backlog *backlog, RingEntry *entry) {
+    if (backlog->size == backlog->capacity) {
+        // Reuse the room of the entries already passed on
+        if (backlog->head > 0) {
+            memmove(backlog->entries, backlog->entries + backlog->head, sizeof(RingEntry) * (backlog->size - backlog->head));
+            backlog->size -= backlog->head;
+            backlog->head = 0;
+        }
+        else {
+            int capacity = (backlog->capacity == 0 ? 64 : backlog->capacity << 1);
+            RingEntry *entries = realloc(backlog->entries, sizeof(RingEntry) * capacity);
+            if (entries == NULL) {
+                perror("Insufficent memory!");
+                return false;
+            }
+            backlog->entries = entries;
+            backlog->capacity = capacity;
+        }
+    }
+    backlog->entries[backlog->size++] = *entry;
+    return true;
+}
+
+static bool
+backlog_isEmpty(Backlog *backlog) {
+    return backlog->head == backlog->size;
+}
+
+// *******************************************
+// I/O threads
+// *******************************************
+
+static void
+wake(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+        perror("Can't wake up a thread!");
+}
+
+// Waiting for the dispatcher would deadlock when it waits for this thread,
+// so a full ring only stops the reading of the sockets
+static void
+io_push(IoThread *t, RingEntry *entry) {
+    t->pushed = true;
+    // Earlier entries are waiting, keep the order
+    if (backlog_isEmpty(&(t->backlog)) && MpscRing_push(&inbound, entry))
+        return;
+    if (!backlog_add(&(t->backlog), entry))
+        free(entry->data);
+}
+
+// Moves the waiting input to the inbound ring, true when nothing is left
+static bool
+io_retry(IoThread *t) {
+    Backlog *backlog = &(t->backlog);
+    while (!backlog_isEmpty(backlog) && MpscRing_push(&inbound, &(backlog->entries[backlog->head]))) {
+        ++backlog->head;
+        t->pushed = true;
+    }
+    if (!backlog_isEmpty(backlog))
+        return false;
+    backlog->head = 0;
+    backlog->size = 0;
+    return true;
+}
+
+// Registers the events the socket waits for at epoll
+static void
+io_watch(IoThread *t, int fd) {
+    IoSocket *s = t->sockets[fd];
+    if (s->closed)
+        return;
+    int events = (s->stalled || s->paused ? 0 : EPOLLIN) | (s->writing ? EPOLLOUT : 0);
+    if (events == s->events)
+        return;
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    int op = (s->events == 0 ? EPOLL_CTL_ADD : (events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD));
+    if (epoll_ctl(t->epollFd, op, fd, &event) == 0)
+        s->events = events;
+}
+
+// The socket isn't read until the inbound ring has room again
+static void
+io_stall(IoThread *t, int fd) {
+    IoSocket *s = t->sockets[fd];
+    if (s->stalled)
+        return;
+    s->stalled = true;
+    t->stalling = true;
+    io_watch(t, fd);
+}
+
+static void
+io_resume(IoThread *t) {
+    t->stalling = false;
+    int i;
+    for (i = 0; i < t->openCount; ++i) {
+        IoSocket *s = t->sockets[t->open[i]];
+        if (s->stalled) {
+            s->stalled = false;
+            io_watch(t, t->open[i]);
+        }
+    }
+}
+
+static void
+io_release(OutItem *item) {
+    Payload_release(item->payload);
+    free(item);
+    __atomic_sub_fetch(&outputMemory, sizeof(OutItem), __ATOMIC_RELAXED);
+}
+
+static void
+io_destroy(IoThread *t, int fd) {
+    IoSocket *s = t->sockets[fd];
+    while (s->outHead != NULL) {
+        OutItem *item = s->outHead;
+        s->outHead = item->next;
+        io_release(item);
+    }
+    if (!s->closed && s->events != 0)
+        epoll_ctl(t->epollFd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    // The last socket takes the place
+    t->open[s->openIndex] = t->open[--t->openCount];
+    t->sockets[t->open[s->openIndex]]->openIndex = s->openIndex;
+    free(s->partial);
+    free(s);
+    t->sockets[fd] = NULL;
+}
+
+// Tells the dispatcher about the end of the connection
+static void
+io_closed(IoThread *t, int fd) {
+    IoSocket *s = t->sockets[fd];
+    if (s->closed)
+        return;
+    s->closed = true;
+    if (s->events != 0)
+        epoll_ctl(t->epollFd, EPOLL_CTL_DEL, fd, NULL);
+    RingEntry entry;
+    entry.type = RING_CLOSED;
+    entry.socket = fd;
+    entry.clientId = s->clientId;
+    entry.data = NULL;
+    entry.len = 0;
+    io_push(t, &entry);
+}
+
+static void
+io_flush(IoThread *t, int fd) {
+    IoSocket *s = t->sockets[fd];
+    while (s->outHead != NULL && !s->closed) {
+        struct iovec iov[IO_BATCH];
+        int count = 0;
+        OutItem *item;
+        for (item = s->outHead; item != NULL && count < IO_BATCH; item = item->next) {
+            iov[count].iov_base = item->payload->data + item->offset;
+            iov[count].iov_len = item->payload->len - item->offset;
+            ++count;
+        }
+        // A closed peer mustn't raise SIGPIPE in the whole process
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+        ssize_t written = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            io_closed(t, fd);
+            return;
+        }
+        s->outBytes -= written;
+        // Remove the written buffers
+        while (written > 0) {
+            item = s->outHead;
+            int rest = item->payload->len - item->offset;
+            if (written < rest) {
+                item->offset += written;
+                break;
+            }
+            written -= rest;
+            s->outHead = item->next;
+            io_release(item);
+        }
+        if (s->outHead == NULL)
+            s->outTail = NULL;
+    }
+    // Wait for the socket only while output is left
+    bool writing = (s->outHead != NULL && !s->closed);
+    if (writing != s->writing && !s->closed) {
+        s->writing = writing;
+        io_watch(t, fd);
+    }
+}
+
+// Removes the bytes of the new input which are behind the limit of their
+// line. The dispatcher still sees the beginning of a long line and its
+// delimiter, but the rest doesn't pass the ring.
+static void
+io_cut(IoSocket *s, int start) {
+    int write = start;
+    int pos = start;
+    while (pos < s->partialSize) {
+        char *end = memchr(s->partial + pos, '\n', s->partialSize - pos);
+        int len = (end == NULL ? s->partialSize : end - s->partial) - pos;
+        int keep = lineLimit + 1 - s->lineLength;
+        if (keep > len)
+            keep = len;
+        if (keep > 0) {
+            memmove(s->partial + write, s->partial + pos, keep);
+            write += keep;
+            s->lineLength += keep;
+        }
+        pos += len;
+        if (end != NULL) {
+            s->partial[write++] = '\n';
+            s->lineLength = 0;
+            ++pos;
+        }
+    }
+    s->partialSize = write;
+}
+
+// Hands the complete lines to the dispatcher, the rest stays here
+static void
+io_pass(IoThread *t, int fd) {
+    IoSocket *s = t->sockets[fd];
+    char *end = memrchr(s->partial, '\n', s->partialSize);
+    // Endless lines are handed over too, the dispatcher limits their size
+    if (end == NULL && s->partialSize < IO_READ_SIZE && (lineLimit == 0 || s->partialSize <= lineLimit))
+        return;
+    int len = (end == NULL ? s->partialSize : end - s->partial + 1);
+    RingEntry entry;
+    entry.type = RING_DATA;
+    entry.socket = fd;
+    entry.clientId = s->clientId;
+    entry.data = malloc(len);
+    entry.len = len;
+    if (entry.data == NULL) {
+        perror("Insufficent memory!");
+        return;
+    }
+    memcpy(entry.data, s->partial, len);
+    memmove(s->partial, s->partial + len, s->partialSize - len);
+    s->partialSize -= len;
+    io_push(t, &entry);
+}
+
+static void
+io_read(IoThread *t, int fd) {
+    IoSocket *s = t->sockets[fd];
+    int start = s->partialSize;
+    bool hungUp = false;
+    int reads;
+    for (reads = 0; reads < IO_READS_PER_EVENT; ++reads) {
+        if (s->partialCapacity - s->partialSize < IO_READ_SIZE) {
+            int capacity = s->partialCapacity * 2;
+            if (capacity < s->partialSize + IO_READ_SIZE)
+                capacity = s->partialSize + IO_READ_SIZE;
+            char *partial = realloc(s->partial, capacity);
+            if (partial == NULL) {
+                perror("Insufficent memory!");
+                io_closed(t, fd);
+                return;
+            }
+            s->partial = partial;
+            s->partialCapacity = capacity;
+        }
+        ssize_t bytes_read = read(fd, s->partial + s->partialSize, IO_READ_SIZE);
+        if (bytes_read == 0) {
+            hungUp = true;
+            break;
+        }
+        if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                hungUp = true;
+            break;
+        }
+        s->partialSize += bytes_read;
+        if (bytes_read < IO_READ_SIZE)
+            break;
+    }
+    if (lineLimit > 0)
+        io_cut(s, start);
+    io_pass(t, fd);
+    // The lines read before the end arrive ahead of the close, like in
+    // the server loop
+    if (hungUp)
+        io_closed(t, fd);
+}
+
+static void
+io_open(IoThread *t, RingEntry *entry) {
+    int fd = entry->socket;
+    if (fd >= t->socketsSize) {
+        int size = (t->socketsSize == 0 ? 64 : t->socketsSize);
+        while (size <= fd)
+            size = size << 1;
+        IoSocket **sockets = realloc(t->sockets, sizeof(IoSocket *) * size);
+        if (sockets == NULL) {
+            perror("Insufficent memory!");
+            return;
+        }
+        memset(sockets + t->socketsSize, 0, sizeof(IoSocket *) * (size - t->socketsSize));
+        t->sockets = sockets;
+        t->socketsSize = size;
+    }
+    if (t->openCount == t->openCapacity) {
+        int capacity = (t->openCapacity == 0 ? 64 : t->openCapacity << 1);
+        int *open = realloc(t->open, sizeof(int) * capacity);
+        if (open == NULL) {
+            perror("Insufficent memory!");
+            return;
+        }
+        t->open = open;
+        t->openCapacity = capacity;
+    }
+    IoSocket *s = calloc(1, sizeof(IoSocket));
+    if (s == NULL) {
+        perror("Insufficent memory!");
+        return;
+    }
+    s->clientId = entry->clientId;
+    s->openIndex = t->openCount;
+    t->open[t->openCount++] = fd;
+    t->sockets[fd] = s;
+    // Input waits for a full ring, the new socket waits too
+    if (!backlog_isEmpty(&(t->backlog))) {
+        s->stalled = true;
+        t->stalling = true;
+    }
+    io_watch(t, fd);
+    if (s->events == 0 && !s->stalled) {
+        perror("Can't watch client!");
+        io_closed(t, fd);
+    }
+}
+
+// Queues the payload for the socket, takes a reference of it
+static void
+io_enqueue(IoThread *t, int fd, Payload *payload) {
+    IoSocket *s = t->sockets[fd];
+    OutItem *item = malloc(sizeof(OutItem));
+    if (item == NULL || s->closed) {
+        free(item);
+        Payload_release(payload);
+        return;
+    }
+    __atomic_add_fetch(&outputMemory, sizeof(OutItem), __ATOMIC_RELAXED);
+    item->next = NULL;
+    item->payload = payload;
+    item->offset = 0;
+    if (s->outTail == NULL)
+        s->outHead = item;
+    else
+        s->outTail->next = item;
+    s->outTail = item;
+    s->outBytes += payload->len;
+    // Slow client, drop it
+    if (s->outBytes > IO_OUTPUT_LIMIT) {
+        io_closed(t, fd);
+        return;
+    }
+    if (!s->writing)
+        io_flush(t, fd);
+}
+
+// Sends the payload to all sockets of the thread, the sockets only leave
+// the list when they are destroyed by a later entry
+static void
+io_broadcast(IoThread *t, Payload *payload, bool numbered) {
+    // One reference per socket, the one of the entry is given back below
+    __atomic_add_fetch(&(payload->references), t->openCount, __ATOMIC_RELAXED);
+    int i;
+    for (i = 0; i < t->openCount; ++i) {
+        int fd = t->open[i];
+        IoSocket *s = t->sockets[fd];
+        if (s->closed || s->numbered != numbered) {
+            Payload_release(payload);
+            continue;
+        }
+        io_enqueue(t, fd, payload);
+    }
+    Payload_release(payload);
+}
+
+// Handles the entries of the dispatcher
+static void
+io_control(IoThread *t) {
+    uint64_t count;
+    if (read(t->wakeFd, &count, sizeof(count)) < 0) {
+        // Woken up by an earlier batch
+    }
+    RingEntry entry;
+    while (SpscRing_pop(&(t->outbound), &entry)) {
+        if (entry.type == RING_BROADCAST || entry.type == RING_NUMBERED) {
+            io_broadcast(t, entry.data, entry.type == RING_NUMBERED);
+            continue;
+        }
+        IoSocket *s = (entry.socket < t->socketsSize ? t->sockets[entry.socket] : NULL);
+        if (entry.type == RING_OPEN) {
+            io_open(t, &entry);
+            continue;
+        }
+        // Entry of an older client of the socket
+        if (s == NULL || s->clientId != entry.clientId) {
+            if (entry.type == RING_SEND)
+                Payload_release(entry.data);
+            continue;
+        }
+        if (entry.type == RING_SEND) {
+            io_enqueue(t, entry.socket, entry.data);
+        }
+        else if (entry.type == RING_NUMBER) {
+            s->numbered = true;
+        }
+        else if (entry.type == RING_PAUSE || entry.type == RING_RESUME) {
+            s->paused = (entry.type == RING_PAUSE);
+            io_watch(t, entry.socket);
+        }
+        else if (entry.type == RING_CLOSE) {
+            // Last messages like error notices are written if possible
+            io_flush(t, entry.socket);
+            io_destroy(t, entry.socket);
+        }
+    }
+}
+
+static void
+*io_run(void *data) {
+    IoThread *t = data;
+    struct epoll_event events[IO_EVENTS];
+    while (true) {
+        // Look for room in the inbound ring while input is waiting
+        bool full = !io_retry(t);
+        if (!full && t->stalling)
+            io_resume(t);
+        int res = epoll_wait(t->epollFd, events, IO_EVENTS, full ? IO_RETRY_INTERVAL : -1);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed!");
+            break;
+        }
+        int i;
+        for (i = 0; i < res; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == t->wakeFd) {
+                io_control(t);
+                continue;
+            }
+            if (fd >= t->socketsSize || t->sockets[fd] == NULL)
+                continue;
+            if ((events[i].events & EPOLLOUT) != 0)
+                io_flush(t, fd);
+            if (t->sockets[fd] == NULL || (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) == 0)
+                continue;
+            // Paused by an earlier entry of this batch
+            if (t->sockets[fd]->paused)
+                continue;
+            if (backlog_isEmpty(&(t->backlog)))
+                io_read(t, fd);
+            else
+                io_stall(t, fd);
+        }
+        // One wake up for the whole batch
+        if (t->pushed) {
+            t->pushed = false;
+            wake(dispatcherFd);
+        }
+    }
+    return NULL;
+}
+
+// *******************************************
+// Dispatcher
+// *******************************************
+
+long
+Pipeline_memory(void) {
+    return __atomic_load_n(&outputMemory, __ATOMIC_RELAXED);
+}
+
+int
+Pipeline_init(int count, int maxLine) {
+    lineLimit = maxLine;
+    dispatcherFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (dispatcherFd < 0 || MpscRing_init(&inbound, INBOUND_CAPACITY) == EXIT_FAILURE) {
+        perror("Can't create the pipeline!");
+        return -1;
+    }
+    threads = calloc(count, sizeof(IoThread));
+    if (threads == NULL) {
+        perror("Insufficent memory!");
+        return -1;
+    }
+    threadCount = count;
+    int i;
+    for (i = 0; i < count; ++i) {
+        IoThread *t = &threads[i];
+        t->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        t->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (t->epollFd < 0 || t->wakeFd < 0 || SpscRing_init(&(t->outbound), OUTBOUND_CAPACITY) == EXIT_FAILURE) {
+            perror("Can't create I/O thread!");
+            return -1;
+        }
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = t->wakeFd;
+        epoll_ctl(t->epollFd, EPOLL_CTL_ADD, t->wakeFd, &event);
+        if (pthread_create(&(t->thread), NULL, &io_run, t) != 0) {
+            perror("Can't start I/O thread!");
+            return -1;
+        }
+        pthread_detach(t->thread);
+    }
+    return dispatcherFd;
+}
+
+// A full ring mustn't block the dispatcher, which empties the inbound ring
+// the I/O thread may wait for. Pipeline_flush passes the entries on later.
+static void
+Pipeline_pushTo(IoThread *t, RingEntry *entry) {
+    // Earlier entries are waiting, keep the order
+    if (backlog_isEmpty(&(t->waiting)) && SpscRing_push(&(t->outbound), entry)) {
+        t->pending = true;
+        return;
+    }
+    if (!backlog_add(&(t->waiting), entry) && (entry->type == RING_SEND || entry->type == RING_BROADCAST || entry->type == RING_NUMBERED))
+        Payload_release(entry->data);
+}
+
+static void
+Pipeline_push(RingEntry *entry) {
+    Pipeline_pushTo(&threads[entry->socket % threadCount], entry);
+}
+
+void
+Pipeline_open(int socket, long clientId) {
+    RingEntry entry;
+    entry.type = RING_OPEN;
+    entry.socket = socket;
+    entry.clientId = clientId;
+    entry.data = NULL;
+    entry.len = 0;
+    Pipeline_push(&entry);
+}
+
+void
+Pipeline_send(int socket, long clientId, Payload *payload) {
+    __atomic_add_fetch(&(payload->references), 1, __ATOMIC_RELAXED);
+    RingEntry entry;
+    entry.type = RING_SEND;
+    entry.socket = socket;
+    entry.clientId = clientId;
+    entry.data = payload;
+    entry.len = payload->len;
+    Pipeline_push(&entry);
+}
+
+void
+Pipeline_close(int socket, long clientId) {
+    RingEntry entry;
+    entry.type = RING_CLOSE;
+    entry.socket = socket;
+    entry.clientId = clientId;
+    entry.data = NULL;
+    entry.len = 0;
+    Pipeline_push(&entry);
+}
+
+// Each I/O thread sends the payload to its sockets, so the dispatcher
+// pushes one entry per thread instead of one per client. The entries pass
+// the same rings as the other output, so no client gets them out of order.
+void
+Pipeline_broadcast(Payload *payload, bool numbered) {
+    __atomic_add_fetch(&(payload->references), threadCount, __ATOMIC_RELAXED);
+    RingEntry entry;
+    entry.type = (numbered ? RING_NUMBERED : RING_BROADCAST);
+    entry.socket = -1;
+    entry.clientId = 0;
+    entry.data = payload;
+    entry.len = payload->len;
+    int i;
+    for (i = 0; i < threadCount; ++i) {
+        Pipeline_pushTo(&threads[i], &entry);
+    }
+}
+
+void
+Pipeline_number(int socket, long clientId) {
+    RingEntry entry;
+    entry.type = RING_NUMBER;
+    entry.socket = socket;
+    entry.clientId = clientId;
+    entry.data = NULL;
+    entry.len = 0;
+    Pipeline_push(&entry);
+}
+
+void
+Pipeline_pause(int socket, long clientId) {
+    RingEntry entry;
+    entry.type = RING_PAUSE;
+    entry.socket = socket;
+    entry.clientId = clientId;
+    entry.data = NULL;
+    entry.len = 0;
+    Pipeline_push(&entry);
+}
+
+void
+Pipeline_resume(int socket, long clientId) {
+    RingEntry entry;
+    entry.type = RING_RESUME;
+    entry.socket = socket;
+    entry.clientId = clientId;
+    entry.data = NULL;
+    entry.len = 0;
+    Pipeline_push(&entry);
+}
+
+bool
+Pipeline_flush(void) {
+    bool full = false;
+    int i;
+    for (i = 0; i < threadCount; ++i) {
+        IoThread *t = &threads[i];
+        Backlog *backlog = &(t->waiting);
+        while (!backlog_isEmpty(backlog) && SpscRing_push(&(t->outbound), &(backlog->entries[backlog->head]))) {
+            ++backlog->head;
+            t->pending = true;
+        }
+        if (backlog_isEmpty(backlog)) {
+            backlog->head = 0;
+            backlog->size = 0;
+        }
+        else {
+            full = true;
+        }
+        if (t->pending) {
+            t->pending = false;
+            wake(t->wakeFd);
+        }
+    }
+    return full;
+}
+
+void
+Pipeline_acknowledge(void) {
+    uint64_t count;
+    if (read(dispatcherFd, &count, sizeof(count)) < 0) {
+        // Entries were taken with an earlier wake up
+    }
+}
+
+bool
+Pipeline_receive(RingEntry *entry) {
+    return MpscRing_pop(&inbound, entry);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include "ring.h"
+
+// Optional staged mode of the server: I/O threads read and frame the input
+// of the clients and write their output, the server loop is the single
+// dispatcher handling the messages. Complete lines travel over a lock-free
+// MPSC ring to the dispatcher, output and control entries over one SPSC
+// ring per I/O thread. Both sides wake the other side once per batch.
+
+// Data sent to one or many clients, freed by the last I/O thread writing it
+typedef struct Payload {
+    int references;
+    int len;
+    char data[];
+} Payload;
+
+Payload
+*Payload_construct(char *data, int len);
+
+void
+Payload_release(Payload *payload);
+
+// Lines above maxLine bytes are cut behind the first maxLine + 1 bytes,
+// 0 hands over the lines as they are
+int
+Pipeline_init(int threads, int maxLine);
+
+// Bytes of the payloads and of the output queues of the I/O threads
+long
+Pipeline_memory(void);
+
+void
+Pipeline_open(int socket, long clientId);
+
+void
+Pipeline_send(int socket, long clientId, Payload *payload);
+
+void
+Pipeline_close(int socket, long clientId);
+
+void
+Pipeline_broadcast(Payload *payload, bool numbered);
+
+void
+Pipeline_number(int socket, long clientId);
+
+void
+Pipeline_pause(int socket, long clientId);
+
+void
+Pipeline_resume(int socket, long clientId);
+
+// Wakes the I/O threads, true when output still waits for a full ring
+bool
+Pipeline_flush(void);
+
+void
+Pipeline_acknowledge(void);
+
+bool
+Pipeline_receive(RingEntry *entry);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "presence.h"
+#include "server.h"
+#include "config.h"
+
+// Names shown in a notice, the other clients are only counted
+#define MAX_PRESENCE_NAMES 16
+
+typedef struct PresenceEvents {
+    char *names[MAX_PRESENCE_NAMES];
+    // All clients of the event, including the ones without stored name
+    int count;
+} PresenceEvents;
+
+static PresenceEvents joined;
+static PresenceEvents left;
+static bool flushScheduled;
+
+static void
+add_event(PresenceEvents *events, char *name) {
+    if (events->count < config.presenceNames && events->count < MAX_PRESENCE_NAMES) {
+        events->names[events->count] = strdup(name);
+    }
+    ++events->count;
+    if (flushScheduled)
+        return;
+    if (config.presenceWindow == 0) {
+        presence_flush(NULL);
+    }
+    else if (defer_task(config.presenceWindow, &presence_flush, NULL) == EXIT_SUCCESS) {
+        flushScheduled = true;
+    }
+}
+
+void
+presence_joined(char *name) {
+    add_event(&joined, name);
+}
+
+void
+presence_left(char *name) {
+    add_event(&left, name);
+}
+
+// Notice like "A, B und 37 weitere sind online"
+static void
+send_events(PresenceEvents *events, char *state, bool suppressed) {
+    if (events->count == 0)
+        return;
+    int names = (events->count < config.presenceNames ? events->count : config.presenceNames);
+    if (names > MAX_PRESENCE_NAMES)
+        names = MAX_PRESENCE_NAMES;
+
+    if (!suppressed) {
+        StringBuffer *msg = StringBuffer_construct();
+        int others = events->count - names;
+        int i;
+        for (i = 0; i < names; ++i) {
+            // The last name is joined by "und" when no others follow
+            if (i > 0)
+                StringBuffer_concat(msg, (i == names - 1 && others == 0 ? " und " : ", "));
+            StringBuffer_concat(msg, events->names[i]);
+        }
+        if (others > 0) {
+            char temp[32];
+            sprintf(temp, "%s%d weitere", (names > 0 ? " und " : ""), others);
+            StringBuffer_concat(msg, temp);
+        }
+        StringBuffer_concat(msg, (events->count == 1 ? " ist " : " sind "));
+        StringBuffer_concat(msg, state);
+        broadcast(msg);
+        StringBuffer_free(msg);
+    }
+
+    int i;
+    for (i = 0; i < names; ++i) {
+        free(events->names[i]);
+    }
+    events->count = 0;
+}
+
+void
+presence_flush(void *data) {
+    (void)data;
+    flushScheduled = false;
+    // Large rooms don't get presence notices at all
+    bool suppressed = config.presenceMaxRoom > 0 && client_count() > config.presenceMaxRoom;
+    send_events(&joined, "online", suppressed);
+    send_events(&left, "offline", suppressed);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ring.h"
+
+int
+MpscRing_init(MpscRing *ring, unsigned long capacity) {
+    ring->slots = malloc(sizeof(MpscSlot) * capacity);
+    if (ring->slots == NULL) {
+        perror("Insufficent memory!");
+        return EXIT_FAILURE;
+    }
+    // The sequence of a slot is the position a producer may write it at
+    unsigned long i;
+    for (i = 0; i < capacity; ++i) {
+        ring->slots[i].sequence = i;
+    }
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    return EXIT_SUCCESS;
+}
+
+bool
+MpscRing_push(MpscRing *ring, RingEntry *entry) {
+    unsigned long pos = __atomic_load_n(&(ring->head), __ATOMIC_RELAXED);
+    MpscSlot *slot;
+    while (true) {
+        slot = &(ring->slots[pos & ring->mask]);
+        unsigned long sequence = __atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE);
+        long diff = (long)sequence - (long)pos;
+        // Slot is free, try to claim the position
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&(ring->head), &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        // Consumer hasn't read the slot of the last round
+        else if (diff < 0) {
+            return false;
+        }
+        // Another producer claimed it
+        else {
+            pos = __atomic_load_n(&(ring->head), __ATOMIC_RELAXED);
+        }
+    }
+    slot->entry = *entry;
+    // Publish the entry to the consumer
+    __atomic_store_n(&(slot->sequence), pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool
+MpscRing_pop(MpscRing *ring, RingEntry *entry) {
+    MpscSlot *slot = &(ring->slots[ring->tail & ring->mask]);
+    unsigned long sequence = __atomic_load_n(&(slot->sequence), __ATOMIC_ACQUIRE);
+    if (sequence != ring->tail + 1)
+        return false;
+    *entry = slot->entry;
+    // Free the slot for the next round of the producers
+    __atomic_store_n(&(slot->sequence), ring->tail + ring->mask + 1, __ATOMIC_RELEASE);
+    ring->tail++;
+    return true;
+}
+
+int
+SpscRing_init(SpscRing *ring, unsigned long capacity) {
+    ring->entries = malloc(sizeof(RingEntry) * capacity);
+    if (ring->entries == NULL) {
+        perror("Insufficent memory!");
+        return EXIT_FAILURE;
+    }
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    return EXIT_SUCCESS;
+}
+
+bool
+SpscRing_push(SpscRing *ring, RingEntry *entry) {
+    unsigned long tail = ring->tail;
+    if (tail - __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE) > ring->mask)
+        return false;
+    ring->entries[tail & ring->mask] = *entry;
+    __atomic_store_n(&(ring->tail), tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool
+SpscRing_pop(SpscRing *ring, RingEntry *entry) {
+    unsigned long head = ring->head;
+    if (head == __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE))
+        return false;
+    *entry = ring->entries[head & ring->mask];
+    __atomic_store_n(&(ring->head), head + 1, __ATOMIC_RELEASE);
+    return true;
+}
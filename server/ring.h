@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+
+// Bounded lock-free queues between the threads of the pipeline.
+// The capacity must be a power of two.
+
+// Kinds of entries
+#define RING_OPEN   0
+#define RING_DATA   1
+#define RING_SEND   2
+#define RING_CLOSE  3
+#define RING_CLOSED 4
+// Data for all sockets of an I/O thread, without and with sequence numbers
+#define RING_BROADCAST 5
+#define RING_NUMBERED  6
+// The socket gets the broadcasts with sequence numbers from now on
+#define RING_NUMBER    7
+// The socket stops and continues reading
+#define RING_PAUSE     8
+#define RING_RESUME    9
+
+typedef struct RingEntry {
+    int type;
+    int socket;
+    long clientId;
+    void *data;
+    int len;
+} RingEntry;
+
+// Many producers, one consumer
+typedef struct MpscSlot {
+    unsigned long sequence;
+    RingEntry entry;
+} MpscSlot;
+
+typedef struct MpscRing {
+    MpscSlot *slots;
+    unsigned long mask;
+    // Producers and the consumer write to their own cache line
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+} MpscRing;
+
+// One producer, one consumer
+typedef struct SpscRing {
+    RingEntry *entries;
+    unsigned long mask;
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+} SpscRing;
+
+int
+MpscRing_init(MpscRing *ring, unsigned long capacity);
+
+bool
+MpscRing_push(MpscRing *ring, RingEntry *entry);
+
+bool
+MpscRing_pop(MpscRing *ring, RingEntry *entry);
+
+int
+SpscRing_init(SpscRing *ring, unsigned long capacity);
+
+bool
+SpscRing_push(SpscRing *ring, RingEntry *entry);
+
+bool
+SpscRing_pop(SpscRing *ring, RingEntry *entry);
+
+#endif
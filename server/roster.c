@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "roster.h"
+#include "server.h"
+#include "config.h"
+#include "federation.h"
+#include "../common/datatype/GenericVector.h"
+
+DefVector(Client *, subscriber);
+// Clients receiving the changes of the roster
+static subscriberVector *subscriberList;
+
+static long version;
+
+// Names at the last change, shared with the workers
+static RosterSnapshot *current;
+
+// All lines of a snapshot for subscribers
+static StringBuffer *snapshotCache;
+static bool snapshotValid;
+
+// Clients of this server and of the other servers of the network
+static int
+roster_count(void) {
+    return client_count() + federation_userCount();
+}
+
+static char
+*roster_name(int index) {
+    if (index < client_count())
+        return client_at(index)->name;
+    return federation_userName(index - client_count());
+}
+
+long
+roster_version(void) {
+    return version;
+}
+
+// Send a change to every subscriber
+static void
+roster_publish(char *change, char *name, char *newName) {
+    ++version;
+    snapshotValid = false;
+    if (current != NULL) {
+        roster_release(current);
+        current = NULL;
+    }
+    if (subscriberList == NULL || subscriberList->size == 0)
+        return;
+
+    char temp[48];
+    sprintf(temp, "/roster %ld %s ", version, change);
+    StringBuffer *msg = StringBuffer_construct();
+    StringBuffer_concat(msg, temp);
+    StringBuffer_concat(msg, name);
+    if (newName != NULL) {
+        StringBuffer_concat(msg, "\t");
+        StringBuffer_concat(msg, newName);
+    }
+    int i;
+    for (i = 0; i < subscriberList->size; ++i) {
+        send_message_lane(subscriberList->elements[i]->socket, msg, LANE_BULK);
+    }
+    StringBuffer_free(msg);
+}
+
+void
+roster_add(char *name) {
+    roster_publish("+", name, NULL);
+}
+
+void
+roster_remove(char *name) {
+    roster_publish("-", name, NULL);
+}
+
+void
+roster_rename(char *oldName, char *newName) {
+    roster_publish("~", oldName, newName);
+}
+
+RosterSnapshot
+*roster_snapshot(void) {
+    if (current == NULL) {
+        int count = roster_count();
+        int size = 0;
+        int i;
+        for (i = 0; i < count; ++i) {
+            size += strlen(roster_name(i)) + 1;
+        }
+        int pageSize = (config.listPageSize > 0 ? config.listPageSize : count);
+        int pages = (pageSize == 0 ? 1 : (count + pageSize - 1) / pageSize);
+        if (pages == 0)
+            pages = 1;
+        // Names and pages are stored behind the struct in a single block
+        current = malloc(sizeof(RosterSnapshot) + sizeof(char *) * count + sizeof(StringBuffer *) * pages + size);
+        if (current == NULL) {
+            perror("Insufficent memory!");
+            return NULL;
+        }
+        current->references = 1;
+        current->version = version;
+        current->count = count;
+        current->names = (char **)(current + 1);
+        current->pageSize = pageSize;
+        current->pageCount = pages;
+        current->pages = (StringBuffer **)(current->names + count);
+        for (i = 0; i < pages; ++i) {
+            current->pages[i] = NULL;
+        }
+        pthread_mutex_init(&(current->pageLock), NULL);
+        char *pos = (char *)(current->pages + pages);
+        for (i = 0; i < count; ++i) {
+            current->names[i] = pos;
+            strcpy(pos, roster_name(i));
+            pos += strlen(pos) + 1;
+        }
+    }
+    // The roster keeps its own reference until the next change
+    __sync_add_and_fetch(&(current->references), 1);
+    return current;
+}
+
+void
+roster_release(RosterSnapshot *snapshot) {
+    // Workers release their snapshots too
+    if (__sync_sub_and_fetch(&(snapshot->references), 1) == 0) {
+        int i;
+        for (i = 0; i < snapshot->pageCount; ++i) {
+            if (snapshot->pages[i] != NULL)
+                StringBuffer_free(snapshot->pages[i]);
+        }
+        pthread_mutex_destroy(&(snapshot->pageLock));
+        free(snapshot);
+    }
+}
+
+static StringBuffer
+*roster_buildPage(RosterSnapshot *snapshot, int page) {
+    StringBuffer *msg = StringBuffer_construct();
+    char temp[64];
+    sprintf(temp, "Verbundene Clients(%d)", snapshot->count);
+    StringBuffer_concat(msg, temp);
+    if (snapshot->pageCount > 1) {
+        sprintf(temp, " Seite %d/%d", page, snapshot->pageCount);
+        StringBuffer_concat(msg, temp);
+    }
+    StringBuffer_concat(msg, "\n");
+    int first = (page - 1) * snapshot->pageSize;
+    int last = (page * snapshot->pageSize < snapshot->count ? page * snapshot->pageSize : snapshot->count);
+    int i;
+    for (i = first; i < last; ++i) {
+        if (i > first)
+            StringBuffer_concat(msg, ", ");
+        StringBuffer_concat(msg, "[");
+        StringBuffer_concat(msg, snapshot->names[i]);
+        StringBuffer_concat(msg, "]");
+    }
+    return msg;
+}
+
+StringBuffer
+*roster_listPage(RosterSnapshot *snapshot, char *args, bool *cached) {
+    *cached = false;
+    // First page without arguments
+    int page = 1;
+    if (args != NULL) {
+        char *end;
+        page = strtol(args, &end, 10);
+        if (*end != '\0') {
+            StringBuffer *msg = StringBuffer_construct();
+            StringBuffer_concat(msg, "ERROR: Keine gueltige Seite angegeben!");
+            return msg;
+        }
+    }
+    if (page < 1 || page > snapshot->pageCount) {
+        StringBuffer *msg = StringBuffer_construct();
+        StringBuffer_concat(msg, "ERROR: Diese Seite gibt es nicht!");
+        return msg;
+    }
+    // Until the next change every /list of the page gets the same message
+    pthread_mutex_lock(&(snapshot->pageLock));
+    if (snapshot->pages[page - 1] == NULL)
+        snapshot->pages[page - 1] = roster_buildPage(snapshot, page);
+    StringBuffer *msg = snapshot->pages[page - 1];
+    pthread_mutex_unlock(&(snapshot->pageLock));
+    *cached = true;
+    return msg;
+}
+
+StringBuffer
+*roster_search(RosterSnapshot *snapshot, char *args, bool *cached) {
+    *cached = false;
+    StringBuffer *msg = StringBuffer_construct();
+    if (args == NULL || *args == '\0') {
+        StringBuffer_concat(msg, "ERROR: Keinen Suchbegriff angegeben!");
+        return msg;
+    }
+    // The results are limited like a page of /list
+    int limit = (config.listPageSize > 0 ? config.listPageSize : snapshot->count);
+    StringBuffer *names = StringBuffer_construct();
+    int found = 0;
+    int i;
+    for (i = 0; i < snapshot->count; ++i) {
+        if (strcasestr(snapshot->names[i], args) == NULL)
+            continue;
+        if (found < limit) {
+            if (found > 0)
+                StringBuffer_concat(names, ", ");
+            StringBuffer_concat(names, "[");
+            StringBuffer_concat(names, snapshot->names[i]);
+            StringBuffer_concat(names, "]");
+        }
+        ++found;
+    }
+    if (found == 0) {
+        StringBuffer_concat(msg, "INFO: Kein Client gefunden fuer '");
+        StringBuffer_concat(msg, args);
+        StringBuffer_concat(msg, "'.");
+    }
+    else {
+        char temp[64];
+        sprintf(temp, "Gefundene Clients(%d) fuer '", found);
+        StringBuffer_concat(msg, temp);
+        StringBuffer_concat(msg, args);
+        StringBuffer_concat(msg, "'\n");
+        StringBuffer_concat(msg, names->buffer);
+    }
+    StringBuffer_free(names);
+    return msg;
+}
+
+static void
+roster_buildSnapshot(void) {
+    if (snapshotCache == NULL)
+        snapshotCache = StringBuffer_construct();
+    StringBuffer_clear(snapshotCache);
+
+    char temp[64];
+    int count = roster_count();
+    // Header with the number of following names
+    sprintf(temp, "/roster %ld * %d", version, count);
+    StringBuffer_concat(snapshotCache, temp);
+    sprintf(temp, "\n/roster %ld = ", version);
+    int i;
+    for (i = 0; i < count; ++i) {
+        StringBuffer_concat(snapshotCache, temp);
+        StringBuffer_concat(snapshotCache, roster_name(i));
+    }
+    snapshotValid = true;
+}
+
+int
+roster_subscribe(Client *client) {
+    if (subscriberList == NULL)
+        subscriberList = subscriberVector_construct(4);
+    if (client->rosterIndex < 0) {
+        client->rosterIndex = subscriberList->size;
+        subscriberVector_add(subscriberList, client);
+    }
+    if (!snapshotValid)
+        roster_buildSnapshot();
+    return send_message_lane(client->socket, snapshotCache, LANE_BULK);
+}
+
+void
+roster_unsubscribe(Client *client) {
+    if (client->rosterIndex < 0)
+        return;
+    subscriberVector_removeFast(subscriberList, client->rosterIndex, NULL);
+    if (client->rosterIndex < subscriberList->size)
+        subscriberList->elements[client->rosterIndex]->rosterIndex = client->rosterIndex;
+    client->rosterIndex = -1;
+}
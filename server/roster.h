@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROSTER_H
+#define ROSTER_H
+
+#include <pthread.h>
+
+#include "clientStruct.h"
+
+// The list of connected clients is serialized only once after a change.
+// Subscribed clients get a snapshot once and afterwards only the changes,
+// every change increases the version of the roster.
+
+long roster_version(void);
+
+void roster_add(char *name);
+
+void roster_remove(char *name);
+
+void roster_rename(char *oldName, char *newName);
+
+// Names of the roster at one version, read by the workers
+typedef struct RosterSnapshot {
+    int references;
+    long version;
+    int count;
+    char **names;
+    // Pages of /list, each serialized by the first request for it
+    int pageSize;
+    int pageCount;
+    StringBuffer **pages;
+    pthread_mutex_t pageLock;
+} RosterSnapshot;
+
+RosterSnapshot *roster_snapshot(void);
+
+void roster_release(RosterSnapshot *snapshot);
+
+// Sets cached if the result is a page of the snapshot, which is freed with it
+StringBuffer *roster_listPage(RosterSnapshot *snapshot, char *args, bool *cached);
+
+StringBuffer *roster_search(RosterSnapshot *snapshot, char *args, bool *cached);
+
+int roster_subscribe(Client *client);
+
+void roster_unsubscribe(Client *client);
+
+#endif
@@ -16,6 +16,8 @@
  * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -28,14 +30,37 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <pwd.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <poll.h>
 
 #include "server.h"
+#include "config.h"
+#include "presence.h"
+#include "roster.h"
+#include "handoff.h"
+#include "federation.h"
+#include "workerPool.h"
+#include "pipeline.h"
+#include "filter.h"
+#include "sketch.h"
+#include "transfer.h"
+#include "log.h"
+#include "mailbox.h"
+#include "session.h"
+#include "budget.h"
+#include "transport.h"
 #include "../common/network/network.h"
+#include "../common/time/clock.h"
 #include "../common/StringBuffer.h"
 #include "../common/datatype/GenericVector.h"
 
@@ -43,36 +68,223 @@
 // Methods only called when server is starting / stopping
 // *******************************************************
 
-// File Descriptor to the serverSocket(accepting new connections)
-static int serverSocket;
+DefVector(int, socket);
+// File Descriptors of the listening sockets(accepting new connections)
+static socketVector *listenerList;
 
 // Create Generic Vector storing pollfd
 DefVector(struct pollfd, poll);
 // List storing pollfd for poll()
 static pollVector *pollList;
 
-DefVector(Client, client);
+DefVector(Client *, client);
 
 static clientVector *clientList;
 
+// Clients indexed by their socket
+static Client **clientTable;
+static int clientTableSize;
+
+// Timers for rate limits, keepalives and deferred tasks
+static TimerWheel timers;
+
+// Milliseconds per tick of the timer wheel
+#define TIMER_RESOLUTION 10
+
+// Path of the unix socket a successor takes over the server from, NULL when disabled
+static char *handoffPath;
+static int handoffListener = -1;
+
+// Path of the unix socket for local clients, NULL when only TCP is used
+static char *unixPath;
+
+// Port accepting links of other servers, NULL when no server may link to this one
+static char *federationPort;
+
+// Id of the last connected client
+static long lastClientId;
+
+// Signals completed jobs of the workers, -1 without workers
+static int workerEvent = -1;
+
+// Files relayed at the moment
+static int transferCount;
+
+// Messages held for a receiver of a file, more are dropped
+#define TRANSFER_MAX_HELD (256 * 1024)
+
+// Queued bytes above which the input of a client isn't handled
+#define CLIENT_BACKLOG (16 * 1024)
+
+// Buffered input above which the I/O threads stop reading a client, but
+// at least a few messages of the maximal size
+#define INPUT_HIGH_WATER (64 * 1024)
+
+// Clients with messages left after their turn, served round robin
+static Client *readyHead;
+static Client *readyTail;
+// Number of the current round of serve_ready_clients
+static unsigned int readyRound;
+
+// Signals input of the I/O threads, -1 when the server loop reads and writes itself
+static int pipelineEvent = -1;
+
+// File of the banned words, NULL when messages aren't filtered
+static char *filterPath;
+
+// Receives SIGHUP, which reloads the filter
+static int reloadSignal = -1;
+
+// Core the server loop is pinned to, -1 when it may run on every core
+static int loopCpu = -1;
+
+// Milliseconds between the checks of the memory budget
+#define BUDGET_INTERVAL 100
+// Clients paused or disconnected per check
+#define BUDGET_VICTIMS 8
+
+// Checks the memory budget, see check_budget
+static Timer budgetTimer;
+// Stage of the load shedding, one of BUDGET_*. Queued messages raise
+// it at once, only the check lowers it again.
+static int memoryStage;
+static int checkedStage;
+// Clients of the I/O threads closed while their input still waited
+static int hungUpClients;
+// Number of the current check, counts the recent bytes of the senders
+static int budgetCheck = 1;
+// Clients which aren't read because of the budget
+static int shedClients;
+
+// State of the server loop, also used by a simulation
+static int
+init_state(void) {
+    clientList = clientVector_construct(8);
+    BufferPool_init(config.poolMaxFree);
+    if (top_init() == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    TimerWheel_init(&timers, TIMER_RESOLUTION, currentTimeMillis());
+    if (config.memBudget > 0) {
+        Timer_init(&budgetTimer, &check_budget, NULL);
+        TimerWheel_add(&timers, &budgetTimer, currentTimeMillis() + BUDGET_INTERVAL);
+    }
+    return EXIT_SUCCESS;
+}
+
 int init(int argc, char **args) {
 
     puts("Start Server...");
-    char *port;
+    char *port = NULL;
     puts("Parse Arguments from console...");
     if (parseArguments(argc, args, &port) == EXIT_FAILURE)
         return EXIT_FAILURE;
+    if (Log_init() == EXIT_FAILURE)
+        return EXIT_FAILURE;
 
-    puts("Initiating connection...");
-    if (initConnection(port) == EXIT_FAILURE)
+    if (init_state() == EXIT_FAILURE)
         return EXIT_FAILURE;
-        
-    if (initPoll() == EXIT_FAILURE) {
+
+    // Continue the work of a running server
+    bool tookOver = (handoffPath != NULL && take_over(handoffPath) == EXIT_SUCCESS);
+    if (tookOver) {
+        puts("Gnuddels-Server took over the running server!");
+    }
+    else {
+        if (port == NULL && unixPath == NULL) {
+            fprintf(stderr, "No port given!\n");
+            return EXIT_FAILURE;
+        }
+        puts("Initiating connection...");
+        if (initConnection(port, unixPath) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+            
+        if (initPoll() == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+        if (port != NULL)
+            printf("Gnuddels-Server started on the port %s!\n", port);
+        if (unixPath != NULL)
+            printf("Gnuddels-Server started on the socket %s!\n", unixPath);
+    }
+
+    // The clients taken over mustn't be lost for a busy port
+    if (federation_init(federationPort, tookOver) == EXIT_FAILURE)
         return EXIT_FAILURE;
+
+    // SIGHUP is blocked before other threads start, so only the loop gets it
+    if (filterPath != NULL) {
+        if (filter_init(filterPath) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        reloadSignal = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (reloadSignal < 0) {
+            perror("Can't receive signals!");
+            return EXIT_FAILURE;
+        }
+        watch_socket(reloadSignal, POLLIN);
+    }
+
+    // Expensive commands are computed by other threads
+    if (config.workers > 0) {
+        workerEvent = WorkerPool_init(config.workers);
+        if (workerEvent < 0)
+            return EXIT_FAILURE;
+        watch_socket(workerEvent, POLLIN);
+    }
+
+    // Reading and writing is done by other threads
+    if (config.ioThreads > 0) {
+        // Streamed messages need all their bytes
+        pipelineEvent = Pipeline_init(config.ioThreads, (config.msgPolicy == MSG_POLICY_STREAM ? 0 : config.msgMaxSize));
+        if (pipelineEvent < 0)
+            return EXIT_FAILURE;
+        watch_socket(pipelineEvent, POLLIN);
+        // Clients taken over from the predecessor
+        int i;
+        for (i = 0; i < clientList->size; ++i) {
+            Client *client = clientList->elements[i];
+            unwatch_socket(client->socket);
+            client->pollIndex = -1;
+            Pipeline_open(client->socket, client->id);
+            // The I/O thread sends the output the predecessor left
+            char *output;
+            if (client->outbox.size > 0 && (output = malloc(client->outbox.size)) != NULL) {
+                Payload *payload = Payload_construct(output, Outbox_copy(&(client->outbox), output));
+                free(output);
+                if (payload != NULL) {
+                    Pipeline_send(client->socket, client->id, payload);
+                    Payload_release(payload);
+                }
+            }
+            Outbox_clear(&(client->outbox));
+            throttle_input(client);
+        }
+    }
+
+    // Wait for a successor
+    if (handoffPath != NULL) {
+        handoffListener = handoff_listen(handoffPath);
+        if (handoffListener < 0)
+            return EXIT_FAILURE;
+        struct pollfd handoffPollfd;
+        handoffPollfd.fd = handoffListener;
+        handoffPollfd.events = POLLIN;
+        pollVector_add(pollList, handoffPollfd);
+    }
+
+    // Pinned after the other threads are started, they keep every core
+    if (loopCpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(loopCpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            fprintf(stderr, "Can't pin the server to core %d!\n", loopCpu);
+            return EXIT_FAILURE;
+        }
     }
-    
-    clientList = clientVector_construct(8);
-    printf("Gnuddels-Server started on the port %s!\n", port);
 
     return EXIT_SUCCESS;
 }
@@ -80,17 +292,45 @@ int init(int argc, char **args) {
 int parseArguments(int argc, char **args, char **port) {
     // Not enough arguments
     if (argc < 3) {
-        printf("Usage: %s -p Port\n", args[0]);
+        printf("Usage: %s -p Port [-U Unix socket] [-H Handoff socket] [-N Node name] [-F Link port] [-L Host:Port]... [-B Filter list] [-C Core] [-o name=value]...\n", args[0]);
+        Config_printUsage();
         return EXIT_FAILURE;
     }
 
     // Parse arguments
     int opt;
-	while ((opt = getopt(argc, args, "p:")) != -1) {
+	while ((opt = getopt(argc, args, "p:o:U:H:N:F:L:B:C:")) != -1) {
 		switch (opt) {
 			case 'p':
                 *port = optarg;
                 break;
+            case 'U':
+                unixPath = optarg;
+                break;
+            case 'H':
+                handoffPath = optarg;
+                break;
+            case 'N':
+                federation_setNode(optarg);
+                break;
+            case 'F':
+                federationPort = optarg;
+                break;
+            case 'L':
+                federation_addPeer(optarg);
+                break;
+            case 'B':
+                filterPath = optarg;
+                break;
+            case 'C':
+                loopCpu = atoi(optarg);
+                break;
+            case 'o':
+                if (Config_set(optarg) == EXIT_FAILURE) {
+                    Config_printUsage();
+                    return EXIT_FAILURE;
+                }
+                break;
             default:
                 fprintf(stderr, "Unknown paramater %c", opt);
                 return EXIT_FAILURE;
@@ -100,7 +340,19 @@ int parseArguments(int argc, char **args, char **port) {
 	return EXIT_SUCCESS;
 }
 
-int initConnection(char *port) {
+int initConnection(char *port, char *path) {
+
+    listenerList = socketVector_construct(2);
+    // Local clients like bots don't need the TCP stack
+    if (path != NULL) {
+        int listener = initUnixListener(path);
+        if (listener >= 0) {
+            socketVector_add(listenerList, listener);
+        }
+    }
+    if (port == NULL) {
+        return (listenerList->size > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
     
     // Information about the connection type
     struct addrinfo hints;
@@ -112,297 +364,1887 @@ int initConnection(char *port) {
     
     // Store information in struct "res"
     struct addrinfo *res;
-    if (getaddrinfo(NULL, port, &hints, &res) == -1) {
-        perror("Can't parse information for socket creation");
+    int error = getaddrinfo(NULL, port, &hints, &res);
+    if (error != 0) {
+        fprintf(stderr, "Can't parse information for socket creation: %s\n", gai_strerror(error));
         return EXIT_FAILURE;
     }
-    
+
+    // Listen on every address, usually one for IPv4 and one for IPv6
+    struct addrinfo *info;
+    for (info = res; info != NULL; info = info->ai_next) {
+        int listener = initListener(info);
+        if (listener >= 0) {
+            socketVector_add(listenerList, listener);
+        }
+    }
+
+    // Free Memory
+    freeaddrinfo(res);
+
+    if (listenerList->size == 0) {
+        fprintf(stderr, "Can't listen on any address!\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int initListener(struct addrinfo *info) {
+
     // Create Socket with the stored information
-    serverSocket = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if (serverSocket < 0 ) {
+    // The listener is non blocking, so it can be drained by accept
+    int listener = socket(info->ai_family, info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, info->ai_protocol);
+    if (listener < 0 ) {
         perror("Can't create new socket!");
-        return EXIT_FAILURE;
+        return -1;
     }
 
     // Make address of the server reusable (nice for debugging)
     int flag = 1;
-    if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (char *)&flag, sizeof(flag)) < 0) {
+    if (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (char *)&flag, sizeof(flag)) < 0) {
         perror("setsockopt() failed");
-        close(serverSocket);
-        return EXIT_FAILURE;
+        close(listener);
+        return -1;
+    }
+    // IPv4 has its own listener, otherwise both binds would collide
+    if (info->ai_family == AF_INET6 && setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&flag, sizeof(flag)) < 0) {
+        perror("setsockopt() failed");
+        close(listener);
+        return -1;
     }
 
     // Bind the Server to the Socket
-    if (bind(serverSocket, res->ai_addr, res->ai_addrlen) == -1) {
+    if (bind(listener, info->ai_addr, info->ai_addrlen) == -1) {
         perror("Can't bind the server to the socket!");
+        close(listener);
+        return -1;
+    }
+
+    // Start Listening to the Socket    
+    if (listen(listener, SOMAXCONN) == -1) {
+        perror("Can't listen to the socket!");
+        close(listener);
+        return -1;
+    }
+
+    return listener;
+}
+
+int initUnixListener(char *path) {
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Path of the unix socket is too long!\n");
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    // Socket of the last run is still there
+    unlink(path);
+
+    struct addrinfo info;
+    memset(&info, 0, sizeof(info));
+    info.ai_family = AF_UNIX;
+    info.ai_socktype = SOCK_STREAM;
+    info.ai_addr = (struct sockaddr*)&address;
+    info.ai_addrlen = sizeof(address);
+    return initListener(&info);
+}
+
+int
+initPoll() {
+    // init list for poll structs
+    pollList = pollVector_construct(1);
+    if (pollList == NULL) {
         return EXIT_FAILURE;
     }
+    // add pollstruct of every listener to list
+    int i;
+    for (i = 0; i < listenerList->size; ++i) {
+        struct pollfd serverPollfd;
+        serverPollfd.fd = listenerList->elements[i];
+        serverPollfd.events = POLLIN;    
+        pollVector_add(pollList, serverPollfd);
+    }
+    
+    return EXIT_SUCCESS;
+}
 
-    // Free Memory
-    freeaddrinfo(res);
+void stopServer(void) {
 
-    // Start Listening to the Socket    
-    listen(serverSocket, SOMAXCONN);
+    puts("Stopping server...");
+    puts("Close socket...");
+    int i;
+    for (i = 0; i < listenerList->size; ++i) {
+        close(listenerList->elements[i]);
+    }
+    if (handoffListener >= 0)
+        close(handoffListener);
+    Log_flush();
+}
+
+// *******************************************
+// Methods for the hot restart
+// *******************************************
+
+#define HANDOFF_MAGIC 0x474E5544
+
+// Types of the handoff messages
+#define HANDOFF_HEADER  1
+#define HANDOFF_CLIENTS 2
+#define HANDOFF_END     3
+
+// Client is subscribed to the roster
+#define HANDOFF_FLAG_ROSTER 1
+#define HANDOFF_FLAG_ADMIN  2
+// The rest of an oversized message is skipped or relayed
+#define HANDOFF_FLAG_OVERSIZED  4
+#define HANDOFF_FLAG_STREAMING  8
+
+// First message, carries the listening sockets
+typedef struct HandoffHeader {
+    uint32_t type;
+    uint32_t magic;
+    uint32_t listeners;
+    // Listening sockets of the federation, following the others
+    uint32_t federation;
+    uint32_t clients;
+} HandoffHeader;
+
+// Every client in a HANDOFF_CLIENTS message, followed by the name, the unhandled
+// input and the unsent output
+typedef struct HandoffRecord {
+    uint32_t nameLength;
+    uint32_t inputLength;
+    uint32_t outputLength;
+    uint32_t flags;
+} HandoffRecord;
+
+int
+handoff_serve(int listener) {
+    int successor = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (successor < 0) {
+        return EXIT_FAILURE;
+    }
+    // The sockets are owned by the I/O threads
+    if (pipelineEvent >= 0) {
+        fprintf(stderr, "Can't hand over the server while I/O threads are running!\n");
+        close(successor);
+        return EXIT_FAILURE;
+    }
+    // The successor can't continue a half relayed file
+    if (transferCount > 0) {
+        fprintf(stderr, "Can't hand over the server while %d files are sent!\n", transferCount);
+        close(successor);
+        return EXIT_FAILURE;
+    }
+    long long start = currentTimeMillis();
+    printf("Handing %d clients over to the successor...\n", clientList->size);
+
+    // Listening sockets, the successor needn't bind the ports again
+    int fds[HANDOFF_MAX_FDS];
+    int fdCount = 0;
+    HandoffHeader header;
+    header.type = HANDOFF_HEADER;
+    header.magic = HANDOFF_MAGIC;
+    header.listeners = listenerList->size;
+    header.federation = federation_listenerCount();
+    header.clients = clientList->size;
+    if (header.listeners + header.federation > HANDOFF_MAX_FDS) {
+        fprintf(stderr, "Can't hand over %u listening sockets!\n", header.listeners + header.federation);
+        close(successor);
+        return EXIT_FAILURE;
+    }
+    memcpy(fds, listenerList->elements, sizeof(int) * header.listeners);
+    memcpy(fds + header.listeners, federation_listeners(), sizeof(int) * header.federation);
+    if (handoff_send(successor, (char*)&header, sizeof(header), fds, header.listeners + header.federation) == EXIT_FAILURE) {
+        close(successor);
+        return EXIT_FAILURE;
+    }
+
+    // Clients in batches
+    char *batch = malloc(HANDOFF_MAX_MESSAGE);
+    if (batch == NULL) {
+        perror("Insufficent memory!");
+        close(successor);
+        return EXIT_FAILURE;
+    }
+    uint32_t type = HANDOFF_CLIENTS;
+    memcpy(batch, &type, sizeof(type));
+    int size = sizeof(type);
+    int i;
+    for (i = 0; i < clientList->size; ++i) {
+        Client *client = clientList->elements[i];
+        HandoffRecord record;
+        record.nameLength = strlen(client->name);
+        record.inputLength = client->input.size;
+        // Only an upper bound until the messages are copied without their lengths
+        record.outputLength = client->outbox.size;
+        record.flags = (client->rosterIndex >= 0 ? HANDOFF_FLAG_ROSTER : 0);
+        if (client->admin)
+            record.flags |= HANDOFF_FLAG_ADMIN;
+        if (client->oversized)
+            record.flags |= HANDOFF_FLAG_OVERSIZED;
+        if (client->streaming)
+            record.flags |= HANDOFF_FLAG_STREAMING;
+        int recordSize = sizeof(record) + record.nameLength + record.inputLength + record.outputLength;
+        // A single message must hold the record
+        if (recordSize + sizeof(type) > HANDOFF_MAX_MESSAGE) {
+            // Without the rest of a started message the client gets a broken line
+            fprintf(stderr, "Output of client %d is too big, only the started message is handed over\n", client->socket);
+            record.outputLength = client->outbox.partial.size;
+            recordSize = sizeof(record) + record.nameLength + record.inputLength + record.outputLength;
+        }
+        if (recordSize + sizeof(type) > HANDOFF_MAX_MESSAGE) {
+            fprintf(stderr, "Input of client %d is too big, it is dropped\n", client->socket);
+            record.inputLength = 0;
+            recordSize = sizeof(record) + record.nameLength + record.outputLength;
+        }
+        if (recordSize + sizeof(type) > HANDOFF_MAX_MESSAGE) {
+            record.outputLength = 0;
+            recordSize = sizeof(record) + record.nameLength;
+        }
+        // Batch is full -> send it
+        if (fdCount == HANDOFF_MAX_FDS || size + recordSize > HANDOFF_MAX_MESSAGE) {
+            if (handoff_send(successor, batch, size, fds, fdCount) == EXIT_FAILURE)
+                break;
+            size = sizeof(type);
+            fdCount = 0;
+        }
+        int recordPos = size;
+        size += sizeof(record);
+        memcpy(batch + size, client->name, record.nameLength);
+        size += record.nameLength;
+        ChunkChain_copy(&(client->input), batch + size, record.inputLength);
+        size += record.inputLength;
+        if (record.outputLength == (uint32_t)client->outbox.size)
+            record.outputLength = Outbox_copy(&(client->outbox), batch + size);
+        else
+            ChunkChain_copy(&(client->outbox.partial), batch + size, record.outputLength);
+        size += record.outputLength;
+        memcpy(batch + recordPos, &record, sizeof(record));
+        fds[fdCount++] = client->socket;
+    }
+    int res = EXIT_FAILURE;
+    if (i == clientList->size && (fdCount == 0 || handoff_send(successor, batch, size, fds, fdCount) == EXIT_SUCCESS)) {
+        type = HANDOFF_END;
+        res = handoff_send(successor, (char*)&type, sizeof(type), NULL, 0);
+    }
+    free(batch);
+
+    // Wait for the successor to confirm
+    char ack = 0;
+    struct pollfd pollfd;
+    pollfd.fd = successor;
+    pollfd.events = POLLIN;
+    if (res == EXIT_FAILURE || poll(&pollfd, 1, HANDOFF_TIMEOUT) <= 0 || read(successor, &ack, 1) != 1 || ack != 'K') {
+        fprintf(stderr, "Handoff failed, the server continues\n");
+        close(successor);
+        return EXIT_FAILURE;
+    }
+    close(successor);
+    printf("Handed %d clients over in %lld ms\n", clientList->size, currentTimeMillis() - start);
+    return EXIT_SUCCESS;
+}
+
+int
+take_over(char *path) {
+    int predecessor = handoff_connect(path);
+    // No server is running
+    if (predecessor < 0) {
+        return EXIT_FAILURE;
+    }
+    long long start = currentTimeMillis();
+    char *message = malloc(HANDOFF_MAX_MESSAGE);
+    if (message == NULL) {
+        perror("Insufficent memory!");
+        close(predecessor);
+        return EXIT_FAILURE;
+    }
+    int fds[HANDOFF_MAX_FDS];
+    int fdCount;
+
+    // Listening sockets
+    int len = handoff_receive(predecessor, message, HANDOFF_MAX_MESSAGE, fds, &fdCount);
+    HandoffHeader header;
+    if (len != sizeof(header)) {
+        free(message);
+        close(predecessor);
+        return EXIT_FAILURE;
+    }
+    memcpy(&header, message, sizeof(header));
+    if (header.type != HANDOFF_HEADER || header.magic != HANDOFF_MAGIC || fdCount != (int)(header.listeners + header.federation)) {
+        fprintf(stderr, "Invalid handoff header!\n");
+        free(message);
+        close(predecessor);
+        return EXIT_FAILURE;
+    }
+    listenerList = socketVector_construct(2);
+    int i;
+    for (i = 0; i < (int)header.listeners; ++i) {
+        socketVector_add(listenerList, fds[i]);
+    }
+    initPoll();
+    // The links of the federation are only accepted when configured
+    for (; i < fdCount; ++i) {
+        if (federationPort != NULL)
+            federation_adopt(fds[i]);
+        else
+            close(fds[i]);
+    }
+
+    // Clients
+    while ((len = handoff_receive(predecessor, message, HANDOFF_MAX_MESSAGE, fds, &fdCount)) >= (int)sizeof(uint32_t)) {
+        uint32_t type;
+        memcpy(&type, message, sizeof(type));
+        if (type != HANDOFF_CLIENTS)
+            break;
+        int pos = sizeof(type);
+        for (i = 0; i < fdCount && pos + (int)sizeof(HandoffRecord) <= len; ++i) {
+            HandoffRecord record;
+            memcpy(&record, message + pos, sizeof(record));
+            pos += sizeof(record);
+            char *name = strndup(message + pos, record.nameLength);
+            pos += record.nameLength;
+            Client *client = add_client(fds[i], name);
+            free(name);
+            if (client == NULL) {
+                close(fds[i]);
+                pos += record.inputLength + record.outputLength;
+                continue;
+            }
+            ChunkChain_append(&(client->input), message + pos, record.inputLength);
+            pos += record.inputLength;
+            // The predecessor stopped in the middle of the messages
+            if (record.outputLength > 0 && Outbox_pushPartial(&(client->outbox), message + pos, record.outputLength) == EXIT_SUCCESS)
+                set_writing(client, true);
+            pos += record.outputLength;
+            // The flag marks clients of the unix socket, the allow-list may have changed
+            client->admin = ((record.flags & HANDOFF_FLAG_ADMIN) != 0 && admin_uid(peer_uid(fds[i])));
+            client->oversized = ((record.flags & HANDOFF_FLAG_OVERSIZED) != 0);
+            client->streaming = ((record.flags & HANDOFF_FLAG_STREAMING) != 0);
+            if ((record.flags & HANDOFF_FLAG_ROSTER) != 0) {
+                // Versions start again, so the subscriber needs a new snapshot
+                roster_subscribe(client);
+            }
+        }
+    }
+    free(message);
+
+    // Confirm the handoff, the predecessor stops afterwards
+    if (write(predecessor, "K", 1) != 1) {
+        perror("Can't confirm the handoff!");
+    }
+    close(predecessor);
+    printf("Took over %d of %u clients in %lld ms\n", clientList->size, header.clients, currentTimeMillis() - start);
+
+    // Handle the complete messages the predecessor hadn't handled yet
+    for (i = 0; i < clientList->size; ++i) {
+        Client *client = clientList->elements[i];
+        if (client->input.size > 0 && dispatch_messages(client) != EXIT_SUCCESS) {
+            remove_client(client->socket);
+            --i;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// *******************************************
+// Methods called when the server is running
+// *******************************************
+
+#define INFINITE_TIMEOUT -1
+
+#define CLIENT_DISCONNECTED -2 
+
+#define CLIENT_FLOODING -3
+
+#define CLIENT_OVERSIZED -4
+
+void
+serverLoop(void) {
+
+    // Time of the last event, the loop spins for config.busyPoll ms afterwards
+    long long lastEvent = 0;
+    while (true) {
+        // Continue the clients which used up their budget
+        serve_ready_clients();
+        // Run the expired timers and wait until the next timer expires
+        TimerWheel_advance(&timers, currentTimeMillis());
+        // Closed clients of the I/O threads whose last messages are handled
+        if (hungUpClients > 0)
+            remove_hung_up();
+        int timeout = TimerWheel_timeout(&timers, currentTimeMillis());
+        // Only look for new events when the ready list has more work
+        if (readyHead != NULL)
+            timeout = 0;
+        // Don't sleep in the kernel while events are expected soon
+        else if (config.busyPoll > 0 && currentTimeMillis() - lastEvent < config.busyPoll)
+            timeout = 0;
+        // Wake the I/O threads for the output of this iteration
+        // Output waiting for a full ring is retried soon
+        if (pipelineEvent >= 0 && Pipeline_flush() && (timeout < 0 || timeout > 1))
+            timeout = 1;
+        // res stores the numbers of file descriptors throwed an event
+        int res = poll(pollList->elements, pollList->size, timeout);
+        // Poll returns without any events
+        if (res == 0) {
+            continue;
+        }
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll failed!");
+            break;
+        }
+        lastEvent = currentTimeMillis();
+        int i;
+        struct pollfd *pollfd = NULL;
+        for (i = 0 ; i < pollList->size; ++i) {
+            pollfd = pollVector_get(pollList, i);
+            // This fd didn't fired an event
+            if (pollfd->revents == 0) {
+                continue;
+            }
+            // Links to the other servers of the network
+            if (federation_isSocket(pollfd->fd)) {
+                if (federation_handle(pollfd->fd, pollfd->revents) == LINK_CLOSED)
+                    --i;
+            }
+            // Socket of a client can take more data
+            else if ((pollfd->revents & POLLOUT) != 0 && search_client(pollfd->fd) != NULL) {
+                if (client_event(pollfd->fd, POLLOUT))
+                    --i;
+            }
+            // The fd want to send something
+            else if ((pollfd->revents & POLLIN) == POLLIN) {
+                // Successor wants to take over the server
+                if (pollfd->fd == handoffListener) {
+                    if (handoff_serve(handoffListener) == EXIT_SUCCESS) {
+                        return;
+                    }
+                }
+                // Workers completed jobs
+                else if (pollfd->fd == workerEvent) {
+                    complete_jobs();
+                }
+                // Filter list was changed
+                else if (pollfd->fd == reloadSignal) {
+                    struct signalfd_siginfo info;
+                    while (read(reloadSignal, &info, sizeof(info)) == sizeof(info)) {
+                        filter_reload();
+                    }
+                }
+                // I/O threads read input of clients
+                else if (pollfd->fd == pipelineEvent) {
+                    receive_pipeline();
+                }
+                // New clients want to connect
+                else if (is_listener(pollfd->fd)) {
+                    // try to accept the waiting clients
+                    accept_newClients(pollfd->fd);
+                }
+                // Connected client want to send something
+                else if (client_event(pollfd->fd, POLLIN)) {
+                    --i;
+                }
+            }
+            // Connection of a client was closed or broken
+            else if ((pollfd->revents & (POLLHUP | POLLERR | POLLNVAL)) != 0 && !is_listener(pollfd->fd)) {
+                LOG(LOG_CLIENT, LOG_INFO, "Client hung up", pollfd->fd, NULL);
+                remove_client(pollfd->fd);
+                --i;
+            }
+            // Unregistered poll event was thrown
+            else {
+                fprintf(stderr, "Unkown poll event %d! Server is stopping\n", pollfd->revents);
+                return;
+            }
+        }
+    }
+}
+
+bool
+client_event(int socket, short events) {
+    int cRes;
+    if ((events & POLLOUT) != 0) {
+        Client *client = search_client(socket);
+        // Receiver of a file
+        if (client->transfer != NULL && client->transfer->receiver == client->socket && !client->transfer->queued)
+            cRes = pump_transfer(client->transfer, false);
+        // Queued messages
+        else
+            cRes = flush_client(client);
+        if (cRes == EXIT_FAILURE)
+            cRes = CLIENT_DISCONNECTED;
+    }
+    else {
+        // Read it's input and handle it
+        cRes = handle_client(socket);
+    }
+    if (cRes == EXIT_SUCCESS)
+        return false;
+
+    if (cRes == CLIENT_DISCONNECTED)
+        LOG(LOG_CLIENT, LOG_INFO, "Client disconnected", socket, NULL);
+    // Client exceeded its rate limits
+    else if (cRes == CLIENT_FLOODING)
+        LOG(LOG_CLIENT, LOG_WARN, "Client is flooding", socket, NULL);
+    // Client sent a message above the maximal size
+    else if (cRes == CLIENT_OVERSIZED)
+        LOG(LOG_CLIENT, LOG_WARN, "Client sent a too long message", socket, NULL);
+    // An error occurred
+    else
+        LOG(LOG_CLIENT, LOG_ERROR, "Client crashed", socket, NULL);
+    remove_client(socket);
+    return true;
+}
+
+bool
+is_listener(int socket) {
+    int i;
+    for (i = 0; i < listenerList->size; ++i) {
+        if (listenerList->elements[i] == socket)
+            return true;
+    }
+    return false;
+}
+
+int
+accept_newClients(int listener) {
+    int accepted;
+    // Drain the connection queue, but don't let a connection storm block the other clients
+    for (accepted = 0; config.acceptBudget == 0 || accepted < config.acceptBudget; ++accepted) {
+        int res = accept_newClient(listener);
+        if (res == EXIT_FAILURE)
+            break;
+    }
+    return accepted;
+}
+
+// Bytes of the send buffer of unix socket clients
+#define UNIX_SEND_BUFFER (4 * 1024 * 1024)
+
+int
+accept_newClient(int listener) {
+
+    // Accept new clients in the connection queue
+    // sockaddr_storage is big enough for IPv4 and IPv6 addresses
+    struct sockaddr_storage conInfo;
+    socklen_t conInfo_len = sizeof(struct sockaddr_storage);
+
+    // Get one single client from the queue
+    int clientSocket;
+    do {
+        clientSocket = accept4(listener, (struct sockaddr*)(&conInfo), &conInfo_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    } while (clientSocket < 0 && (errno == EINTR || errno == ECONNABORTED));
+    if (clientSocket < 0) {
+        // Queue is empty
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            LOG_ERRNO(LOG_SERVER, "accept failed", listener);
+        return EXIT_FAILURE;
+    }
+
+    // Convert client address to a readable IPv4 or IPv6 formatted string
+    // This is the standard name of all new users
+    char ip[NI_MAXHOST];
+    bool admin = false;
+    if (conInfo.ss_family == AF_UNIX) {
+        admin = admin_uid(peer_name(clientSocket, ip, sizeof(ip)));
+        // Unix sockets account every small message with a whole buffer and
+        // don't grow their buffer like TCP, broadcasts would block early
+        int size = UNIX_SEND_BUFFER;
+        setsockopt(clientSocket, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+    else if (getnameinfo((struct sockaddr*)(&conInfo), conInfo_len, ip, sizeof(ip), NULL, 0, NI_NUMERICHOST) != 0) {
+        strcpy(ip, "unknown");
+    }
+    if (connect_client(clientSocket, ip, admin) == NULL)
+        close(clientSocket);
+    return EXIT_SUCCESS;
+}
+
+Client
+*connect_client(int socket, char *address, bool admin) {
+    Client *client = add_client(socket, address);
+    if (client == NULL)
+        return NULL;
+    client->admin = admin;
+    
+    presence_joined(client->name);
+    roster_add(client->name);
+    federation_joined(client);
+    
+    LOG(LOG_CLIENT, LOG_INFO, "Client connected", socket, address);
+    return client;
+}
+
+void
+tune_socket(int socket) {
+    // Unix sockets fail the options, nothing to tune there
+    if (config.outLowat > 0) {
+        // Otherwise megabytes wait in the socket where no lane can pass them
+        setsockopt(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &config.outLowat, sizeof(config.outLowat));
+    }
+    if (config.busyPoll > 0) {
+        // Answers leave at once instead of waiting for the ack of the last one
+        int on = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if (config.busySocket > 0) {
+        if (setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &config.busySocket, sizeof(config.busySocket)) != 0 && errno != EOPNOTSUPP)
+            LOG_ERRNO(LOG_SERVER, "SO_BUSY_POLL failed", socket);
+    }
+}
+
+int
+peer_uid(int socket) {
+    struct ucred cred;
+    socklen_t credLen = sizeof(cred);
+    if (getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) != 0)
+        return -1;
+    return (int)cred.uid;
+}
+
+int
+peer_name(int socket, char *name, int len) {
+    // Clients of the unix socket are named by the user running them
+    int uid = peer_uid(socket);
+    if (uid < 0) {
+        snprintf(name, len, "unknown@local");
+        return -1;
+    }
+    struct passwd entry;
+    struct passwd *result = NULL;
+    char buffer[1024];
+    if (getpwuid_r(uid, &entry, buffer, sizeof(buffer), &result) == 0 && result != NULL)
+        snprintf(name, len, "%s@local", entry.pw_name);
+    else
+        snprintf(name, len, "%d@local", uid);
+    return uid;
+}
+
+bool
+admin_uid(int uid) {
+    // Only the users of the allow-list, any local user can connect to the unix socket
+    int i;
+    for (i = 0; uid >= 0 && i < config.adminUidCount; ++i) {
+        if (config.adminUids[i] == uid)
+            return true;
+    }
+    return false;
+}
+
+Client
+*add_client(int socket, char *name) {
+    // Make room in the table
+    if (socket >= clientTableSize) {
+        int newSize = (clientTableSize == 0 ? 64 : clientTableSize);
+        while (newSize <= socket)
+            newSize = newSize << 1;
+        Client **table = realloc(clientTable, sizeof(Client *) * newSize);
+        if (table == NULL) {
+            perror("Insufficent memory!");
+            return NULL;
+        }
+        memset(table + clientTableSize, 0, sizeof(Client *) * (newSize - clientTableSize));
+        clientTable = table;
+        clientTableSize = newSize;
+    }
+    Client *client = Client_construct(socket, name);
+    if (client == NULL) {
+        return NULL;
+    }
+    tune_socket(socket);
+
+    client->id = ++lastClientId;
+
+    // Add client to pollList or to its I/O thread
+    if (pipelineEvent >= 0) {
+        client->pollIndex = -1;
+        Pipeline_open(socket, client->id);
+    }
+    else {
+        client->pollIndex = pollList->size;
+        watch_socket(socket, POLLIN);
+    }
+
+    // Add client to clientList
+    client->listIndex = clientList->size;
+    clientVector_add(clientList, client);
+    clientTable[socket] = client;
+
+    long long now = currentTimeMillis();
+    TokenBucket_init(&(client->msgBucket), config.rateMsgs, config.rateMsgsBurst, now);
+    TokenBucket_init(&(client->byteBucket), config.rateBytes, config.rateBytesBurst, now);
+    TokenBucket_init(&(client->commandBucket), config.rateCommands, config.rateCommandsBurst, now);
+
+    // Start watching the connection
+    client->lastActivity = now;
+    client->lastMessage = now;
+    Timer_init(&(client->resumeTimer), &resume_client, client);
+    Timer_init(&(client->keepaliveTimer), &keepalive_client, client);
+    Timer_init(&(client->idleTimer), &idle_client, client);
+    if (config.pingInterval > 0)
+        TimerWheel_add(&timers, &(client->keepaliveTimer), now + config.pingInterval * 1000LL);
+    if (config.idleTimeout > 0)
+        TimerWheel_add(&timers, &(client->idleTimer), now + config.idleTimeout * 1000LL);
+
+    return client;
+}
+
+int
+remove_client(int socket) {
+
+    Client *client = search_client(socket);
+    if (client == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    // Close the socket after its I/O thread wrote the last messages
+    if (pipelineEvent >= 0)
+        Pipeline_close(socket, client->id);
+    else
+        transport->close(socket);
+    
+    // Remove registered socket from poll list
+    unwatch_socket(socket);
+    
+    // Remove registered Client from client list
+    clientVector_removeFast(clientList, client->listIndex, NULL);
+    if (client->listIndex < clientList->size) {
+        clientList->elements[client->listIndex]->listIndex = client->listIndex;
+    }
+    clientTable[socket] = NULL;
+    unready_client(client);
+    if (client->shed)
+        --shedClients;
+    if (client->hungUp)
+        --hungUpClients;
+    leave_transfer(client);
+
+    TimerWheel_cancel(&timers, &(client->resumeTimer));
+    TimerWheel_cancel(&timers, &(client->keepaliveTimer));
+    TimerWheel_cancel(&timers, &(client->idleTimer));
+
+    roster_unsubscribe(client);
+    roster_remove(client->name);
+    presence_left(client->name);
+    federation_left(client);
+    session_detach(client);
+    Client_free(client);
+    return EXIT_SUCCESS;
+}
+
+void
+watch_socket(int socket, short events) {
+    struct pollfd pollfd;
+    pollfd.fd = socket;
+    pollfd.events = events;
+    pollfd.revents = 0;
+    pollVector_add(pollList, pollfd);
+}
+
+static int
+poll_index(int socket) {
+    Client *client = search_client(socket);
+    if (client != NULL)
+        return client->pollIndex;
+    // Only few sockets aren't clients
+    int i;
+    for (i = 0; i < pollList->size; ++i) {
+        if (pollList->elements[i].fd == socket)
+            return i;
+    }
+    return -1;
+}
+
+void
+watch_events(int socket, short events) {
+    int index = poll_index(socket);
+    if (index >= 0)
+        pollList->elements[index].events = events;
+}
+
+void
+unwatch_socket(int socket) {
+    int index = poll_index(socket);
+    if (index < 0)
+        return;
+    // The last pollfd takes its position
+    pollVector_removeFast(pollList, index, NULL);
+    if (index < pollList->size) {
+        Client *moved = search_client(pollList->elements[index].fd);
+        if (moved != NULL)
+            moved->pollIndex = index;
+    }
+}
+
+#define MSG_DELIMITER '\n'
+
+#define COMMAND_START '/'
+
+int
+handle_client(int socket) {
+
+    // Get the client registered to the socket
+    Client *client = search_client(socket);
+    if (client == NULL) {
+        perror("Unregistered client socket found! This is not in the list!");
+        return EXIT_FAILURE;
+    }
+    // The input is a file for another client
+    if (is_sending(client))
+        return pump_transfer(client->transfer, true);
+    // Read the complete input of the client
+    int res = read_from_client(client);
+    if (res != EXIT_SUCCESS)
+        return res;
+
+    return dispatch_messages(client);
+}
+
+int
+dispatch_messages(Client *client) {
+    long long now = currentTimeMillis();
+    int len;
+    int handled = 0;
+    long bytes = 0;
+    // Handle every complete message in the buffer
+    // A pending job delays the following messages to keep their order
+    // and the input following /send is the file
+    while (!client->jobPending && !is_sending(client)) {
+        len = next_message_length(client);
+        // Messages above the maximal size are never buffered completely
+        if (client->oversized || is_oversized(client, len)) {
+            int res = handle_oversized(client, len, now);
+            if (res != EXIT_SUCCESS)
+                return res;
+            // Waiting for the rest of the message or for the rate limits
+            if (client->oversized || client->resumeTimer.active)
+                break;
+            continue;
+        }
+        if (len < 0)
+            break;
+        // The client doesn't read the answers, so it mustn't get more
+        if (client->outbox.size > CLIENT_BACKLOG) {
+            client->backlogged = true;
+            set_reading(client, false);
+            return EXIT_SUCCESS;
+        }
+        // Budget of this turn is used up, the other clients are served first
+        if ((config.fairMsgs > 0 && handled >= config.fairMsgs) || (config.fairBytes > 0 && bytes >= config.fairBytes)) {
+            ready_client(client);
+            return EXIT_SUCCESS;
+        }
+        StringBuffer *msg = peek_message(client, len);
+        if (msg == NULL) {
+            return EXIT_FAILURE;
+        }
+        // Check the limits before the message is handled
+        long long delay = check_rate_limits(client, msg->buffer, len, now);
+        if (delay > 0) {
+            StringBuffer_free(msg);
+            if (config.ratePolicy == RATE_POLICY_DISCONNECT) {
+                return CLIENT_FLOODING;
+            }
+            if (config.ratePolicy == RATE_POLICY_DROP) {
+                consume_message(client, len);
+                StringBuffer *errorMsg = StringBuffer_construct();
+                StringBuffer_concat(errorMsg, "ERROR: Zu viele Nachrichten! Die Nachricht wurde verworfen.");
+                send_message(client->socket, errorMsg);
+                StringBuffer_free(errorMsg);
+            }
+            // Stop reading from the client until it can send again
+            pause_client(client, now + delay);
+            return EXIT_SUCCESS;
+        }
+
+        consume_message(client, len);
+        ++handled;
+        bytes += len + 1;
+        top_count(client, TOP_MESSAGES, 1);
+        top_count(client, TOP_BYTES, len + 1);
+        count_recent(client, len + 1);
+        // Keepalives don't count as activity of the user
+        if (strcmp(msg->buffer, "/ping") != 0 && strcmp(msg->buffer, "/pong") != 0) {
+            client->lastMessage = now;
+        }
+        if (is_command(client, msg) == EXIT_SUCCESS) {
+            handle_command(client, msg);
+        }
+        else {
+            broadcast_message(client, msg);
+        }
+        StringBuffer_free(msg);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// ***********************************
+// Methods for oversized messages
+// ***********************************
+
+bool
+is_oversized(Client *client, int len) {
+    if (config.msgMaxSize == 0)
+        return false;
+    // Complete message or the beginning of one without a delimiter
+    return len > config.msgMaxSize || (len < 0 && client->input.size > config.msgMaxSize);
+}
+
+int
+handle_oversized(Client *client, int len, long long now) {
+    // First part of the message
+    if (!client->oversized) {
+        StringBuffer *errorMsg = StringBuffer_construct();
+        if (config.msgPolicy == MSG_POLICY_DISCONNECT) {
+            StringBuffer_concat(errorMsg, "ERROR: Nachricht zu lang! Die Verbindung wird getrennt.");
+            send_message(client->socket, errorMsg);
+            StringBuffer_free(errorMsg);
+            return CLIENT_OVERSIZED;
+        }
+        char first;
+        ChunkChain_copy(&(client->input), &first, 1);
+        client->oversized = true;
+        // Commands are never streamed
+        client->streaming = (config.msgPolicy == MSG_POLICY_STREAM && first != COMMAND_START);
+        if (!client->streaming) {
+            StringBuffer_concat(errorMsg, "ERROR: Nachricht zu lang! Sie wurde verworfen.");
+            send_message(client->socket, errorMsg);
+        }
+        StringBuffer_free(errorMsg);
+    }
+    // The received part of the message
+    int available = (len < 0 ? client->input.size : len);
+    if (!client->streaming) {
+        // Skip the message until the delimiter, the next message starts behind it
+        consume_input(client, (len < 0 ? available : available + 1));
+        client->oversized = (len < 0);
+        return EXIT_SUCCESS;
+    }
+    // Relay the received part in pieces of the maximal size
+    while (available > 0 || len >= 0) {
+        int piece = (available < config.msgMaxSize ? available : config.msgMaxSize);
+        bool last = (len >= 0 && piece == available);
+        StringBuffer *msg = peek_message(client, piece);
+        if (msg == NULL)
+            return EXIT_FAILURE;
+        long long delay = check_rate_limits(client, msg->buffer, piece, now);
+        if (delay > 0) {
+            StringBuffer_free(msg);
+            if (config.ratePolicy == RATE_POLICY_DISCONNECT)
+                return CLIENT_FLOODING;
+            // Dropping a piece would break the message, so the rest waits
+            pause_client(client, now + delay);
+            return EXIT_SUCCESS;
+        }
+        consume_input(client, (last ? piece + 1 : piece));
+        available -= piece;
+        client->lastMessage = now;
+        top_count(client, TOP_MESSAGES, 1);
+        top_count(client, TOP_BYTES, piece + 1);
+        stream_message(client, msg, last);
+        StringBuffer_free(msg);
+        if (last) {
+            client->oversized = false;
+            client->streaming = false;
+            break;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int
+stream_message(Client *client, StringBuffer *piece, bool last) {
+    filter_message(piece->buffer, piece->size);
+    // "[name]+ " marks a piece which is continued by the next one
+    StringBuffer *temp = StringBuffer_construct_n(piece->size);
+    StringBuffer_concat(temp, "[");
+    StringBuffer_concat(temp, client->name);
+    StringBuffer_concat(temp, (last ? "]: " : "]+ "));
+    StringBuffer_concat(temp, piece->buffer);
+    broadcast(temp);
+    top_count(client, TOP_FANOUT, clientList->size);
+    StringBuffer_free(temp);
+    federation_message(client, piece->buffer);
+    return EXIT_SUCCESS;
+}
+
+// ***********************************
+// Methods for rate limiting
+// ***********************************
+
+// Commands with a costly response
+static const char *expensiveCommands[] = {"list", "search", "roster", NULL};
+
+bool
+is_expensive_command(char *msg, int len) {
+    if (len == 0 || msg[0] != COMMAND_START)
+        return false;
+    // Length of the command name
+    char *end = memchr(msg, ' ', len);
+    int syn_len = (end == NULL ? len : end - msg) - 1;
+    int i;
+    for (i = 0; expensiveCommands[i] != NULL; ++i) {
+        if ((int)strlen(expensiveCommands[i]) == syn_len && strncmp(msg + 1, expensiveCommands[i], syn_len) == 0)
+            return true;
+    }
+    return false;
+}
+
+long long
+check_rate_limits(Client *client, char *msg, int len, long long now) {
+    bool expensive = is_expensive_command(msg, len);
+    // The message must pass all buckets
+    long long delay = TokenBucket_delay(&(client->msgBucket), 1, now);
+    long long temp = TokenBucket_delay(&(client->byteBucket), len + 1, now);
+    if (temp > delay)
+        delay = temp;
+    if (expensive) {
+        temp = TokenBucket_delay(&(client->commandBucket), 1, now);
+        if (temp > delay)
+            delay = temp;
+    }
+    // Heavy hitters may only send one message per second
+    if (config.topThrottle > 0 && top_estimate(client, TOP_MESSAGES) > (unsigned long)config.topThrottle) {
+        temp = client->lastMessage + 1000 - now;
+        if (temp > delay)
+            delay = temp;
+    }
+    if (delay > 0)
+        return delay;
+
+    TokenBucket_consume(&(client->msgBucket), 1);
+    TokenBucket_consume(&(client->byteBucket), len + 1);
+    if (expensive)
+        TokenBucket_consume(&(client->commandBucket), 1);
+    return 0;
+}
+
+void
+set_reading(Client *client, bool reading) {
+    // Clients in the ready list don't read until their buffer is handled
+    if (client->pollIndex >= 0) {
+        short events = pollList->elements[client->pollIndex].events & POLLOUT;
+        if (reading && !client->ready && !client->backlogged && !client->shed)
+            events |= POLLIN;
+        pollList->elements[client->pollIndex].events = events;
+    }
+    // The I/O thread of the client stops reading instead
+    else if (pipelineEvent >= 0) {
+        client->reading = reading;
+        throttle_input(client);
+    }
+}
+
+void
+throttle_input(Client *client) {
+    bool paused = !client->reading || client->ready || client->backlogged || client->shed;
+    // I/O threads read ahead of the dispatcher, so the buffered input is
+    // limited too. Unlimited messages are never complete in a full buffer.
+    if (config.msgMaxSize > 0) {
+        int highWater = (INPUT_HIGH_WATER > 4 * config.msgMaxSize ? INPUT_HIGH_WATER : 4 * config.msgMaxSize);
+        // Continued below the half only, so each resume reads a good part
+        if (client->input.size > (client->inputPaused ? highWater / 2 : highWater))
+            paused = true;
+    }
+    if (paused == client->inputPaused)
+        return;
+    client->inputPaused = paused;
+    if (paused)
+        Pipeline_pause(client->socket, client->id);
+    else
+        Pipeline_resume(client->socket, client->id);
+}
+
+void
+set_writing(Client *client, bool writing) {
+    if (client->pollIndex >= 0) {
+        short events = pollList->elements[client->pollIndex].events & ~POLLOUT;
+        if (writing)
+            events |= POLLOUT;
+        pollList->elements[client->pollIndex].events = events;
+    }
+}
+
+void
+pause_client(Client *client, long long resumeAt) {
+    // Stop polling for input, the unread input stays in the socket
+    set_reading(client, false);
+    TimerWheel_add(&timers, &(client->resumeTimer), resumeAt);
+}
+
+void
+resume_client(Timer *timer, void *data) {
+    (void)timer;
+    Client *client = data;
+    if (!client->jobPending)
+        set_reading(client, true);
+    // Handle the messages which are still in the buffer
+    if (dispatch_messages(client) != EXIT_SUCCESS) {
+        LOG(LOG_CLIENT, LOG_WARN, "Client is flooding", client->socket, NULL);
+        remove_client(client->socket);
+    }
+}
+
+// ***********************************
+// Methods for fair scheduling
+// ***********************************
+
+void
+ready_client(Client *client) {
+    if (client->ready)
+        return;
+    client->ready = true;
+    client->readyRound = readyRound;
+    client->readyPrev = readyTail;
+    client->readyNext = NULL;
+    if (readyTail == NULL)
+        readyHead = client;
+    else
+        readyTail->readyNext = client;
+    readyTail = client;
+    set_reading(client, false);
+}
+
+void
+unready_client(Client *client) {
+    if (!client->ready)
+        return;
+    if (client->readyPrev == NULL)
+        readyHead = client->readyNext;
+    else
+        client->readyPrev->readyNext = client->readyNext;
+    if (client->readyNext == NULL)
+        readyTail = client->readyPrev;
+    else
+        client->readyNext->readyPrev = client->readyPrev;
+    client->ready = false;
+    client->readyPrev = NULL;
+    client->readyNext = NULL;
+}
+
+void
+serve_ready_clients(void) {
+    // One turn for every client which was waiting at the start of the round,
+    // clients using up their budget again are appended for the next round.
+    // The round ends at the first of them, removed clients don't matter.
+    unsigned int round = ++readyRound;
+    while (readyHead != NULL && readyHead->readyRound != round) {
+        Client *client = readyHead;
+        unready_client(client);
+        // Paused clients are continued by their timer or their job
+        if (!client->jobPending && !client->resumeTimer.active) {
+            set_reading(client, true);
+            if (dispatch_messages(client) != EXIT_SUCCESS) {
+                LOG(LOG_CLIENT, LOG_WARN, "Client is flooding", client->socket, NULL);
+                remove_client(client->socket);
+            }
+        }
+    }
+}
+
+// ***********************************
+// Methods for file transfers
+// ***********************************
+
+bool
+is_sending(Client *client) {
+    return client->transfer != NULL && client->transfer->sender == client->socket;
+}
+
+// Polls the sockets the transfer waits for
+static void
+update_transfer(Transfer *transfer) {
+    if (transfer->sender >= 0)
+        set_reading(search_client(transfer->sender), Transfer_wantsInput(transfer));
+    if (transfer->receiver >= 0)
+        set_writing(search_client(transfer->receiver), transfer->queued || Transfer_wantsOutput(transfer));
+}
+
+int
+start_transfer(Client *sender, Client *receiver, long long size) {
+    Transfer *transfer = Transfer_construct(sender, receiver, size, config.transferMode == TRANSFER_MODE_SPLICE);
+    if (transfer == NULL)
+        return EXIT_FAILURE;
+    // The announcement waits until the receiver took the queued messages,
+    // newer messages are held until the file is sent
+    char line[64];
+    StringBuffer *msg = StringBuffer_construct();
+    StringBuffer_concat(msg, "FILE: [");
+    StringBuffer_concat(msg, sender->name);
+    snprintf(line, sizeof(line), "] %lld\n", size);
+    StringBuffer_concat(msg, line);
+    int res = ChunkChain_append(&(transfer->head), msg->buffer, msg->size);
+    StringBuffer_clear(msg);
+    // The beginning of the file was read together with the command
+    char buffer[CHUNK_SIZE];
+    while (res == EXIT_SUCCESS && transfer->remaining > 0 && sender->input.size > 0) {
+        int len = (sender->input.size < CHUNK_SIZE ? sender->input.size : CHUNK_SIZE);
+        if (len > transfer->remaining)
+            len = transfer->remaining;
+        ChunkChain_copy(&(sender->input), buffer, len);
+        res = ChunkChain_append(&(transfer->head), buffer, len);
+        consume_input(sender, len);
+        transfer->remaining -= len;
+    }
+    if (res == EXIT_FAILURE) {
+        StringBuffer_free(msg);
+        Transfer_free(transfer);
+        return EXIT_FAILURE;
+    }
+    transfer->queued = true;
+
+    sender->transfer = transfer;
+    receiver->transfer = transfer;
+    ++transferCount;
+    LOG(LOG_TRANSFER, LOG_INFO, "Transfer started", sender->socket, receiver->name);
+
+    snprintf(line, sizeof(line), "INFO: Sende %lld Bytes an '", size);
+    StringBuffer_concat(msg, line);
+    StringBuffer_concat(msg, receiver->name);
+    StringBuffer_concat(msg, "'.");
+    send_message(sender->socket, msg);
+    StringBuffer_free(msg);
+
+    if (Transfer_isDone(transfer))
+        finish_transfer(transfer);
+    else
+        update_transfer(transfer);
+    return EXIT_SUCCESS;
+}
+
+// Moves the announcement and the beginning of the file to the empty outbox
+// of the receiver, the stage follows once they are sent
+static int
+queue_transfer(Client *receiver, Transfer *transfer) {
+    char buffer[CHUNK_SIZE];
+    while (transfer->head.size > 0) {
+        int len = (transfer->head.size < CHUNK_SIZE ? transfer->head.size : CHUNK_SIZE);
+        ChunkChain_copy(&(transfer->head), buffer, len);
+        if (Outbox_pushPartial(&(receiver->outbox), buffer, len) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+        ChunkChain_consume(&(transfer->head), len);
+    }
+    return EXIT_SUCCESS;
+}
+
+int
+pump_transfer(Transfer *transfer, bool fromSender) {
+    if (transfer == NULL)
+        return EXIT_SUCCESS;
+    int res = Transfer_pump(transfer, fromSender, TRANSFER_TURN);
+    if (res == TRANSFER_DONE) {
+        finish_transfer(transfer);
+        return EXIT_SUCCESS;
+    }
+    // The socket of the event is closed
+    if (res == TRANSFER_SENDER_CLOSED || (res == TRANSFER_RECEIVER_CLOSED && !fromSender))
+        return CLIENT_DISCONNECTED;
+    // Receiver is removed by its own event, the sender continues into the void
+    if (res == TRANSFER_RECEIVER_CLOSED)
+        leave_transfer(search_client(transfer->receiver));
+    else
+        update_transfer(transfer);
+    return EXIT_SUCCESS;
+}
+
+void
+finish_transfer(Transfer *transfer) {
+    Client *sender = (transfer->sender >= 0 ? search_client(transfer->sender) : NULL);
+    Client *receiver = (transfer->receiver >= 0 ? search_client(transfer->receiver) : NULL);
+    if (sender != NULL && receiver != NULL)
+        LOG(LOG_TRANSFER, LOG_INFO, "Transfer finished", sender->socket, receiver->name);
+    else
+        LOG(LOG_TRANSFER, LOG_WARN, "Transfer aborted", transfer->sender, NULL);
+    StringBuffer *msg = StringBuffer_construct();
+    if (receiver != NULL) {
+        receiver->transfer = NULL;
+        // The notice and the messages which arrived meanwhile follow the
+        // file directly, before anything queued later
+        Outbox *box = &(receiver->outbox);
+        if (sender == NULL) {
+            StringBuffer_concat(msg, "ERROR: Die Uebertragung wurde abgebrochen! Der Rest der Datei besteht aus Nullbytes.\n");
+            Outbox_pushPartial(box, msg->buffer, msg->size);
+            StringBuffer_clear(msg);
+        }
+        char buffer[CHUNK_SIZE];
+        while (receiver->held.size > 0) {
+            int len = (receiver->held.size < CHUNK_SIZE ? receiver->held.size : CHUNK_SIZE);
+            ChunkChain_copy(&(receiver->held), buffer, len);
+            ChunkChain_consume(&(receiver->held), len);
+            Outbox_pushPartial(box, buffer, len);
+        }
+        // A backlogged receiver continues its input with the next POLLOUT
+        set_writing(receiver, box->size > 0 || receiver->backlogged);
+    }
+    if (sender != NULL) {
+        sender->transfer = NULL;
+        if (receiver == NULL) {
+            StringBuffer_concat(msg, "ERROR: Der Empfaenger hat die Datei nicht vollstaendig erhalten!");
+        }
+        else {
+            char line[96];
+            long long time = currentTimeMillis() - transfer->start;
+            snprintf(line, sizeof(line), "INFO: %lld Bytes in %lld ms gesendet.", transfer->size, time);
+            StringBuffer_concat(msg, line);
+        }
+        send_message(sender->socket, msg);
+        // Continue with the messages following the file
+        set_reading(sender, true);
+        ready_client(sender);
+    }
+    StringBuffer_free(msg);
+    Transfer_free(transfer);
+    --transferCount;
+}
+
+void
+leave_transfer(Client *client) {
+    Transfer *transfer = client->transfer;
+    if (transfer == NULL)
+        return;
+    client->transfer = NULL;
+    ChunkChain_clear(&(client->held));
+    if (transfer->sender == client->socket) {
+        Transfer_senderLeft(transfer);
+    }
+    else {
+        set_writing(client, false);
+        Transfer_receiverLeft(transfer);
+    }
+    if (Transfer_isDone(transfer))
+        finish_transfer(transfer);
+    else
+        update_transfer(transfer);
+}
+
+// Sends the data, queues it in its lane when the socket is full or holds
+// it while the client receives a file
+static int
+deliver(Client *client, char *data, int len, int lane) {
+    if (client->transfer != NULL && client->transfer->receiver == client->socket) {
+        if (client->held.size + len > TRANSFER_MAX_HELD)
+            return EXIT_FAILURE;
+        return ChunkChain_append(&(client->held), data, len);
+    }
+    Outbox *box = &(client->outbox);
+    // Nothing waits, so the message doesn't have to pass any other
+    if (box->size == 0) {
+        struct iovec iov = {data, len};
+        int sent = transport->writev(client->socket, &iov, 1);
+        if (sent == len)
+            return EXIT_SUCCESS;
+        if (sent < 0) {
+            // The broken connection is noticed by poll
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return EXIT_FAILURE;
+        }
+        else {
+            set_writing(client, true);
+            return Outbox_pushPartial(box, data + sent, len - sent);
+        }
+    }
+    if (over_budget(lane))
+        return EXIT_FAILURE;
+    int limit = config.outLimit[lane];
+    if (limit > 0 && Outbox_laneSize(box, lane) + len > limit) {
+        switch (config.outPolicy[lane]) {
+            case OUT_POLICY_DROP_OLD:
+                while (Outbox_laneSize(box, lane) + len > limit && Outbox_drop(box, lane) > 0)
+                    ;
+                if (Outbox_laneSize(box, lane) + len <= limit)
+                    break;
+                // The message alone is too long for the lane
+                return EXIT_FAILURE;
+            case OUT_POLICY_DISCONNECT:
+                // Removed by the next poll, the client lists are iterated now
+                LOG(LOG_CLIENT, LOG_WARN, "Client doesn't read its messages", client->socket, NULL);
+                transport->shutdown(client->socket);
+                return EXIT_FAILURE;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    set_writing(client, true);
+    return Outbox_push(box, lane, data, len);
+}
+
+int
+flush_client(Client *client) {
+    int res = Outbox_send(&(client->outbox), client->socket);
+    if (res == OUTBOX_ERROR)
+        return EXIT_FAILURE;
+    Transfer *transfer = client->transfer;
+    if (res == OUTBOX_EMPTY && (transfer == NULL || transfer->receiver != client->socket)) {
+        set_writing(client, false);
+    }
+    // The messages before the file are sent, the file follows
+    else if (res == OUTBOX_EMPTY && transfer->queued) {
+        if (transfer->head.size > 0)
+            return queue_transfer(client, transfer);
+        transfer->queued = false;
+        if (Transfer_isDone(transfer))
+            finish_transfer(transfer);
+        else
+            update_transfer(transfer);
+    }
+    // Continue the input which waited for the answers
+    if (client->backlogged && client->outbox.size <= CLIENT_BACKLOG / 2) {
+        client->backlogged = false;
+        if (!client->jobPending && !client->resumeTimer.active)
+            set_reading(client, true);
+        return dispatch_messages(client);
+    }
+    return EXIT_SUCCESS;
+}
+
+void
+number_client(Client *client) {
+    // The I/O threads have to know it for the broadcasts they fan out
+    if (pipelineEvent >= 0)
+        Pipeline_number(client->socket, client->id);
+}
+
+// ***********************************
+// Methods for the simulation
+// ***********************************
+
+int
+simulation_init(void) {
+    // The clients are fed by the simulation, nothing listens
+    transport = &memoryTransport;
+    listenerList = socketVector_construct(2);
+    if (listenerList == NULL || init_state() == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    return initPoll();
+}
+
+void
+simulation_step(void) {
+    // Same order as in an iteration of the server loop
+    serve_ready_clients();
+    TimerWheel_advance(&timers, currentTimeMillis());
+}
+
+short
+watched_events(int socket) {
+    int index = poll_index(socket);
+    return (index < 0 ? 0 : pollList->elements[index].events);
+}
+
+// ***********************************
+// Methods for the workers
+// ***********************************
+
+int
+run_job(Client *client, JobFunction run, StringBuffer *command) {
+    char *args = (command == NULL ? NULL : command->buffer);
+    RosterSnapshot *snapshot = roster_snapshot();
+    if (snapshot == NULL)
+        return EXIT_FAILURE;
+    // Without workers the server loop computes the response itself
+    if (workerEvent < 0) {
+        bool cached;
+        StringBuffer *msg = run(snapshot, args, &cached);
+        send_message_lane(client->socket, msg, LANE_BULK);
+        if (!cached)
+            StringBuffer_free(msg);
+        roster_release(snapshot);
+        return EXIT_SUCCESS;
+    }
+    if (WorkerPool_submit(client->socket, client->id, run, args, snapshot) == EXIT_FAILURE) {
+        roster_release(snapshot);
+        return EXIT_FAILURE;
+    }
+    // Stop reading until the result is sent
+    client->jobPending = true;
+    set_reading(client, false);
+    return EXIT_SUCCESS;
+}
+
+void
+complete_jobs(void) {
+    Job *job = WorkerPool_completed();
+    while (job != NULL) {
+        Job *next = job->next;
+        Client *client = search_client(job->socket);
+        // Client is still connected
+        if (client != NULL && client->id == job->clientId) {
+            send_message_lane(client->socket, job->result, LANE_BULK);
+            client->jobPending = false;
+            // A paused client is continued by its timer
+            if (!client->resumeTimer.active)
+                set_reading(client, true);
+            // Handle the messages which waited for the result
+            if (dispatch_messages(client) != EXIT_SUCCESS) {
+                LOG(LOG_CLIENT, LOG_WARN, "Client is flooding", client->socket, NULL);
+                remove_client(client->socket);
+            }
+        }
+        Job_free(job);
+        job = next;
+    }
+}
+
+// ***********************************
+// Methods for the I/O threads
+// ***********************************
+
+void
+receive_pipeline(void) {
+    Pipeline_acknowledge();
+    RingEntry entry;
+    while (Pipeline_receive(&entry)) {
+        Client *client = search_client(entry.socket);
+        // Entry of a client which is already removed
+        if (client == NULL || client->id != entry.clientId) {
+            free(entry.data);
+            continue;
+        }
+        if (entry.type == RING_CLOSED) {
+            // The server loop reads the end only after the waiting messages,
+            // so they are handled here too
+            if (client->jobPending || client->resumeTimer.active || client->ready) {
+                client->hungUp = true;
+                ++hungUpClients;
+                continue;
+            }
+            LOG(LOG_CLIENT, LOG_INFO, "Client disconnected", entry.socket, NULL);
+            remove_client(entry.socket);
+            continue;
+        }
+        int res = ChunkChain_append(&(client->input), entry.data, entry.len);
+        free(entry.data);
+        if (res == EXIT_FAILURE) {
+            LOG(LOG_CLIENT, LOG_ERROR, "Client crashed", entry.socket, NULL);
+            remove_client(entry.socket);
+            continue;
+        }
+        client->lastActivity = currentTimeMillis();
+        // Entries read before the pause arrive until the thread handles it
+        throttle_input(client);
+        // Paused and waiting clients continue with the buffered messages later
+        if (client->jobPending || client->resumeTimer.active || client->ready)
+            continue;
+        if (dispatch_messages(client) != EXIT_SUCCESS) {
+            LOG(LOG_CLIENT, LOG_WARN, "Client is flooding", entry.socket, NULL);
+            remove_client(entry.socket);
+        }
+    }
+}
+
+void
+remove_hung_up(void) {
+    int i;
+    for (i = 0; i < clientList->size && hungUpClients > 0; ++i) {
+        Client *client = clientList->elements[i];
+        if (!client->hungUp || client->jobPending || client->resumeTimer.active || client->ready)
+            continue;
+        LOG(LOG_CLIENT, LOG_INFO, "Client disconnected", client->socket, NULL);
+        remove_client(client->socket);
+        // The last client takes the place
+        --i;
+    }
+}
+
+// ***********************************
+// Methods for timers
+// ***********************************
+
+void
+keepalive_client(Timer *timer, void *data) {
+    Client *client = data;
+    long long now = currentTimeMillis();
+    // Ping was not answered
+    if (client->pingSentAt != 0 && client->lastActivity < client->pingSentAt) {
+        LOG(LOG_CLIENT, LOG_INFO, "Client timed out", client->socket, NULL);
+        remove_client(client->socket);
+        return;
+    }
+    client->pingSentAt = 0;
+    // Client was active since the last check
+    if (now - client->lastActivity < config.pingInterval * 1000LL) {
+        TimerWheel_add(&timers, timer, client->lastActivity + config.pingInterval * 1000LL);
+        return;
+    }
+    StringBuffer *msg = StringBuffer_construct();
+    StringBuffer_concat(msg, "/ping");
+    send_message(client->socket, msg);
+    StringBuffer_free(msg);
+    client->pingSentAt = now;
+    TimerWheel_add(&timers, timer, now + config.pingTimeout * 1000LL);
+}
+
+void
+idle_client(Timer *timer, void *data) {
+    Client *client = data;
+    long long now = currentTimeMillis();
+    // Client sent a message since the last check
+    if (now - client->lastMessage < config.idleTimeout * 1000LL) {
+        TimerWheel_add(&timers, timer, client->lastMessage + config.idleTimeout * 1000LL);
+        return;
+    }
+    StringBuffer *msg = StringBuffer_construct();
+    StringBuffer_concat(msg, "ERROR: Die Verbindung wurde wegen Inaktivitaet getrennt!");
+    send_message(client->socket, msg);
+    StringBuffer_free(msg);
+    LOG(LOG_CLIENT, LOG_INFO, "Client was idle", client->socket, NULL);
+    remove_client(client->socket);
+}
 
-    return EXIT_SUCCESS;
+// A task executed later by the timer wheel
+typedef struct Task {
+    Timer timer;
+    void (*run)(void *data);
+    void *data;
+} Task;
+
+static void
+run_task(Timer *timer, void *data) {
+    (void)timer;
+    Task *task = data;
+    task->run(task->data);
+    free(task);
 }
 
 int
-initPoll() {
-    // init list for poll structs
-    pollList = pollVector_construct(1);
-    if (pollList == NULL) {
+defer_task(long long delay, void (*run)(void *data), void *data) {
+    Task *task = malloc(sizeof(Task));
+    if (task == NULL) {
+        perror("Insufficent memory!");
         return EXIT_FAILURE;
     }
-    // add pollstruct to list
-    struct pollfd serverPollfd;
-    serverPollfd.fd = serverSocket;
-    serverPollfd.events = POLLIN;    
-    pollVector_add(pollList, serverPollfd);
-    
+    task->run = run;
+    task->data = data;
+    Timer_init(&(task->timer), &run_task, task);
+    TimerWheel_add(&timers, &(task->timer), currentTimeMillis() + delay);
     return EXIT_SUCCESS;
 }
 
-void stopServer(void) {
+// ***********************************
+// Methods for the memory budget
+// ***********************************
 
-    puts("Stopping server...");
-    puts("Close socket...");
-    close(serverSocket);
+void
+count_recent(Client *client, int bytes) {
+    if (client->budgetCheck != budgetCheck) {
+        client->budgetCheck = budgetCheck;
+        client->recentBytes = 0;
+    }
+    client->recentBytes += bytes;
 }
 
-// *******************************************
-// Methods called when the server is running
-// *******************************************
-
-#define INFINITE_TIMEOUT -1
-
-#define CLIENT_DISCONNECTED -2 
-
 void
-serverLoop(void) {
+check_budget(Timer *timer, void *data) {
+    (void)data;
+    long total = budget_total();
+    int stage = budget_stage(total);
+    if (stage != checkedStage)
+        LOG(LOG_SERVER, (stage > checkedStage ? LOG_WARN : LOG_INFO), "Memory budget stage changed", -1, budget_stageName(stage));
+    // Bulk messages which already wait are dropped once
+    if (stage >= BUDGET_SHED && checkedStage < BUDGET_SHED)
+        drop_bulk();
+    checkedStage = stage;
+    memoryStage = stage;
+
+    if (stage >= BUDGET_PAUSE)
+        pause_senders();
+    else if (shedClients > 0)
+        resume_senders();
+    if (stage == BUDGET_KILL)
+        disconnect_biggest();
+
+    ++budgetCheck;
+    TimerWheel_add(&timers, timer, currentTimeMillis() + BUDGET_INTERVAL);
+}
 
-    while (true) {
-        // res stores the numbers of file descriptors throwed an event
-        int res = poll(pollList->elements, pollList->size, INFINITE_TIMEOUT);
-        // Poll returns without any events
-        if (res == 0) {
+void
+pause_senders(void) {
+    // The heaviest senders since the last check, sorted by insertion
+    Client *heaviest[BUDGET_VICTIMS];
+    int found = 0;
+    int i, j;
+    for (i = 0; i < clientList->size; ++i) {
+        Client *client = clientList->elements[i];
+        if (client->shed || client->budgetCheck != budgetCheck || client->recentBytes == 0)
             continue;
+        for (j = found; j > 0 && heaviest[j - 1]->recentBytes < client->recentBytes; --j) {
+            if (j < BUDGET_VICTIMS)
+                heaviest[j] = heaviest[j - 1];
         }
-        if (res < 0) {
-            perror("poll failed!");
-            break;
-        }
-        int i;
-        struct pollfd *pollfd = NULL;
-        for (i = 0 ; i < pollList->size; ++i) {
-            pollfd = pollVector_get(pollList, i);
-            // This fd didn't fired an event
-            if (pollfd->revents == 0) {
-                continue;
-            }
-            // The fd want to send something
-            if ((pollfd->revents & POLLIN) == POLLIN) {
-                // New client want to connect
-                if (pollfd->fd == serverSocket) {
-                    // try to accept new client
-                    if (accept_newClient() == EXIT_FAILURE) {
-                        return;
-                    }
-                }
-                // Connected client want to send something
-                else {
-                    // Read it's input and handle it
-                    int cRes = handle_client(pollfd->fd);
-                    // sconnected
-                    if (cRes == CLIENT_DISCONNECTED) {
-                        printf("Client %d disconnected\n", pollfd->fd);
-                        remove_client(pollfd->fd);
-                        --i;
-                    }
-                    // An error occurred
-                    else if (cRes == EXIT_FAILURE) {
-                        printf("Client %d crashed!\n", pollfd->fd);
-                        remove_client(pollfd->fd);
-                        --i;
-                    }
-                    else {
-                        // Do Nothing
-                    }
-                }
-            }
-            // Unregistered poll event was thrown
-            else {
-                fprintf(stderr, "Unkown poll event %d! Server is stopping\n", pollfd->revents);
-                return;
-            }
+        if (j < BUDGET_VICTIMS) {
+            heaviest[j] = client;
+            if (found < BUDGET_VICTIMS)
+                ++found;
         }
     }
+    for (i = 0; i < found; ++i) {
+        LOG(LOG_CLIENT, LOG_WARN, "Client paused for the memory budget", heaviest[i]->socket, NULL);
+        heaviest[i]->shed = true;
+        set_reading(heaviest[i], false);
+        ++shedClients;
+    }
 }
 
-int
-accept_newClient() {
-
-    // Accept new clients in the connection queue
-    struct sockaddr_in conInfo;
-    socklen_t conInfo_len = sizeof(struct sockaddr_in);
-
-    // Get one single client from the queue
-    int clientSocket = accept(serverSocket, (struct sockaddr*)(&conInfo), &conInfo_len);
-    if (clientSocket < 0) {
-        perror("accept failed!");
-        return EXIT_FAILURE;
+void
+resume_senders(void) {
+    int i;
+    for (i = 0; i < clientList->size; ++i) {
+        Client *client = clientList->elements[i];
+        if (!client->shed)
+            continue;
+        client->shed = false;
+        if (!client->jobPending && !client->resumeTimer.active)
+            set_reading(client, true);
     }
-
-    // Add client to pollList
-    struct pollfd pollfd;
-    pollfd.fd = clientSocket;
-    pollfd.events = POLLIN;
-    pollVector_add(pollList, pollfd);
-    
-    // Add client to clientList
-    // Convert client address to readable IP4 formatted string
-    // This is the standard name of all new users
-    char *ip = inet_ntoa(conInfo.sin_addr);
-    Client *client = Client_construct(clientSocket, ip);
-    clientVector_add(clientList, *client);
-    
-    StringBuffer *msg = StringBuffer_construct();
-    StringBuffer_concat(msg, client->name);
-    StringBuffer_concat(msg, " ist online");
-    broadcast(msg);
-    StringBuffer_free(msg);
-    
-    printf("Client %s connected\n", ip);
-    return EXIT_SUCCESS;
+    shedClients = 0;
 }
 
-int equals_pollfd(struct pollfd *fd1, struct pollfd *fd2) {
-    return (fd1->fd == fd2->fd ? 0 : -1);
+bool
+over_budget(int lane) {
+    if (config.memBudget == 0)
+        return false;
+    int stage = budget_stage(budget_total());
+    if (stage > memoryStage)
+        memoryStage = stage;
+    // Lists and roster updates don't wait while the memory is short
+    if (lane == LANE_BULK && memoryStage >= BUDGET_SHED)
+        return true;
+    // Nothing but replies is queued above the budget, the check
+    // disconnects the biggest clients
+    return (lane != LANE_CONTROL && memoryStage == BUDGET_KILL);
 }
 
-int
-remove_client(int socket) {
-
-    // Close the socket
-    close(socket);
-    
-    // Remove registered socket from poll list
-    struct pollfd tempPollfd;
-    tempPollfd.fd = socket;
-    pollVector_remove(pollList, &tempPollfd, &equals_pollfd);
-    
-    // Remove registered Client from client list
-    Client tempClient;
-    tempClient.socket = socket;
+void
+drop_bulk(void) {
     int i;
-    for (i = 0 ; i < clientList->size; ++i) {
-        if (equals_Client_Socket(&tempClient, clientVector_get(clientList, i)) == 0) {
-            clientVector_removeAt(clientList,i , &tempClient);
-            break;
-        }
+    for (i = 0; i < clientList->size; ++i) {
+        Outbox *box = &(clientList->elements[i]->outbox);
+        while (Outbox_drop(box, LANE_BULK) > 0)
+            ;
     }
-    StringBuffer *msg = StringBuffer_construct();
-    StringBuffer_concat(msg, tempClient.name);
-    StringBuffer_concat(msg, " ist offline.");
-    broadcast(msg);    
-    Client_free(&tempClient);
-    StringBuffer_free(msg);
-    return EXIT_SUCCESS;
 }
 
-#define MSG_DELIMITER '\n'
-
-int
-handle_client(int socket) {
-
-    // Get the client registered to the socket
-    Client *client = search_client(socket);
-    if (client == NULL) {
-        perror("Unregistered client socket found! This is not in the list!");
-        return EXIT_FAILURE;
-    }
-    // Read the complete input of the client
-    int res = read_from_client(client);
-    if (res != EXIT_SUCCESS)
-        return res;
-        
-    // Try to extract a single message from the buffer
-    StringBuffer *msg = extract_message(client);
-    if (msg == NULL) {
-        return EXIT_SUCCESS;
-    }
-    if (is_command(client, msg) == EXIT_SUCCESS) {
-        handle_command(client, msg);
-    }
-    else {
-        broadcast_message(client, msg);
+void
+disconnect_biggest(void) {
+    int victims;
+    for (victims = 0; victims < BUDGET_VICTIMS; ++victims) {
+        if (budget_stage(budget_total()) < BUDGET_SHED)
+            return;
+        Client *biggest = NULL;
+        long biggestSize = 0;
+        int i;
+        for (i = 0; i < clientList->size; ++i) {
+            long size = budget_client(clientList->elements[i]);
+            if (size > biggestSize) {
+                biggest = clientList->elements[i];
+                biggestSize = size;
+            }
+        }
+        // Only the buffers of the clients are freed
+        if (biggest == NULL || biggestSize <= (long)sizeof(Client))
+            return;
+        LOG(LOG_CLIENT, LOG_WARN, "Client disconnected for the memory budget", biggest->socket, biggest->name);
+        remove_client(biggest->socket);
     }
-    
-    StringBuffer_free(msg);
-    return EXIT_SUCCESS;
 }
 
-// ***********************************
-// Methods for client input handeling
-// ***********************************
+int
+next_message_length(Client *client) {
+    // If MSG_DELIMITER is part of the input, the client has sendet a complete message
+    return ChunkChain_find(&(client->input), MSG_DELIMITER);
+}
 
 StringBuffer
-*extract_message(Client *client) {
-    // If MSG_DELIMITER is part of the string, the client has sendet a complete message
-    char *subString = strchr(client->buffer->buffer, MSG_DELIMITER);
-    if (subString == NULL) {
+*peek_message(Client *client, int len) {
+    // Copy message to temponary buffer, the message stays in the input
+    StringBuffer *msg = StringBuffer_construct_n(len);
+    if (msg == NULL) {
         return NULL;
     }
-    // Extract single message from buffer
-    // Calculate the length of the message
-    int len = subString - client->buffer->buffer;
-    // Copy mesage to temponary buffer
-    StringBuffer *msg = StringBuffer_construct_n(len);
-    StringBuffer_concat_n(msg, client->buffer->buffer, len);
-    
-    // Delete the leading \n
-    subString = subString + 1;
-    // Regorganize buffer by moving the rest of the buffer without the message to the beginning of the buffer
-    memmove(client->buffer->buffer, subString, client->buffer->size - (len + 1));
-    client->buffer->size = client->buffer->size - (len + 1);
-    client->buffer->buffer[client->buffer->size] = '\0';
+    ChunkChain_copy(&(client->input), msg->buffer, len);
+    msg->size = len;
+    msg->buffer[len] = '\0';
     return msg;
 }
 
+void
+consume_message(Client *client, int len) {
+    // Remove the message and its delimiter, empty chunks go back to the pool
+    consume_input(client, len + 1);
+}
+
+void
+consume_input(Client *client, int len) {
+    ChunkChain_consume(&(client->input), len);
+    // Its I/O thread continues once the buffer is drained
+    if (client->inputPaused)
+        throttle_input(client);
+}
+
+int
+client_count(void) {
+    return clientList->size;
+}
+
+Client
+*client_at(int index) {
+    return clientList->elements[index];
+}
+
 Client
 *search_client(int socket) {
-    Client *client = NULL;    
+    if (socket < 0 || socket >= clientTableSize)
+        return NULL;
+    return clientTable[socket];
+}
+
+Client
+*search_client_by_name(char *name) {
+    Client temp;
+    temp.name = name;
     int i;
     for (i = 0 ; i < clientList->size; ++i) {
-        if (clientList->elements[i].socket == socket) {
-            client = &(clientList->elements[i]);
-            break;
+        if (equals_Client_Name(&temp, clientList->elements[i]) == 0) {
+            return clientList->elements[i];
         }
     }
-    return client;
+    return NULL;
 }
 
 #define IN_BUFFER_SIZE 4096
-static char inBuffer[IN_BUFFER_SIZE + 1] = {0};
 
 int
 read_from_client(Client *client) {
-    int bytes_read = read(client->socket, inBuffer, IN_BUFFER_SIZE);
+    // Read directly into chunks of the shared pool
+    int bytes_read = ChunkChain_read(&(client->input), client->socket, IN_BUFFER_SIZE);
     if (bytes_read == 0) {
         return CLIENT_DISCONNECTED;
     }
+    // Socket is non blocking, nothing to read
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return EXIT_SUCCESS;
+    }
     if (bytes_read < 0) {
-        perror("read failed!");
+        LOG_ERRNO(LOG_CLIENT, "read failed", client->socket);
         return EXIT_FAILURE;
     }
-    // Copy received message to the client buffer
-    StringBuffer_concat_n(client->buffer, inBuffer, bytes_read);
+    client->lastActivity = currentTimeMillis();
 
     return EXIT_SUCCESS;
 }
 
 int broadcast_message(Client *client, StringBuffer *msg) {
 
+    // Mask banned words before the message leaves the server
+    filter_message(msg->buffer, msg->size);
+
     // Construct message
     StringBuffer *temp = StringBuffer_construct_n(msg->size);
     StringBuffer_concat(temp, "[");
@@ -412,26 +2254,108 @@ int broadcast_message(Client *client, StringBuffer *msg) {
     
     // Send message to all clients
     broadcast(temp);
+    top_count(client, TOP_FANOUT, clientList->size);
     
     StringBuffer_free(temp);
+    // and to the clients of the other servers
+    federation_message(client, msg->buffer);
     return EXIT_SUCCESS;
 }
 
 int broadcast(StringBuffer *msg) {
+    // Terminate the message only once for all clients
+    StringBuffer_concat_n(msg, "\n", 1);
+    // Clients with a session get the copy with the sequence number
+    char *numbered = NULL;
+    int numberedLength = session_record(msg->buffer, msg->size, &numbered);
+    if (session_clients() == 0)
+        numberedLength = 0;
     // Send message to all clients
+    int res = EXIT_SUCCESS;
     int i;
-    for(i = 0 ; i < clientList->size; ++i) {
-        sendAll(clientVector_get(clientList, i)->socket, msg->buffer, msg->size);
+    if (pipelineEvent >= 0) {
+        // The I/O threads queue every message, so the budget is checked before.
+        // All I/O threads share the same copy.
+        Payload *payload = NULL;
+        Payload *numberedPayload = NULL;
+        if (over_budget(LANE_BROADCAST)
+            || (payload = Payload_construct(msg->buffer, msg->size)) == NULL
+            || (numberedLength > 0 && (numberedPayload = Payload_construct(numbered, numberedLength)) == NULL)) {
+            res = EXIT_FAILURE;
+        }
+        // Big rooms are fanned out by the I/O threads, the loop is free
+        // after one entry per thread
+        else if (config.fanoutMin > 0 && clientList->size >= config.fanoutMin) {
+            Pipeline_broadcast(payload, false);
+            Pipeline_broadcast(numberedPayload != NULL ? numberedPayload : payload, true);
+        }
+        else {
+            for (i = 0 ; i < clientList->size; ++i) {
+                Client *client = clientList->elements[i];
+                Pipeline_send(client->socket, client->id, (client->session != NULL && numberedPayload != NULL ? numberedPayload : payload));
+            }
+        }
+        if (payload != NULL)
+            Payload_release(payload);
+        if (numberedPayload != NULL)
+            Payload_release(numberedPayload);
     }
-    return EXIT_SUCCESS;
+    else {
+        for(i = 0 ; i < clientList->size; ++i) {
+            Client *client = clientList->elements[i];
+            if (client->session != NULL && numberedLength > 0)
+                deliver(client, numbered, numberedLength, LANE_BROADCAST);
+            else
+                deliver(client, msg->buffer, msg->size, LANE_BROADCAST);
+        }
+    }
+    // Remove the delimiter again
+    msg->size = msg->size - 1;
+    msg->buffer[msg->size] = '\0';
+    return res;
 }
 
-#define COMMAND_START '/'
+int send_message(int socket, StringBuffer *msg) {
+    return send_message_lane(socket, msg, LANE_CONTROL);
+}
+
+int send_message_lane(int socket, StringBuffer *msg, int lane) {
+    // Every message is terminated by the MSG_DELIMITER, so the client can split them
+    StringBuffer_concat_n(msg, "\n", 1);
+    int res = EXIT_SUCCESS;
+    Client *client = search_client(socket);
+    // The client is gone, nobody reads the message
+    if (client == NULL) {
+        res = EXIT_FAILURE;
+    }
+    else if (pipelineEvent >= 0) {
+        // The I/O threads queue every message, so the budget is checked before
+        Payload *payload = NULL;
+        if (over_budget(lane) || (payload = Payload_construct(msg->buffer, msg->size)) == NULL)
+            res = EXIT_FAILURE;
+        else {
+            Pipeline_send(socket, client->id, payload);
+            Payload_release(payload);
+        }
+    }
+    else {
+        res = deliver(client, msg->buffer, msg->size, lane);
+    }
+    // Remove the delimiter again
+    msg->size = msg->size - 1;
+    msg->buffer[msg->size] = '\0';
+    return res;
+}
 
 int is_command(Client *client, StringBuffer *msg) {
+    (void)client;
     return msg->buffer[0] == COMMAND_START ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+bool is_command_name(char *syntax, int syn_len, char *name) {
+    return (int)strlen(name) == syn_len && strncmp(syntax, name, syn_len) == 0;
+}
+
 int handle_command(Client *client, StringBuffer *msg) {
 
     // Skip the COMMAND_START
@@ -450,27 +2374,65 @@ int handle_command(Client *client, StringBuffer *msg) {
         StringBuffer_concat(command, args + 1);
     }
     else {
-        syn_len = msg->size;
+        syn_len = msg->size - 1;
     }
     // List command
-    if (strncmp(syntax, "list", syn_len) == 0) {
+    if (is_command_name(syntax, syn_len, "list")) {
         command_list(client, command);   
     }
+    // Search for names
+    else if (is_command_name(syntax, syn_len, "search")) {
+        command_search(client, command);   
+    }
     // Nick command
-    else if (strncmp(syntax, "nick", syn_len) == 0) {
+    else if (is_command_name(syntax, syn_len, "nick")) {
         command_nick(client, command);   
     }
     // Message command
-    else if (strncmp(syntax, "msg", syn_len) == 0) {
+    else if (is_command_name(syntax, syn_len, "msg")) {
         command_msg(client, command);   
     }
+    // Roster synchronisation
+    else if (is_command_name(syntax, syn_len, "roster")) {
+        command_roster(client, command);   
+    }
+    // Relay a file
+    else if (is_command_name(syntax, syn_len, "send")) {
+        command_send(client, command);   
+    }
+    // Addresses with the most traffic
+    else if (is_command_name(syntax, syn_len, "top")) {
+        command_top(client, command);   
+    }
+    // Memory of the server
+    else if (is_command_name(syntax, syn_len, "memory")) {
+        command_memory(client, command);   
+    }
+    // Session surviving a lost connection
+    else if (is_command_name(syntax, syn_len, "session")) {
+        command_session(client, command);
+    }
+    // Continue a session after a reconnect
+    else if (is_command_name(syntax, syn_len, "resume")) {
+        command_resume(client, command);
+    }
+    // Keepalive of the client, answer it
+    else if (is_command_name(syntax, syn_len, "ping")) {
+        StringBuffer *pong = StringBuffer_construct();
+        StringBuffer_concat(pong, "/pong");
+        send_message(client->socket, pong);
+        StringBuffer_free(pong);
+    }
+    // Answer on a keepalive, the input was already registered
+    else if (is_command_name(syntax, syn_len, "pong")) {
+    }
     // Unknown command!
     else {
         StringBuffer *errorMsg = StringBuffer_construct();
         StringBuffer_concat(errorMsg, "ERROR: Unbekannter Befehl '");
         StringBuffer_concat(errorMsg, syntax);
         StringBuffer_concat(errorMsg, "'!");
-        sendAll(client->socket, errorMsg->buffer, errorMsg->size);
+        send_message(client->socket, errorMsg);
         StringBuffer_free(errorMsg);
     }
 
@@ -485,31 +2447,12 @@ int handle_command(Client *client, StringBuffer *msg) {
 // ***********************************
 
 int command_list(Client *client, StringBuffer *command) {
-    StringBuffer *msg = StringBuffer_construct();
-    StringBuffer_concat(msg, "Verbundene Clients(");
-    char temp[15];
-    sprintf(temp, "%d", clientList->size);
-    StringBuffer_concat(msg, temp);
-    StringBuffer_concat(msg, ")\n");
-    int i = 0;
-    // Build message
-    for (i = 0; i < clientList->size - 1; ++i) {
-        StringBuffer_concat(msg, "[");     
-        StringBuffer_concat(msg, clientVector_get(clientList, i)->name);
-        StringBuffer_concat(msg, "]");
-        StringBuffer_concat(msg, ", ");
-    }
-    // Add last one without ,
-    StringBuffer_concat(msg, "[");     
-    StringBuffer_concat(msg, clientVector_get(clientList, i)->name);
-    StringBuffer_concat(msg, "]");
-    
-    // Send message to client
-    sendAll(client->socket, msg->buffer, msg->size);
+    // Pages are built from a snapshot of the roster by a worker
+    return run_job(client, &roster_listPage, command);
+}
 
-    StringBuffer_free(msg);
-    
-    return EXIT_SUCCESS;
+int command_search(Client *client, StringBuffer *command) {
+    return run_job(client, &roster_search, command);
 }
 
 int command_nick(Client *client, StringBuffer *command) {
@@ -518,34 +2461,53 @@ int command_nick(Client *client, StringBuffer *command) {
     // No arguments
     if (command == NULL) {
         StringBuffer_concat(msg, "ERROR: Keinen Nicknamen angegeben!");
-        sendAll(client->socket, msg->buffer, msg->size);
+        send_message(client->socket, msg);
         StringBuffer_free(msg);
         return EXIT_FAILURE;
     }
-    Client temp;
-    temp.name = command->buffer;    
-    // Search for double names
-    if (clientVector_contains(clientList, &temp, &equals_Client_Name) == EXIT_SUCCESS) {
+    // Tabs separate the names in roster changes
+    if (command->size == 0 || strchr(command->buffer, '\t') != NULL) {
+        StringBuffer_concat(msg, "ERROR: Ungueltiger Nickname!");
+        send_message(client->socket, msg);
+        StringBuffer_free(msg);
+        return EXIT_FAILURE;
+    }
+    // Search for double names, on the other servers too
+    // and the names waiting for their resumed session
+    if (search_client_by_name(command->buffer) != NULL || federation_nameTaken(command->buffer) || session_nameReserved(command->buffer)) {
         StringBuffer_concat(msg, "ERROR: Es existiert bereits ein Client namens '");
         StringBuffer_concat(msg, command->buffer);
         StringBuffer_concat(msg, "'!");
-        sendAll(client->socket, msg->buffer, msg->size);
+        send_message(client->socket, msg);
         StringBuffer_free(msg);
         return EXIT_FAILURE;
     }
 
+    StringBuffer_free(msg);
+    rename_client(client, command->buffer);
+    return EXIT_SUCCESS;
+}
+
+void rename_client(Client *client, char *name) {
+
+    StringBuffer *msg = StringBuffer_construct();
     StringBuffer_concat(msg, "INFO: '");
     StringBuffer_concat(msg, client->name);
     StringBuffer_concat(msg, "' nennt sich nun '");
-    StringBuffer_concat(msg, command->buffer);
+    StringBuffer_concat(msg, name);
     StringBuffer_concat(msg, "'.");
 
-    Client_setName(client, command->buffer);    
+    roster_rename(client->name, name);
+    Client_setName(client, name);
+    // The name belongs to the client since now, the earliest claim wins a conflict
+    client->nameClaim = wallTimeMillis();
 
     broadcast(msg);
+    federation_renamed(client);
+    // Whispers which arrived while nobody had the name
+    mailbox_deliver(client);
     
     StringBuffer_free(msg);
-    return EXIT_SUCCESS;
 }
 
 int command_msg(Client *client, StringBuffer *command) {
@@ -554,7 +2516,7 @@ int command_msg(Client *client, StringBuffer *command) {
     if (command == NULL) {
         StringBuffer *errMsg = StringBuffer_construct();
         StringBuffer_concat(errMsg, "ERROR: Keinen Nicknamen angegeben!");
-        sendAll(client->socket, errMsg->buffer, errMsg->size);
+        send_message(client->socket, errMsg);
         StringBuffer_free(errMsg);
         return EXIT_FAILURE;
     }
@@ -563,37 +2525,49 @@ int command_msg(Client *client, StringBuffer *command) {
     if (whisperText == NULL) {
         StringBuffer *errMsg = StringBuffer_construct();
         StringBuffer_concat(errMsg, "Keine Nachricht angegeben!");
-        sendAll(client->socket, errMsg->buffer, errMsg->size);
+        send_message(client->socket, errMsg);
         StringBuffer_free(errMsg);
         return EXIT_FAILURE;
     }
     // Split string at position
     *whisperText = '\0';
     whisperText = whisperText + 1;
+    filter_message(whisperText, strlen(whisperText));
     // Looking for receiver
-    Client temp;
-    temp.name = command->buffer;
-    Client *receiver = NULL;
-    int i = 0;
-    for (i = 0 ; i < clientList->size; ++i) {
-        receiver = clientVector_get(clientList, i);
-        // Check if names are equals
-        if (equals_Client_Name(&temp, receiver) == 0) {
-            break;
+    Client *receiver = search_client_by_name(command->buffer);
+    // Receiver is on another server
+    if (receiver == NULL && federation_whisper(client, command->buffer, whisperText) == EXIT_SUCCESS) {
+        StringBuffer *msg = StringBuffer_construct();
+        StringBuffer_concat(msg, "[me -> ");
+        StringBuffer_concat(msg, command->buffer);
+        StringBuffer_concat(msg, "]: ");
+        StringBuffer_concat(msg, whisperText);
+        send_message(client->socket, msg);
+        StringBuffer_free(msg);
+        return EXIT_SUCCESS;
+    }
+    // Receiver not found, the whisper waits for the nick
+    if (receiver == NULL) {
+        int res = mailbox_store(command->buffer, client->name, whisperText);
+        StringBuffer *msg = StringBuffer_construct();
+        if (res == EXIT_SUCCESS) {
+            StringBuffer_concat(msg, "INFO: '");
+            StringBuffer_concat(msg, command->buffer);
+            StringBuffer_concat(msg, "' ist nicht online, die Nachricht wird zugestellt, sobald sich jemand so nennt.");
+        }
+        else if (res == MAILBOX_FULL) {
+            StringBuffer_concat(msg, "ERROR: Das Postfach von '");
+            StringBuffer_concat(msg, command->buffer);
+            StringBuffer_concat(msg, "' ist voll!");
         }
         else {
-            receiver = NULL;
+            StringBuffer_concat(msg, "ERROR: Client '");
+            StringBuffer_concat(msg, command->buffer);
+            StringBuffer_concat(msg, "' ist nicht online!");
         }
-    }
-    // Receiver not found
-    if (receiver == NULL) {
-        StringBuffer *errMsg = StringBuffer_construct();
-        StringBuffer_concat(errMsg, "ERROR: Client '");
-        StringBuffer_concat(errMsg, command->buffer);
-        StringBuffer_concat(errMsg, "' ist nicht online!");
-        sendAll(client->socket, errMsg->buffer, errMsg->size);
-        StringBuffer_free(errMsg);
-        return EXIT_FAILURE;
+        send_message(client->socket, msg);
+        StringBuffer_free(msg);
+        return (res == EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
     // Build message for caller
@@ -603,7 +2577,7 @@ int command_msg(Client *client, StringBuffer *command) {
     StringBuffer_concat(msg, receiver->name);
     StringBuffer_concat(msg, "]: ");
     StringBuffer_concat(msg, whisperText);
-    sendAll(client->socket, msg->buffer, msg->size);
+    send_message(client->socket, msg);
     StringBuffer_clear(msg);
     
     // Build message for receiver
@@ -612,8 +2586,109 @@ int command_msg(Client *client, StringBuffer *command) {
     StringBuffer_concat(msg, client->name);
     StringBuffer_concat(msg, " -> me]: ");
     StringBuffer_concat(msg, whisperText);
-    sendAll(receiver->socket, msg->buffer, msg->size);
+    send_message_lane(receiver->socket, msg, LANE_DIRECT);
+    StringBuffer_free(msg);
+
+    return EXIT_SUCCESS;
+}
+
+int command_send(Client *client, StringBuffer *command) {
+    StringBuffer *errorMsg = StringBuffer_construct();
+    char *sizeText = (command == NULL ? NULL : strchr(command->buffer, ' '));
+    char *end = NULL;
+    long long size = 0;
+    if (sizeText != NULL) {
+        *sizeText = '\0';
+        size = strtoll(sizeText + 1, &end, 10);
+    }
+    Client *receiver = (sizeText == NULL ? NULL : search_client_by_name(command->buffer));
+    if (pipelineEvent >= 0) {
+        StringBuffer_concat(errorMsg, "ERROR: Dateien koennen mit I/O-Threads nicht gesendet werden!");
+    }
+    else if (sizeText == NULL || *end != '\0' || size <= 0) {
+        StringBuffer_concat(errorMsg, "ERROR: Benutzung: /send Nickname Bytes");
+    }
+    else if (receiver == NULL || receiver == client) {
+        StringBuffer_concat(errorMsg, "ERROR: Client '");
+        StringBuffer_concat(errorMsg, command->buffer);
+        StringBuffer_concat(errorMsg, "' ist nicht online!");
+    }
+    else if (receiver->transfer != NULL) {
+        StringBuffer_concat(errorMsg, "ERROR: Client '");
+        StringBuffer_concat(errorMsg, receiver->name);
+        StringBuffer_concat(errorMsg, "' empfaengt gerade eine andere Datei!");
+    }
+    else if (start_transfer(client, receiver, size) == EXIT_SUCCESS) {
+        StringBuffer_free(errorMsg);
+        return EXIT_SUCCESS;
+    }
+    else {
+        StringBuffer_concat(errorMsg, "ERROR: Die Datei kann nicht gesendet werden!");
+    }
+    send_message(client->socket, errorMsg);
+    StringBuffer_free(errorMsg);
+    return EXIT_FAILURE;
+}
+
+int command_top(Client *client, StringBuffer *command) {
+    StringBuffer *msg;
+    if (!client->admin) {
+        msg = StringBuffer_construct();
+        StringBuffer_concat(msg, "ERROR: Nur Administratoren duerfen '/top' benutzen!");
+    }
+    else {
+        msg = top_report(command == NULL ? NULL : command->buffer);
+    }
+    send_message(client->socket, msg);
     StringBuffer_free(msg);
+    return EXIT_SUCCESS;
+}
 
+int command_memory(Client *client, StringBuffer *command) {
+    (void)command;
+    StringBuffer *msg;
+    if (!client->admin) {
+        msg = StringBuffer_construct();
+        StringBuffer_concat(msg, "ERROR: Nur Administratoren duerfen '/memory' benutzen!");
+    }
+    else {
+        msg = budget_report(clientList->elements, clientList->size, memoryStage);
+    }
+    send_message(client->socket, msg);
+    StringBuffer_free(msg);
     return EXIT_SUCCESS;
 }
+
+int command_roster(Client *client, StringBuffer *command) {
+    // Stop receiving changes
+    if (command != NULL && strcmp(command->buffer, "off") == 0) {
+        roster_unsubscribe(client);
+        return EXIT_SUCCESS;
+    }
+    // Snapshot of the roster followed by all changes
+    return roster_subscribe(client);
+}
+
+int command_session(Client *client, StringBuffer *command) {
+    (void)command;
+    return session_start(client);
+}
+
+int command_resume(Client *client, StringBuffer *command) {
+    // "/resume <token> <sequence number of the last received broadcast>"
+    char *seq = (command == NULL ? NULL : strchr(command->buffer, ' '));
+    char *end = NULL;
+    long long last = 0;
+    if (seq != NULL) {
+        *seq = '\0';
+        last = strtoll(seq + 1, &end, 10);
+    }
+    if (seq == NULL || end == seq + 1 || *end != '\0' || last < 0) {
+        StringBuffer *errMsg = StringBuffer_construct();
+        StringBuffer_concat(errMsg, "ERROR: Syntax ist '/resume Sitzung Nummer'!");
+        send_message(client->socket, errMsg);
+        StringBuffer_free(errMsg);
+        return EXIT_FAILURE;
+    }
+    return session_resume(client, command->buffer, last);
+}
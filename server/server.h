@@ -17,6 +17,7 @@
  */
 
 #include "clientStruct.h"
+#include "workerPool.h"
 
 // Methods only called when server is starting / stopping
 
@@ -24,28 +25,169 @@ int init(int argc, char **args);
 
 int parseArguments(int argc, char **args, char **port);
 
-int initConnection(char *port);
+int initConnection(char *port, char *path);
+
+struct addrinfo;
+int initListener(struct addrinfo *info);
+
+int initUnixListener(char *path);
 
 int initPoll();
 
 void stopServer(void);
 
+// Methods for the hot restart
+
+int handoff_serve(int listener);
+
+int take_over(char *path);
+
+// Methods for a simulation with the memory transport, which calls them
+// instead of the server loop
+
+int simulation_init(void);
+
+void simulation_step(void);
+
+short watched_events(int socket);
+
 // Methods called when the server is running
 
 void serverLoop(void);
 
-int accept_newClient();
+// Handles POLLIN or POLLOUT of a client, true when the client was removed
+bool client_event(int socket, short events);
+
+bool is_listener(int socket);
+
+int accept_newClients(int listener);
+
+int accept_newClient(int listener);
+
+int peer_uid(int socket);
+
+int peer_name(int socket, char *name, int len);
+
+bool admin_uid(int uid);
+
+Client *connect_client(int socket, char *address, bool admin);
+
+Client *add_client(int socket, char *name);
+
+void tune_socket(int socket);
 
 int remove_client(int socket);
 
+void watch_socket(int socket, short events);
+
+void watch_events(int socket, short events);
+
+void unwatch_socket(int socket);
+
+void set_reading(Client *client, bool reading);
+
+void set_writing(Client *client, bool writing);
+
+void throttle_input(Client *client);
+
 int handle_client(int socket);
 
+int dispatch_messages(Client *client);
+
+// Methods for oversized messages
+
+bool is_oversized(Client *client, int len);
+
+int handle_oversized(Client *client, int len, long long now);
+
+int stream_message(Client *client, StringBuffer *piece, bool last);
+
+// Methods for rate limiting
+
+bool is_expensive_command(char *msg, int len);
+
+long long check_rate_limits(Client *client, char *msg, int len, long long now);
+
+void pause_client(Client *client, long long resumeAt);
+
+void resume_client(Timer *timer, void *data);
+
+// Methods for fair scheduling
+
+void ready_client(Client *client);
+
+void unready_client(Client *client);
+
+void serve_ready_clients(void);
+
+// Methods for file transfers
+
+struct Transfer;
+
+bool is_sending(Client *client);
+
+int start_transfer(Client *sender, Client *receiver, long long size);
+
+int pump_transfer(struct Transfer *transfer, bool fromSender);
+
+void finish_transfer(struct Transfer *transfer);
+
+void leave_transfer(Client *client);
+
+// Methods for the workers
+
+int run_job(Client *client, JobFunction run, StringBuffer *command);
+
+void complete_jobs(void);
+
+// Methods for the I/O threads
+
+void receive_pipeline(void);
+
+void remove_hung_up(void);
+
+// Methods for timers
+
+void keepalive_client(Timer *timer, void *data);
+
+void idle_client(Timer *timer, void *data);
+
+int defer_task(long long delay, void (*run)(void *data), void *data);
+
+// Methods for the memory budget
+
+void count_recent(Client *client, int bytes);
+
+void check_budget(Timer *timer, void *data);
+
+void pause_senders(void);
+
+void resume_senders(void);
+
+void drop_bulk(void);
+
+bool over_budget(int lane);
+
+void disconnect_biggest(void);
+
 // Methods for client input handeling
 
-StringBuffer *extract_message(Client *client);
+int next_message_length(Client *client);
+
+StringBuffer *peek_message(Client *client, int len);
+
+void consume_message(Client *client, int len);
+
+void consume_input(Client *client, int len);
+
+int client_count(void);
+
+Client *client_at(int index);
 
 Client *search_client(int socket);
 
+Client *search_client_by_name(char *name);
+
 int read_from_client(Client *client);
 
 int is_command(Client *client, StringBuffer *msg);
@@ -54,12 +196,39 @@ int broadcast_message(Client *client, StringBuffer *msg);
 
 int broadcast(StringBuffer *msg);
 
+int send_message(int socket, StringBuffer *msg);
+
+int send_message_lane(int socket, StringBuffer *msg, int lane);
+
+int flush_client(Client *client);
+
+// The client gets the broadcasts with sequence numbers
+void number_client(Client *client);
+
+bool is_command_name(char *syntax, int syn_len, char *name);
+
 int handle_command(Client *client, StringBuffer *msg);
 
 // Commands methods
 
 int command_list(Client *client, StringBuffer *command);
 
+int command_search(Client *client, StringBuffer *command);
+
 int command_nick(Client *client, StringBuffer *command);
 
 int command_msg(Client *client, StringBuffer *command);
+
+int command_send(Client *client, StringBuffer *command);
+
+int command_top(Client *client, StringBuffer *command);
+
+int command_memory(Client *client, StringBuffer *command);
+
+int command_roster(Client *client, StringBuffer *command);
+
+int command_session(Client *client, StringBuffer *command);
+
+int command_resume(Client *client, StringBuffer *command);
+
+void rename_client(Client *client, char *name);
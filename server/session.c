@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/random.h>
+
+#include "session.h"
+#include "server.h"
+#include "config.h"
+#include "outbox.h"
+#include "log.h"
+#include "federation.h"
+#include "../common/time/clock.h"
+
+#define SESSION_BUCKETS 1024
+
+// Random bytes of a token, sent as hex digits
+#define SESSION_TOKEN_BYTES 16
+
+// Missed broadcasts are sent in messages of about this size
+#define SESSION_REPLAY_CHUNK (16 * 1024)
+
+typedef struct Session {
+    char token[SESSION_TOKEN_BYTES * 2 + 1];
+    // NULL while the session waits for its client
+    Client *client;
+    // Nick of the lost client
+    char *name;
+    long long detachedAt;
+    // Expiry checks which are still pending
+    int checks;
+    // Chain of the token and of the waiting names
+    struct Session *next;
+    struct Session *nextWaiting;
+} Session;
+
+// A kept broadcast, "#<sequence> <message>\n"
+typedef struct Retained {
+    char *data;
+    int len;
+} Retained;
+
+// The broadcast with the number seq is kept at seq % config.sessionHistory
+static Retained *history;
+static long long firstSeq = 1;
+static long long lastSeq;
+static long historyBytes;
+
+static Session *sessions[SESSION_BUCKETS];
+static Session *waiting[SESSION_BUCKETS];
+static int attached;
+static int sessionCount;
+
+static bool
+sessions_enabled(void) {
+    return config.sessionMemory > 0 && config.sessionHistory > 0;
+}
+
+static unsigned int
+hash_string(char *string, bool ignoreCase) {
+    unsigned int hash = 5381;
+    for (; *string != '\0'; ++string)
+        hash = hash * 33 + (ignoreCase ? tolower((unsigned char)*string) : *string);
+    return hash % SESSION_BUCKETS;
+}
+
+static Session
+*session_find(char *token) {
+    Session *session = sessions[hash_string(token, false)];
+    for (; session != NULL; session = session->next) {
+        if (strcmp(session->token, token) == 0)
+            return session;
+    }
+    return NULL;
+}
+
+// The caller owns the name afterwards
+static void
+session_stopWaiting(Session *session) {
+    Session **p = &(waiting[hash_string(session->name, true)]);
+    while (*p != session)
+        p = &((*p)->nextWaiting);
+    *p = session->nextWaiting;
+    session->name = NULL;
+}
+
+static void
+session_free(Session *session) {
+    Session **p = &(sessions[hash_string(session->token, false)]);
+    while (*p != session)
+        p = &((*p)->next);
+    *p = session->next;
+    char *name = session->name;
+    if (name != NULL)
+        session_stopWaiting(session);
+    free(name);
+    free(session);
+    --sessionCount;
+}
+
+static void
+session_expire(void *data) {
+    Session *session = data;
+    --session->checks;
+    if (session->client != NULL || session->detachedAt + config.sessionTimeout * 1000LL > currentTimeMillis())
+        return;
+    // A later detach has its own check
+    if (session->checks == 0)
+        session_free(session);
+}
+
+static void
+session_reply(Client *client, Session *session, int lane) {
+    char line[80];
+    snprintf(line, sizeof(line), "/session %s %lld", session->token, lastSeq);
+    StringBuffer *msg = StringBuffer_construct();
+    StringBuffer_concat(msg, line);
+    send_message_lane(client->socket, msg, lane);
+    StringBuffer_free(msg);
+}
+
+static void
+session_error(Client *client, char *text) {
+    StringBuffer *msg = StringBuffer_construct();
+    StringBuffer_concat(msg, text);
+    send_message(client->socket, msg);
+    StringBuffer_free(msg);
+}
+
+// Sends the kept broadcasts after seq in the lane of the broadcasts, so
+// the following ones can't pass them
+static void
+session_replay(Client *client, long long seq) {
+    if (seq >= lastSeq)
+        return;
+    StringBuffer *msg = StringBuffer_construct();
+    if (seq + 1 < firstSeq) {
+        char line[80];
+        snprintf(line, sizeof(line), "INFO: %lld Nachrichten sind nicht mehr vorhanden.\n", firstSeq - seq - 1);
+        StringBuffer_concat(msg, line);
+        seq = firstSeq - 1;
+    }
+    for (++seq; seq <= lastSeq; ++seq) {
+        Retained *retained = &(history[seq % config.sessionHistory]);
+        StringBuffer_concat_n(msg, retained->data, retained->len);
+        if (msg->size >= SESSION_REPLAY_CHUNK || seq == lastSeq) {
+            // send_message_lane terminates it again
+            msg->size = msg->size - 1;
+            msg->buffer[msg->size] = '\0';
+            send_message_lane(client->socket, msg, LANE_BROADCAST);
+            msg->size = 0;
+            msg->buffer[0] = '\0';
+        }
+    }
+    StringBuffer_free(msg);
+}
+
+int
+session_record(char *msg, int len, char **numbered) {
+    if (!sessions_enabled())
+        return 0;
+    if (history == NULL) {
+        history = calloc(config.sessionHistory, sizeof(Retained));
+        if (history == NULL) {
+            perror("Insufficent memory!");
+            return 0;
+        }
+    }
+    char prefix[24];
+    int prefixLength = snprintf(prefix, sizeof(prefix), "#%lld ", lastSeq + 1);
+    int size = prefixLength + len;
+    // The newest broadcast is always kept
+    while (firstSeq <= lastSeq && (lastSeq - firstSeq + 1 >= config.sessionHistory || historyBytes + size > config.sessionMemory)) {
+        Retained *oldest = &(history[firstSeq % config.sessionHistory]);
+        historyBytes -= oldest->len;
+        free(oldest->data);
+        oldest->data = NULL;
+        ++firstSeq;
+    }
+    char *data = malloc(size);
+    if (data == NULL) {
+        perror("Insufficent memory!");
+        return 0;
+    }
+    memcpy(data, prefix, prefixLength);
+    memcpy(data + prefixLength, msg, len);
+    ++lastSeq;
+    Retained *retained = &(history[lastSeq % config.sessionHistory]);
+    retained->data = data;
+    retained->len = size;
+    historyBytes += size;
+    *numbered = data;
+    return size;
+}
+
+int
+session_clients(void) {
+    return attached;
+}
+
+bool
+session_nameReserved(char *name) {
+    Session *session = waiting[hash_string(name, true)];
+    for (; session != NULL; session = session->nextWaiting) {
+        if (strcasecmp(session->name, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+int
+session_start(Client *client) {
+    if (!sessions_enabled()) {
+        session_error(client, "ERROR: Sitzungen sind abgeschaltet!");
+        return EXIT_FAILURE;
+    }
+    // The token is sent again
+    if (client->session != NULL) {
+        session_reply(client, client->session, LANE_CONTROL);
+        return EXIT_SUCCESS;
+    }
+    unsigned char bytes[SESSION_TOKEN_BYTES];
+    if (getrandom(bytes, sizeof(bytes), 0) != sizeof(bytes)) {
+        LOG_ERRNO(LOG_SERVER, "getrandom failed", client->socket);
+        session_error(client, "ERROR: Die Sitzung konnte nicht erstellt werden!");
+        return EXIT_FAILURE;
+    }
+    Session *session = malloc(sizeof(Session));
+    if (session == NULL) {
+        perror("Insufficent memory!");
+        return EXIT_FAILURE;
+    }
+    int i;
+    for (i = 0; i < SESSION_TOKEN_BYTES; ++i)
+        sprintf(session->token + 2 * i, "%02x", bytes[i]);
+    session->client = client;
+    session->name = NULL;
+    session->detachedAt = 0;
+    session->checks = 0;
+    session->nextWaiting = NULL;
+    unsigned int bucket = hash_string(session->token, false);
+    session->next = sessions[bucket];
+    sessions[bucket] = session;
+    ++sessionCount;
+    client->session = session;
+    number_client(client);
+    ++attached;
+    session_reply(client, session, LANE_CONTROL);
+    return EXIT_SUCCESS;
+}
+
+int
+session_resume(Client *client, char *token, long long seq) {
+    if (!sessions_enabled()) {
+        session_error(client, "ERROR: Sitzungen sind abgeschaltet!");
+        return EXIT_FAILURE;
+    }
+    Session *session = session_find(token);
+    if (session == NULL) {
+        session_error(client, "ERROR: Unbekannte Sitzung!");
+        return EXIT_FAILURE;
+    }
+    // Only the missed broadcasts again
+    if (session->client == client) {
+        session_replay(client, seq);
+        session_reply(client, session, LANE_BROADCAST);
+        return EXIT_SUCCESS;
+    }
+    if (client->session != NULL) {
+        session_error(client, "ERROR: Du hast bereits eine Sitzung!");
+        return EXIT_FAILURE;
+    }
+    // The old connection wasn't noticed as lost yet
+    if (session->client != NULL) {
+        LOG(LOG_CLIENT, LOG_INFO, "Session was resumed by another connection", session->client->socket, NULL);
+        remove_client(session->client->socket);
+    }
+    // The name isn't reserved any more, the client takes it below
+    char *name = session->name;
+    if (name != NULL)
+        session_stopWaiting(session);
+    session->client = client;
+    client->session = session;
+    number_client(client);
+    ++attached;
+
+    session_replay(client, seq);
+    session_reply(client, session, LANE_BROADCAST);
+    if (name != NULL && strcasecmp(client->name, name) != 0) {
+        // Another server of the network gave it away
+        if (search_client_by_name(name) == NULL && !federation_nameTaken(name))
+            rename_client(client, name);
+        else
+            session_error(client, "ERROR: Der Nickname der Sitzung ist vergeben!");
+    }
+    free(name);
+    return EXIT_SUCCESS;
+}
+
+void
+session_detach(Client *client) {
+    Session *session = client->session;
+    if (session == NULL)
+        return;
+    client->session = NULL;
+    session->client = NULL;
+    --attached;
+    if (config.sessionTimeout == 0 || defer_task(config.sessionTimeout * 1000LL, &session_expire, session) == EXIT_FAILURE) {
+        session_free(session);
+        return;
+    }
+    ++session->checks;
+    session->detachedAt = currentTimeMillis();
+    // The name waits for the client
+    session->name = strdup(client->name);
+    unsigned int bucket = hash_string(session->name, true);
+    session->nextWaiting = waiting[bucket];
+    waiting[bucket] = session;
+}
+
+long
+session_memory(void) {
+    long memory = historyBytes + sessionCount * (long)sizeof(Session);
+    if (history != NULL)
+        memory += config.sessionHistory * (long)sizeof(Retained);
+    return memory;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "clientStruct.h"
+
+// Sessions survive a lost connection. Every broadcast gets a sequence
+// number and the last ones are kept, a client which comes back with the
+// token of its session gets its nick back and only the broadcasts it
+// missed.
+
+// Numbers the broadcast msg (terminated by the delimiter) and keeps it.
+// Returns the length of the numbered copy in numbered, 0 without sessions.
+int session_record(char *msg, int len, char **numbered);
+
+// Clients with a session, they get the numbered broadcasts
+int session_clients(void);
+
+// Whether a session waiting for its client holds the name
+bool session_nameReserved(char *name);
+
+// Gives the client a session, answers "/session <token> <sequence>"
+int session_start(Client *client);
+
+// Moves the session of token to the client, sends the broadcasts after
+// the sequence number seq and gives the nick back
+int session_resume(Client *client, char *token, long long seq);
+
+// The client is lost, its session waits for session.timeout seconds
+void session_detach(Client *client);
+
+// Bytes of the kept broadcasts and the sessions
+long session_memory(void);
+
+#endif
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sketch.h"
+#include "config.h"
+#include "../common/time/clock.h"
+
+// Addresses listed by /top
+#define TOP_REPORT 10
+
+// *******************************************
+// Count-min sketch
+// *******************************************
+
+unsigned long
+Sketch_hash(char *key) {
+    // FNV-1a
+    unsigned long hash = 14695981039346656037UL;
+    while (*key != '\0') {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+void
+Sketch_clear(Sketch *sketch) {
+    memset(sketch, 0, sizeof(Sketch));
+}
+
+// Column of a row, the rows use different combinations of the hash halves
+static inline unsigned int
+Sketch_column(unsigned long hash, int row) {
+    unsigned int h1 = (unsigned int)hash;
+    unsigned int h2 = (unsigned int)(hash >> 32) | 1;
+    return (h1 + row * h2) % SKETCH_WIDTH;
+}
+
+unsigned long
+Sketch_estimate(Sketch *sketch, unsigned long hash) {
+    unsigned long estimate = (unsigned long)-1;
+    int row;
+    for (row = 0; row < SKETCH_DEPTH; ++row) {
+        unsigned int count = sketch->counters[row][Sketch_column(hash, row)];
+        if (count < estimate)
+            estimate = count;
+    }
+    return estimate;
+}
+
+static void
+Sketch_siftDown(Sketch *sketch, int index) {
+    TopEntry *top = sketch->top;
+    while (true) {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+        if (left < sketch->topSize && top[left].count < top[smallest].count)
+            smallest = left;
+        if (right < sketch->topSize && top[right].count < top[smallest].count)
+            smallest = right;
+        if (smallest == index)
+            return;
+        TopEntry temp = top[index];
+        top[index] = top[smallest];
+        top[smallest] = temp;
+        index = smallest;
+    }
+}
+
+static void
+Sketch_siftUp(Sketch *sketch, int index) {
+    TopEntry *top = sketch->top;
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (top[parent].count <= top[index].count)
+            return;
+        TopEntry temp = top[index];
+        top[index] = top[parent];
+        top[parent] = temp;
+        index = parent;
+    }
+}
+
+unsigned long
+Sketch_add(Sketch *sketch, unsigned long hash, char *key, unsigned int amount) {
+    // Conservative update: only the smallest counters grow, which keeps
+    // the overestimation of colliding addresses low
+    unsigned long estimate = Sketch_estimate(sketch, hash) + amount;
+    int row;
+    for (row = 0; row < SKETCH_DEPTH; ++row) {
+        unsigned int *count = &(sketch->counters[row][Sketch_column(hash, row)]);
+        if (*count < estimate)
+            *count = estimate;
+    }
+
+    // Update the heap
+    int i;
+    for (i = 0; i < sketch->topSize; ++i) {
+        if (sketch->top[i].hash == hash) {
+            sketch->top[i].count = estimate;
+            Sketch_siftDown(sketch, i);
+            return estimate;
+        }
+    }
+    TopEntry *entry;
+    if (sketch->topSize < SKETCH_TOP) {
+        entry = &(sketch->top[sketch->topSize++]);
+    }
+    // Replaces the smallest of the top addresses
+    else if (estimate > sketch->top[0].count) {
+        entry = &(sketch->top[0]);
+    }
+    else {
+        return estimate;
+    }
+    strncpy(entry->key, key, SKETCH_KEY_SIZE - 1);
+    entry->key[SKETCH_KEY_SIZE - 1] = '\0';
+    entry->hash = hash;
+    entry->count = estimate;
+    if (entry == &(sketch->top[0]))
+        Sketch_siftDown(sketch, 0);
+    else
+        Sketch_siftUp(sketch, sketch->topSize - 1);
+    return estimate;
+}
+
+// *******************************************
+// Top talkers of the server
+// *******************************************
+
+static const char *metricNames[] = {"msgs", "bytes", "fanout", NULL};
+
+// The current and the last window of every metric
+static Sketch *windows[TOP_METRICS][2];
+static int current;
+static long long windowStart;
+
+int
+top_init(void) {
+    if (config.topWindow == 0)
+        return EXIT_SUCCESS;
+    int i, j;
+    for (i = 0; i < TOP_METRICS; ++i) {
+        for (j = 0; j < 2; ++j) {
+            windows[i][j] = calloc(1, sizeof(Sketch));
+            if (windows[i][j] == NULL) {
+                perror("Insufficent memory!");
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    windowStart = currentTimeMillis();
+    return EXIT_SUCCESS;
+}
+
+// Starts a new window when the current one is over, returns the weight of the last window
+static double
+top_rotate(long long now) {
+    long long window = config.topWindow * 1000LL;
+    if (now - windowStart >= window) {
+        // More than one window without traffic, the last window is empty too
+        bool skipped = (now - windowStart >= 2 * window);
+        current = 1 - current;
+        int i;
+        for (i = 0; i < TOP_METRICS; ++i) {
+            Sketch_clear(windows[i][current]);
+            if (skipped)
+                Sketch_clear(windows[i][1 - current]);
+        }
+        windowStart = now - (now - windowStart) % window;
+    }
+    // The sliding window covers the part of the last window which isn't over yet
+    return 1.0 - (double)(now - windowStart) / window;
+}
+
+static unsigned long
+top_sliding(int metric, unsigned long hash, double weight) {
+    return Sketch_estimate(windows[metric][current], hash)
+        + (unsigned long)(Sketch_estimate(windows[metric][1 - current], hash) * weight);
+}
+
+void
+top_count(Client *client, int metric, unsigned int amount) {
+    if (windows[metric][0] == NULL)
+        return;
+    top_rotate(currentTimeMillis());
+    Sketch_add(windows[metric][current], client->addressHash, client->address, amount);
+}
+
+unsigned long
+top_estimate(Client *client, int metric) {
+    if (windows[metric][0] == NULL)
+        return 0;
+    double weight = top_rotate(currentTimeMillis());
+    return top_sliding(metric, client->addressHash, weight);
+}
+
+static int
+top_compare(const void *a, const void *b) {
+    const TopEntry *e1 = a;
+    const TopEntry *e2 = b;
+    if (e1->count == e2->count)
+        return 0;
+    return (e1->count > e2->count ? -1 : 1);
+}
+
+StringBuffer
+*top_report(char *args) {
+    int metric = TOP_MESSAGES;
+    if (args != NULL) {
+        for (metric = 0; metricNames[metric] != NULL; ++metric) {
+            if (strcmp(args, metricNames[metric]) == 0)
+                break;
+        }
+    }
+    StringBuffer *msg = StringBuffer_construct();
+    if (windows[metric % TOP_METRICS][0] == NULL) {
+        StringBuffer_concat(msg, "ERROR: Die Top-Liste ist abgeschaltet!");
+        return msg;
+    }
+    if (metric == TOP_METRICS) {
+        StringBuffer_concat(msg, "ERROR: Unbekannte Metrik! Erlaubt sind msgs, bytes und fanout.");
+        return msg;
+    }
+    double weight = top_rotate(currentTimeMillis());
+
+    // Candidates are the top addresses of both windows
+    TopEntry candidates[2 * SKETCH_TOP];
+    int count = 0;
+    int i, j, k;
+    for (i = 0; i < 2; ++i) {
+        Sketch *sketch = windows[metric][i];
+        for (j = 0; j < sketch->topSize; ++j) {
+            for (k = 0; k < count; ++k) {
+                if (candidates[k].hash == sketch->top[j].hash)
+                    break;
+            }
+            if (k < count)
+                continue;
+            candidates[count] = sketch->top[j];
+            candidates[count].count = top_sliding(metric, candidates[count].hash, weight);
+            ++count;
+        }
+    }
+    qsort(candidates, count, sizeof(TopEntry), &top_compare);
+
+    char line[SKETCH_KEY_SIZE + 64];
+    snprintf(line, sizeof(line), "INFO: Top %s der letzten %d Sekunden:", metricNames[metric], config.topWindow);
+    StringBuffer_concat(msg, line);
+    for (i = 0; i < count && i < TOP_REPORT; ++i) {
+        snprintf(line, sizeof(line), "%s [%s] %lu", (i == 0 ? "" : ","), candidates[i].key, candidates[i].count);
+        StringBuffer_concat(msg, line);
+    }
+    return msg;
+}
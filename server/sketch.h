@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stdbool.h>
+#include "clientStruct.h"
+#include "../common/StringBuffer.h"
+
+// Finds the addresses producing the most traffic. Every metric is counted
+// by a count-min sketch, which never underestimates and has a fixed size
+// no matter how many addresses are counted. A small heap remembers the
+// addresses with the highest estimates of a window.
+
+#define SKETCH_DEPTH 4
+#define SKETCH_WIDTH 4096
+
+// Entries of the heap
+#define SKETCH_TOP 16
+
+// Longer addresses are truncated
+#define SKETCH_KEY_SIZE 64
+
+typedef struct TopEntry {
+    char key[SKETCH_KEY_SIZE];
+    unsigned long hash;
+    unsigned long count;
+} TopEntry;
+
+typedef struct Sketch {
+    unsigned int counters[SKETCH_DEPTH][SKETCH_WIDTH];
+    // Min heap, the root is the smallest of the top addresses
+    TopEntry top[SKETCH_TOP];
+    int topSize;
+} Sketch;
+
+unsigned long
+Sketch_hash(char *key);
+
+void
+Sketch_clear(Sketch *sketch);
+
+unsigned long
+Sketch_add(Sketch *sketch, unsigned long hash, char *key, unsigned int amount);
+
+unsigned long
+Sketch_estimate(Sketch *sketch, unsigned long hash);
+
+// Metrics of the top talkers
+#define TOP_MESSAGES 0
+#define TOP_BYTES    1
+#define TOP_FANOUT   2
+#define TOP_METRICS  3
+
+int top_init(void);
+
+void top_count(Client *client, int metric, unsigned int amount);
+
+unsigned long top_estimate(Client *client, int metric);
+
+StringBuffer *top_report(char *args);
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include "timerWheel.h"
+
+// Number of ticks covered by the slots of all levels
+#define WHEEL_RANGE (1LL << (WHEEL_BITS * WHEEL_LEVELS))
+
+void
+Timer_init(Timer *timer, TimerCallback callback, void *data) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->active = false;
+    timer->callback = callback;
+    timer->data = data;
+}
+
+static void
+List_init(Timer *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void
+List_append(Timer *head, Timer *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void
+List_unlink(Timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+void
+TimerWheel_init(TimerWheel *wheel, int resolution, long long now) {
+    wheel->resolution = resolution;
+    wheel->tick = now / resolution;
+    wheel->count = 0;
+    int level, slot;
+    for (level = 0; level < WHEEL_LEVELS; ++level) {
+        for (slot = 0; slot < WHEEL_SLOTS; ++slot) {
+            List_init(&(wheel->slots[level][slot]));
+        }
+        wheel->occupied[level] = 0;
+    }
+}
+
+// Put the timer in the slot of its expire tick relative to the current tick
+static void
+TimerWheel_place(TimerWheel *wheel, Timer *timer) {
+    long long delta = timer->expires - wheel->tick;
+    // Timers too far in the future wait in the last slot and are placed again later
+    long long expires = (delta >= WHEEL_RANGE ? wheel->tick + WHEEL_RANGE - 1 : timer->expires);
+    if (delta >= WHEEL_RANGE)
+        delta = WHEEL_RANGE - 1;
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1LL << (WHEEL_BITS * (level + 1)))) {
+        ++level;
+    }
+    int slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer->level = level;
+    timer->slot = slot;
+    List_append(&(wheel->slots[level][slot]), timer);
+    wheel->occupied[level] |= (1ULL << slot);
+}
+
+void
+TimerWheel_add(TimerWheel *wheel, Timer *timer, long long expires) {
+    if (timer->active)
+        TimerWheel_cancel(wheel, timer);
+
+    // Round up to the next tick, a timer never expires too early
+    long long tick = (expires + wheel->resolution - 1) / wheel->resolution;
+    // Already expired timers run on the next tick
+    if (tick <= wheel->tick)
+        tick = wheel->tick + 1;
+    timer->expires = tick;
+    timer->active = true;
+    TimerWheel_place(wheel, timer);
+    wheel->count++;
+}
+
+void
+TimerWheel_cancel(TimerWheel *wheel, Timer *timer) {
+    if (!timer->active)
+        return;
+    List_unlink(timer);
+    // Timers about to run are not part of a slot anymore
+    if (timer->level >= 0) {
+        Timer *head = &(wheel->slots[timer->level][timer->slot]);
+        if (head->next == head)
+            wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+    }
+    timer->active = false;
+    wheel->count--;
+}
+
+// Distance from index to the next set bit in bitmap, starting with index + 1
+static int
+next_occupied(uint64_t bitmap, int index) {
+    // Rotate the bitmap, so bit 0 is the slot after index
+    int shift = (index + 1) & WHEEL_MASK;
+    uint64_t rotated = (bitmap >> shift) | (shift == 0 ? 0 : bitmap << (WHEEL_SLOTS - shift));
+    return __builtin_ctzll(rotated) + 1;
+}
+
+// The next tick something must be done on (running timers or cascading a slot)
+static long long
+TimerWheel_nextTick(TimerWheel *wheel) {
+    long long next = -1;
+    int level;
+    for (level = 0; level < WHEEL_LEVELS; ++level) {
+        if (wheel->occupied[level] == 0)
+            continue;
+        int shift = WHEEL_BITS * level;
+        long long current = wheel->tick >> shift;
+        long long tick = (current + next_occupied(wheel->occupied[level], current & WHEEL_MASK)) << shift;
+        if (next == -1 || tick < next)
+            next = tick;
+    }
+    return next;
+}
+
+int
+TimerWheel_timeout(TimerWheel *wheel, long long now) {
+    if (wheel->count == 0)
+        return -1;
+    long long next = TimerWheel_nextTick(wheel) * wheel->resolution;
+    if (next <= now)
+        return 0;
+    return (next - now > 0x7FFFFFFF ? 0x7FFFFFFF : (int)(next - now));
+}
+
+// Move all timers of the slot to the lower levels
+static void
+TimerWheel_cascade(TimerWheel *wheel, int level, int slot) {
+    Timer *head = &(wheel->slots[level][slot]);
+    Timer list;
+    List_init(&list);
+    // Take the whole list, because the timers can be placed in the same slot again
+    if (head->next != head) {
+        list.next = head->next;
+        list.prev = head->prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        List_init(head);
+    }
+    wheel->occupied[level] &= ~(1ULL << slot);
+    while (list.next != &list) {
+        Timer *timer = list.next;
+        List_unlink(timer);
+        TimerWheel_place(wheel, timer);
+    }
+}
+
+// Run all timers of the current tick
+static void
+TimerWheel_run(TimerWheel *wheel) {
+    int slot = wheel->tick & WHEEL_MASK;
+    Timer *head = &(wheel->slots[0][slot]);
+    if (head->next == head)
+        return;
+    // Detach the slot, the callbacks may add or cancel any timers
+    Timer list;
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    List_init(head);
+    wheel->occupied[0] &= ~(1ULL << slot);
+
+    Timer *timer;
+    for (timer = list.next; timer != &list; timer = timer->next) {
+        timer->level = -1;
+    }
+    while (list.next != &list) {
+        timer = list.next;
+        List_unlink(timer);
+        timer->active = false;
+        wheel->count--;
+        // The timer may be freed by the callback
+        timer->callback(timer, timer->data);
+    }
+}
+
+void
+TimerWheel_advance(TimerWheel *wheel, long long now) {
+    long long target = now / wheel->resolution;
+    while (wheel->tick < target) {
+        long long next = TimerWheel_nextTick(wheel);
+        // Nothing to do until the target -> skip the ticks
+        if (next == -1 || next > target) {
+            wheel->tick = target;
+            break;
+        }
+        wheel->tick = next;
+        // Cascade the slots starting on this tick, the highest level first
+        int level;
+        for (level = WHEEL_LEVELS - 1; level > 0; --level) {
+            int shift = WHEEL_BITS * level;
+            if ((wheel->tick & ((1LL << shift) - 1)) == 0)
+                TimerWheel_cascade(wheel, level, (wheel->tick >> shift) & WHEEL_MASK);
+        }
+        TimerWheel_run(wheel);
+    }
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hashed hierarchical timer wheel
+// Every level has WHEEL_SLOTS slots, one slot of a level covers a complete
+// rotation of the level below. Adding and cancelling a timer is O(1), timers
+// of higher levels are cascaded down when their slot is reached.
+
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+struct Timer;
+
+typedef void (*TimerCallback)(struct Timer *timer, void *data);
+
+typedef struct Timer {
+    // Neighbours in the slot list
+    struct Timer *next;
+    struct Timer *prev;
+    // Tick the timer expires on
+    long long expires;
+    // Position in the wheel, level is -1 while the timer is running
+    int level;
+    int slot;
+    bool active;
+    TimerCallback callback;
+    void *data;
+} Timer;
+
+typedef struct TimerWheel {
+    // Milliseconds per tick
+    int resolution;
+    // Last processed tick
+    long long tick;
+    int count;
+    // Sentinel of every slot list
+    Timer slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    // Bitmap of the slots containing timers
+    uint64_t occupied[WHEEL_LEVELS];
+} TimerWheel;
+
+void
+Timer_init(Timer *timer, TimerCallback callback, void *data);
+
+void
+TimerWheel_init(TimerWheel *wheel, int resolution, long long now);
+
+void
+TimerWheel_add(TimerWheel *wheel, Timer *timer, long long expires);
+
+void
+TimerWheel_cancel(TimerWheel *wheel, Timer *timer);
+
+int
+TimerWheel_timeout(TimerWheel *wheel, long long now);
+
+void
+TimerWheel_advance(TimerWheel *wheel, long long now);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tokenBucket.h"
+
+void
+TokenBucket_init(TokenBucket *bucket, int rate, int burst, long long now) {
+    bucket->rate = rate;
+    // A bucket must at least hold the tokens for one second
+    bucket->burst = (burst < rate ? rate : burst);
+    bucket->tokens = bucket->burst;
+    bucket->lastRefill = now;
+}
+
+static void
+TokenBucket_refill(TokenBucket *bucket, long long now) {
+    if (now <= bucket->lastRefill)
+        return;
+    bucket->tokens += (now - bucket->lastRefill) * bucket->rate / 1000.0;
+    if (bucket->tokens > bucket->burst)
+        bucket->tokens = bucket->burst;
+    bucket->lastRefill = now;
+}
+
+long long
+TokenBucket_delay(TokenBucket *bucket, double amount, long long now) {
+    // Disabled bucket
+    if (bucket->rate <= 0)
+        return 0;
+    TokenBucket_refill(bucket, now);
+    // Amounts larger than the bucket are allowed when the bucket is full,
+    // otherwise they would never pass
+    if (amount > bucket->burst)
+        amount = bucket->burst;
+    if (bucket->tokens >= amount)
+        return 0;
+    // Round up, so the tokens are really there after the delay
+    return (long long)((amount - bucket->tokens) * 1000.0 / bucket->rate) + 1;
+}
+
+void
+TokenBucket_consume(TokenBucket *bucket, double amount) {
+    if (bucket->rate <= 0)
+        return;
+    // May become negative for large amounts -> the next message has to wait longer
+    bucket->tokens -= amount;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+// A bucket is refilled with rate tokens per second up to burst tokens.
+// A rate of 0 disables the bucket.
+typedef struct TokenBucket {
+    double tokens;
+    double rate;
+    double burst;
+    long long lastRefill;
+} TokenBucket;
+
+void
+TokenBucket_init(TokenBucket *bucket, int rate, int burst, long long now);
+
+long long
+TokenBucket_delay(TokenBucket *bucket, double amount, long long now);
+
+void
+TokenBucket_consume(TokenBucket *bucket, double amount);
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "transfer.h"
+#include "budget.h"
+#include "../common/time/clock.h"
+
+Transfer
+*Transfer_construct(Client *sender, Client *receiver, long long size, bool zeroCopy) {
+    Transfer *transfer = malloc(sizeof(Transfer));
+    if (transfer == NULL) {
+        perror("Insufficent memory!");
+        return NULL;
+    }
+    if (initTransferStage(&(transfer->stage), TRANSFER_STAGE, zeroCopy) == EXIT_FAILURE) {
+        free(transfer);
+        return NULL;
+    }
+    transfer->sender = sender->socket;
+    transfer->receiver = receiver->socket;
+    transfer->size = size;
+    transfer->remaining = size;
+    transfer->start = currentTimeMillis();
+    transfer->queued = false;
+    ChunkChain_init(&(transfer->head));
+    ChunkChain_account(&(transfer->head), budget_account(BUDGET_HELD));
+    return transfer;
+}
+
+int
+Transfer_pump(Transfer *transfer, bool fromSender, int budget) {
+    TransferStage *stage = &(transfer->stage);
+    int moved = 0;
+    while (moved < budget) {
+        // Stage the next part of the file
+        if (stage->size == 0 && transfer->remaining > 0) {
+            int len = (transfer->remaining < stage->capacity ? transfer->remaining : stage->capacity);
+            int res;
+            // Sender left, the receiver gets zeros for the rest of the file
+            if (transfer->sender < 0)
+                res = transferPad(stage, len);
+            // Only the events of the sender read from it
+            else if (!fromSender)
+                break;
+            else
+                res = transferFill(stage, transfer->sender, len);
+            if (res == 0)
+                return TRANSFER_SENDER_CLOSED;
+            if (res < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return TRANSFER_WAITING;
+                return (transfer->sender < 0 ? TRANSFER_RECEIVER_CLOSED : TRANSFER_SENDER_CLOSED);
+            }
+            transfer->remaining -= res;
+        }
+        if (stage->size > 0) {
+            // Receiver left, the rest of the file is dropped
+            if (transfer->receiver < 0) {
+                moved += stage->size;
+                stage->size = 0;
+                stage->offset = 0;
+            }
+            // The file continues behind the queued messages
+            else if (transfer->queued) {
+                return TRANSFER_WAITING;
+            }
+            else {
+                int res = transferDrain(stage, transfer->receiver);
+                if (res < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return TRANSFER_WAITING;
+                    return TRANSFER_RECEIVER_CLOSED;
+                }
+                moved += res;
+            }
+        }
+        if (Transfer_isDone(transfer))
+            return TRANSFER_DONE;
+        // Nothing more moves before the queued messages are sent
+        if (transfer->queued)
+            return TRANSFER_WAITING;
+    }
+    return TRANSFER_WAITING;
+}
+
+void
+Transfer_senderLeft(Transfer *transfer) {
+    transfer->sender = -1;
+}
+
+int
+Transfer_receiverLeft(Transfer *transfer) {
+    transfer->receiver = -1;
+    transfer->queued = false;
+    ChunkChain_clear(&(transfer->head));
+    // Data in a pipe can't be dropped without reading it, so the rest is read into a buffer
+    freeTransferStage(&(transfer->stage));
+    return initTransferStage(&(transfer->stage), TRANSFER_STAGE, false);
+}
+
+bool
+Transfer_wantsInput(Transfer *transfer) {
+    return transfer->sender >= 0 && transfer->remaining > 0 && transfer->stage.size == 0;
+}
+
+bool
+Transfer_wantsOutput(Transfer *transfer) {
+    return transfer->receiver >= 0 && !transfer->queued && (transfer->stage.size > 0 || (transfer->sender < 0 && transfer->remaining > 0));
+}
+
+bool
+Transfer_isDone(Transfer *transfer) {
+    if (transfer->sender < 0 && transfer->receiver < 0)
+        return true;
+    return transfer->remaining == 0 && transfer->stage.size == 0 && !transfer->queued;
+}
+
+void
+Transfer_free(Transfer *transfer) {
+    freeTransferStage(&(transfer->stage));
+    ChunkChain_clear(&(transfer->head));
+    free(transfer);
+}
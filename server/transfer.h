@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <stdbool.h>
+#include "clientStruct.h"
+#include "../common/network/network.h"
+
+// A file sent with "/send nick bytes". The bytes following the command on
+// the connection of the sender are relayed to the receiver, without
+// copying them to user space when the stage is a pipe. Every turn moves a
+// limited number of bytes, so the server loop stays responsive.
+
+// Bytes staged at once
+#define TRANSFER_STAGE (256 * 1024)
+
+// Bytes moved per event of a socket
+#define TRANSFER_TURN (256 * 1024)
+
+// Results of Transfer_pump
+#define TRANSFER_DONE            0
+#define TRANSFER_WAITING         1
+#define TRANSFER_SENDER_CLOSED   2
+#define TRANSFER_RECEIVER_CLOSED 3
+
+typedef struct Transfer {
+    // Sockets of the clients, -1 after a client left
+    int sender;
+    int receiver;
+    long long size;
+    // Bytes not taken from the sender yet
+    long long remaining;
+    TransferStage stage;
+    long long start;
+    // Messages queued for the receiver before the file are still sent,
+    // the stage waits for them
+    bool queued;
+    // Announcement and beginning of the file, queued once the receiver
+    // took the older messages
+    ChunkChain head;
+} Transfer;
+
+Transfer
+*Transfer_construct(Client *sender, Client *receiver, long long size, bool zeroCopy);
+
+int
+Transfer_pump(Transfer *transfer, bool fromSender, int budget);
+
+void
+Transfer_senderLeft(Transfer *transfer);
+
+int
+Transfer_receiverLeft(Transfer *transfer);
+
+bool
+Transfer_wantsInput(Transfer *transfer);
+
+bool
+Transfer_wantsOutput(Transfer *transfer);
+
+bool
+Transfer_isDone(Transfer *transfer);
+
+void
+Transfer_free(Transfer *transfer);
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "transport.h"
+#include "bufferPool.h"
+
+// *******************************************
+// Real sockets
+// *******************************************
+
+static int
+socket_readv(int socket, struct iovec *iov, int iovcnt) {
+    return readv(socket, iov, iovcnt);
+}
+
+static int
+socket_writev(int socket, struct iovec *iov, int iovcnt) {
+    // A closed peer mustn't raise SIGPIPE
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = iov;
+    header.msg_iovlen = iovcnt;
+    int written;
+    do {
+        written = sendmsg(socket, &header, MSG_NOSIGNAL);
+    } while (written < 0 && errno == EINTR);
+    return written;
+}
+
+static void
+socket_shutdown(int socket) {
+    shutdown(socket, SHUT_RDWR);
+}
+
+static void
+socket_close(int socket) {
+    close(socket);
+}
+
+Transport socketTransport = {"socket", &socket_readv, &socket_writev, &socket_shutdown, &socket_close};
+
+Transport *transport = &socketTransport;
+
+// *******************************************
+// Sockets in memory
+// *******************************************
+
+typedef struct MemorySocket {
+    bool open;
+    // The client sent its last message
+    bool hungUp;
+    // Sent by the client, not read by the server yet
+    ChunkChain input;
+    // Bytes written by the server and not read by the client yet
+    int pending;
+    // Most pending bytes, 0 for a client which reads everything at once
+    int window;
+    long long received;
+} MemorySocket;
+
+static MemorySocket *sockets;
+static int socketCount;
+static int socketCapacity;
+
+// FNV-1a of everything the server wrote, equal for equal simulations
+static unsigned long checksum = 14695981039346656037UL;
+
+static MemorySocket
+*memory_socket(int socket) {
+    int index = socket - MEMORY_FIRST_SOCKET;
+    if (index < 0 || index >= socketCount || !sockets[index].open)
+        return NULL;
+    return &(sockets[index]);
+}
+
+int
+Memory_open(int window) {
+    if (socketCount == socketCapacity) {
+        int newCapacity = (socketCapacity == 0 ? 1024 : socketCapacity << 1);
+        MemorySocket *newSockets = realloc(sockets, sizeof(MemorySocket) * newCapacity);
+        if (newSockets == NULL) {
+            perror("Insufficent memory!");
+            return -1;
+        }
+        sockets = newSockets;
+        socketCapacity = newCapacity;
+    }
+    MemorySocket *s = &(sockets[socketCount]);
+    s->open = true;
+    s->hungUp = false;
+    ChunkChain_init(&(s->input));
+    s->pending = 0;
+    s->window = window;
+    s->received = 0;
+    return MEMORY_FIRST_SOCKET + socketCount++;
+}
+
+int
+Memory_feed(int socket, char *data, int len) {
+    MemorySocket *s = memory_socket(socket);
+    if (s == NULL)
+        return EXIT_FAILURE;
+    return ChunkChain_append(&(s->input), data, len);
+}
+
+void
+Memory_hangUp(int socket) {
+    MemorySocket *s = memory_socket(socket);
+    if (s != NULL)
+        s->hungUp = true;
+}
+
+int
+Memory_read(int socket, int len) {
+    MemorySocket *s = memory_socket(socket);
+    if (s == NULL)
+        return 0;
+    if (len > s->pending)
+        len = s->pending;
+    s->pending -= len;
+    return len;
+}
+
+int
+Memory_pending(int socket) {
+    MemorySocket *s = memory_socket(socket);
+    return (s == NULL ? 0 : s->pending);
+}
+
+long long
+Memory_received(int socket) {
+    MemorySocket *s = memory_socket(socket);
+    return (s == NULL ? 0 : s->received);
+}
+
+unsigned long
+Memory_checksum(void) {
+    return checksum;
+}
+
+static int
+memory_readv(int socket, struct iovec *iov, int iovcnt) {
+    MemorySocket *s = memory_socket(socket);
+    if (s == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    if (s->input.size == 0) {
+        if (s->hungUp)
+            return 0;
+        errno = EAGAIN;
+        return -1;
+    }
+    int total = 0;
+    int i;
+    for (i = 0; i < iovcnt && s->input.size > 0; ++i) {
+        int len = (s->input.size < (int)iov[i].iov_len ? s->input.size : (int)iov[i].iov_len);
+        ChunkChain_copy(&(s->input), iov[i].iov_base, len);
+        ChunkChain_consume(&(s->input), len);
+        total += len;
+    }
+    return total;
+}
+
+static int
+memory_writev(int socket, struct iovec *iov, int iovcnt) {
+    MemorySocket *s = memory_socket(socket);
+    if (s == NULL || s->hungUp) {
+        errno = EPIPE;
+        return -1;
+    }
+    int space = (s->window > 0 ? s->window - s->pending : -1);
+    if (space == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    int total = 0;
+    int i;
+    for (i = 0; i < iovcnt && space != 0; ++i) {
+        int len = iov[i].iov_len;
+        if (space > 0 && len > space)
+            len = space;
+        unsigned char *p = iov[i].iov_base;
+        int j;
+        for (j = 0; j < len; ++j) {
+            checksum = (checksum ^ p[j]) * 1099511628211UL;
+        }
+        total += len;
+        if (space > 0)
+            space -= len;
+    }
+    if (s->window > 0)
+        s->pending += total;
+    s->received += total;
+    return total;
+}
+
+static void
+memory_shutdown(int socket) {
+    Memory_hangUp(socket);
+}
+
+static void
+memory_close(int socket) {
+    MemorySocket *s = memory_socket(socket);
+    if (s == NULL)
+        return;
+    ChunkChain_clear(&(s->input));
+    s->open = false;
+}
+
+Transport memoryTransport = {"memory", &memory_readv, &memory_writev, &memory_shutdown, &memory_close};
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <sys/uio.h>
+
+// The I/O of the client sockets. The server uses real sockets, the
+// memory transport lets a simulation feed the clients and take their
+// output without any system call.
+typedef struct Transport {
+    const char *name;
+    // Like readv, returns 0 when the peer closed the connection
+    int (*readv)(int socket, struct iovec *iov, int iovcnt);
+    // Like writev, but never raises SIGPIPE. Returns -1 with EAGAIN when
+    // the socket is full
+    int (*writev)(int socket, struct iovec *iov, int iovcnt);
+    void (*shutdown)(int socket);
+    void (*close)(int socket);
+} Transport;
+
+extern Transport socketTransport;
+extern Transport memoryTransport;
+
+// Transport of the client sockets, the socket transport by default
+extern Transport *transport;
+
+// Sockets of the memory transport start here, so they are never mistaken
+// for a real file descriptor
+#define MEMORY_FIRST_SOCKET 1024
+
+int Memory_open(int window);
+
+int Memory_feed(int socket, char *data, int len);
+
+void Memory_hangUp(int socket);
+
+int Memory_read(int socket, int len);
+
+int Memory_pending(int socket);
+
+long long Memory_received(int socket);
+
+unsigned long Memory_checksum(void);
+
+#endif
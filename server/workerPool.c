@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "workerPool.h"
+
+// Jobs waiting for a worker, first in first out
+static Job *pendingHead;
+static Job *pendingTail;
+static pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pendingSignal = PTHREAD_COND_INITIALIZER;
+
+// Finished jobs, collected by the server loop
+static Job *completed;
+static pthread_mutex_t completedLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Readable when jobs are completed
+static int eventFd = -1;
+
+static void
+*WorkerPool_run(void *data) {
+    (void)data;
+    while (1) {
+        pthread_mutex_lock(&pendingLock);
+        while (pendingHead == NULL)
+            pthread_cond_wait(&pendingSignal, &pendingLock);
+        Job *job = pendingHead;
+        pendingHead = job->next;
+        if (pendingHead == NULL)
+            pendingTail = NULL;
+        pthread_mutex_unlock(&pendingLock);
+
+        job->result = job->run(job->snapshot, job->args, &(job->cached));
+
+        pthread_mutex_lock(&completedLock);
+        job->next = completed;
+        completed = job;
+        pthread_mutex_unlock(&completedLock);
+        // Wake up the server loop
+        uint64_t one = 1;
+        if (write(eventFd, &one, sizeof(one)) != sizeof(one))
+            perror("Can't wake up the server!");
+    }
+    return NULL;
+}
+
+int
+WorkerPool_init(int threads) {
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0) {
+        perror("Can't create eventfd!");
+        return -1;
+    }
+    int i;
+    for (i = 0; i < threads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &WorkerPool_run, NULL) != 0) {
+            perror("Can't start worker!");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    return eventFd;
+}
+
+int
+WorkerPool_submit(int socket, long clientId, JobFunction run, char *args, RosterSnapshot *snapshot) {
+    Job *job = malloc(sizeof(Job));
+    if (job == NULL) {
+        perror("Insufficent memory!");
+        return EXIT_FAILURE;
+    }
+    job->next = NULL;
+    job->socket = socket;
+    job->clientId = clientId;
+    job->run = run;
+    job->args = (args == NULL ? NULL : strdup(args));
+    job->snapshot = snapshot;
+    job->result = NULL;
+    job->cached = false;
+
+    pthread_mutex_lock(&pendingLock);
+    if (pendingTail == NULL)
+        pendingHead = job;
+    else
+        pendingTail->next = job;
+    pendingTail = job;
+    pthread_cond_signal(&pendingSignal);
+    pthread_mutex_unlock(&pendingLock);
+    return EXIT_SUCCESS;
+}
+
+Job
+*WorkerPool_completed(void) {
+    uint64_t count;
+    if (read(eventFd, &count, sizeof(count)) < 0) {
+        // Nothing completed
+    }
+    pthread_mutex_lock(&completedLock);
+    Job *jobs = completed;
+    completed = NULL;
+    pthread_mutex_unlock(&completedLock);
+
+    // Restore the order of completion
+    Job *ordered = NULL;
+    while (jobs != NULL) {
+        Job *next = jobs->next;
+        jobs->next = ordered;
+        ordered = jobs;
+        jobs = next;
+    }
+    return ordered;
+}
+
+void
+Job_free(Job *job) {
+    if (job->result != NULL && !job->cached)
+        StringBuffer_free(job->result);
+    roster_release(job->snapshot);
+    free(job->args);
+    free(job);
+}
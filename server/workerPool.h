@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2012 Kilian Gärtner
+ * 
+ * This file is part of Gnuddels.
+ * 
+ * Gnuddels is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ * 
+ * Gnuddels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Gnuddels.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include "roster.h"
+#include "../common/StringBuffer.h"
+
+// Threads computing the responses of expensive commands. A job only reads
+// its snapshot and its arguments, the result is collected by the server
+// loop, which is woken by an eventfd.
+
+typedef StringBuffer *(*JobFunction)(RosterSnapshot *snapshot, char *args, bool *cached);
+
+typedef struct Job {
+    struct Job *next;
+    // Client waiting for the result, the id detects a reused socket
+    int socket;
+    long clientId;
+    JobFunction run;
+    char *args;
+    RosterSnapshot *snapshot;
+    StringBuffer *result;
+    // The result belongs to the snapshot
+    bool cached;
+} Job;
+
+int
+WorkerPool_init(int threads);
+
+int
+WorkerPool_submit(int socket, long clientId, JobFunction run, char *args, RosterSnapshot *snapshot);
+
+Job
+*WorkerPool_completed(void);
+
+void
+Job_free(Job *job);
+
+#endif